@@ -25,11 +25,15 @@
 
 typedef struct expression Expression;
 typedef struct Statement Statement;
+typedef struct AstChunk AstChunk;
 
 
 
 /**
  * header file for data structures related to abstract syntax tree (i.e., "ast")
+ *
+ * statements and expressions are only as large as the variant their
+ * type selects, so nodes are passed around by pointer and never copied
  */
 
 typedef enum {
@@ -104,10 +108,9 @@ typedef struct {
 
 typedef struct {
   int argCount;
-  int capacity;
   Token token;
   Identifier name;
-  Expression* args; 
+  Expression** args;
 } CallExpression;
 
 /**
@@ -134,28 +137,31 @@ struct expression{
 
 typedef struct {
   Token token;
-  Expression expression;
+  Expression* expression;
 } ReturnStatement;
 
 
 typedef struct {
   Token token;
   Identifier name;
-  Expression value;
+  Expression* value;
 } VarStatement;
 
 typedef struct {
   Token token;
-  Expression expression;
+  Expression* expression;
 } ExpressionStatement;
 
 /**
- * dynamic array of statements
+ * array of statements
+ *
+ * the statements parse() returns also own the chunks every node of the
+ * tree was allocated from, nested blocks leave chunks NULL
  */
 typedef struct {
   int count;
-  int capacity;
-  Statement* stmts;
+  Statement** stmts;
+  AstChunk* chunks;
 } Statements;
 
 
@@ -169,7 +175,7 @@ typedef struct {
 */
 typedef struct {
   Token token;
-  Expression condition;
+  Expression* condition;
   BlockStatement block;
   BlockStatement elseBlock;
 } IfStatement;
@@ -179,7 +185,7 @@ typedef struct {
  */
 typedef struct {
   Token token;
-  Expression condition;
+  Expression* condition;
   BlockStatement block;
 } WhileStatement;
 
@@ -189,16 +195,17 @@ typedef struct {
  */
 typedef struct {
   Token token;
-  Expression value;
+  Expression* value;
   Identifier name;
 } AssignStatement;
 
 /**
- * declaring functions
+ * declaring functions, the parameters are kept
+ * in an array of their own
  */
 typedef struct {
   Token token;
-  Identifier args[ARGS_MAX];
+  Identifier* args;
   BlockStatement block;
   int argCount;
   Identifier name;
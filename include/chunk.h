@@ -2,6 +2,7 @@
 #define MCSCRIPT_VM_CHUNK_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <value.h>
 
 /**
@@ -13,6 +14,11 @@ typedef enum {
    * will be followed with parameters that are the index into the ValueArray
    */
   OP_CONSTANT,
+  /**
+   * OP_CONSTANT with a three-byte index, for chunks with more than
+   * 256 constants
+   */
+  OP_CONSTANT_LONG,
   OP_NEGATE,
   OP_ADD,
   OP_SUBTRACT,
@@ -24,22 +30,129 @@ typedef enum {
   OP_LESS,
   OP_GREATER,
   OP_EQUAL,
+  /**
+   * global instructions are followed by a two-byte slot in vm->globals
+   */
   OP_DEFINE_GLOBAL,
   OP_GET_GLOBAL,
+  /**
+   * followed by a one-byte operand: the local's slot in the current frame
+   */
   OP_GET_LOCAL,
   OP_SET_GLOBAL,
   OP_SET_LOCAL,
-  OP_MARK_LOCAL,
   OP_JUMP,
   OP_JUMP_IF_FALSE,
   OP_JUMP_IF_TRUE,
   OP_LOOP,
   OP_CALL,
+  /**
+   * a call in tail position, followed by the argument count
+   * it reuses the current frame for a script function callee
+   */
+  OP_TAIL_CALL,
+  /**
+   * a call to the native held by a global, followed by the global's
+   * two-byte slot and the argument count. the callee is never pushed,
+   * and the result takes the first argument's slot
+   */
+  OP_CALL_NATIVE,
   OP_POP,
   OP_NULL,
-  OP_RETURN // return instruction (i.e., pop function off stack and return to next instruction)
+  OP_RETURN, // return instruction (i.e., pop function off stack and return to next instruction)
+
+  /**
+   * jumps with a three-byte offset, used when a function body
+   * is too large for the two-byte forms
+   */
+  OP_JUMP_LONG,
+  OP_JUMP_IF_FALSE_LONG,
+  OP_JUMP_IF_TRUE_LONG,
+  OP_LOOP_LONG,
+
+  /**
+   * superinstructions (see peephole.c)
+   * each one does the work of its component instructions in a single
+   * dispatch, and its operands are the components' operands in order.
+   * a jump inside a superinstruction is relative to the end of the whole
+   * superinstruction
+   */
+  OP_GET_LOCAL_GET_LOCAL,
+  OP_GET_LOCAL_CONSTANT,
+  OP_GET_LOCAL_CONSTANT_ADD,
+  OP_GET_LOCAL_CONSTANT_SUBTRACT,
+  OP_ADD_SET_LOCAL,
+  OP_LESS_JUMP_IF_FALSE_POP,
+  OP_GREATER_JUMP_IF_FALSE_POP,
+  OP_GET_GLOBAL_CALL,
+  OP_GET_LOCAL_CALL,
+  OP_GET_GLOBAL_TAIL_CALL,
+
+  /**
+   * quickened forms (never emitted by the compiler)
+   * run() rewrites a generic arithmetic instruction into one of these
+   * once it sees number operands, and back again if that stops holding
+   */
+  OP_ADD_NUM,
+  OP_SUBTRACT_NUM,
+  OP_MULTIPLY_NUM,
+  OP_DIVIDE_NUM,
+  OP_LESS_NUM,
+  OP_GREATER_NUM,
+
+  /**
+   * register instructions (three-address code over frame slots)
+   * arithmetic is followed by a destination slot and two RK operands,
+   * the branches by two RK operands and a forward jump offset
+   */
+  OP_ADD_R,
+  OP_SUBTRACT_R,
+  OP_MULTIPLY_R,
+  OP_DIVIDE_R,
+  OP_LESS_R,
+  OP_GREATER_R,
+  OP_JUMP_IF_NOT_LESS_R,
+  OP_JUMP_IF_NOT_GREATER_R,
+
+  /**
+   * back-edges of loops that have a compiled trace (never emitted by
+   * the compiler). the trace compiler rewrites OP_LOOP and OP_LOOP_LONG
+   * into these, and they enter the trace instead of jumping
+   */
+  OP_LOOP_TRACE,
+  OP_LOOP_LONG_TRACE
 } OpCode;
 
+/**
+ * a register instruction's source operand is either a frame slot or,
+ * with RK_CONSTANT set, an index into the chunk's constants.
+ * only slots and constant indices up to RK_MAX can be encoded
+ */
+#define RK_CONSTANT 0x80
+#define RK_MAX 0x7f
+#define IS_RK_CONSTANT(operand) ((operand) & RK_CONSTANT)
+
+#define CONSTANT_LONG_MAX 0xffffff
+#define JUMP_LONG_MAX 0xffffff
+
+
+/**
+ * source line of the code from offset up to the next run
+ */
+typedef struct {
+  int offset;
+  int line;
+} LineRun;
+
+/**
+ * run-length encoded source lines, one run
+ * per stretch of code from the same line
+ */
+typedef struct {
+  int count;
+  int capacity;
+  LineRun* runs;
+} LineTable;
 
 /**
  * represents a dynamic array of OpCodes (see enum in "common.h")
@@ -49,8 +162,16 @@ typedef struct {
   int capacity;
   int count;
   uint8_t* code;
-  int* lines;
+  LineTable lines;
   ValueArray constants;
+
+  /**
+   * open-addressed hash of number and string constants to their
+   * index in constants (stored as index + 1, zero is empty),
+   * so repeated literals share one entry
+   */
+  int* constantIndex;
+  int indexCapacity;
 } Chunk;
 
 /**
@@ -60,19 +181,72 @@ void initChunk(Chunk* chunk);
 
 /**
  * add a single op code (one byte long) to chunk
- * also add line number
+ * also add line number. a byte the chunk can't grow to hold is
+ * dropped, reallocate has flagged the heap out of memory then
  */
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 
 /**
  * add a value to the constants array 
- * returns the index where data is stored
+ * returns the index where data is stored, which is the existing
+ * entry's index when an equal number or string is already there,
+ * or -1 if there is no memory for it
  */
 int addConstant(Chunk* chunk, Value val);
 
+/**
+ * find a string constant by its characters
+ * returns -1 if there is none
+ */
+int findStringConstant(const Chunk* chunk, const char* chars, int length, uint32_t hash);
+
 /**
  * free up dynamic arrays stored on the heap
  */
 void freeChunk(Chunk* chunk);
 
+void initLineTable(LineTable* lines);
+void freeLineTable(LineTable* lines);
+
+/**
+ * record the line of the byte at offset, offsets
+ * must be written in increasing order
+ */
+void writeLine(LineTable* lines, int offset, int line);
+
+/**
+ * the line of the byte at offset (binary search over the runs),
+ * 0 if offset comes before the first run
+ */
+int getLine(const LineTable* lines, int offset);
+
+/**
+ * number of operand bytes following an opcode
+ */
+int operandSize(uint8_t instruction);
+
+/**
+ * total size of an instruction (opcode plus operands)
+ */
+int instructionSize(uint8_t instruction);
+
+/**
+ * the offset an instruction at offset jumps to
+ * returns -1 if it is not a jump
+ */
+int jumpTarget(const Chunk* chunk, int offset);
+
+/**
+ * point the jump in the instruction at offset to target
+ * returns false if the distance does not fit in the operand
+ */
+bool setJumpTarget(Chunk* chunk, int offset, int target);
+
+/**
+ * the most frame slots (locals, temporaries and operands) the code
+ * can use at once, given the slots already taken by the arguments.
+ * -1 if there is no memory for the walk
+ */
+int maxStackHeight(const Chunk* chunk, int argSlots);
+
 #endif
@@ -3,4 +3,16 @@
 
 // #define DEBUG_STACK_TRACE
 
+/**
+ * count executed opcode pairs/triples and print them when the VM is freed
+ */
+// #define PROFILE_OPCODES
+
+/**
+ * collect garbage before every object allocation, and print
+ * how much each collection freed
+ */
+// #define DEBUG_STRESS_GC
+// #define DEBUG_LOG_GC
+
 #endif
@@ -34,6 +34,13 @@ struct Compiler {
   int scopeDepth;
   ObjFunction* func;
   FunctionType type;
+
+  /**
+   * forward jumps are emitted in their two-byte form until one does
+   * not fit, then the function is compiled again with longJumps set
+   */
+  bool longJumps;
+  bool jumpOverflow;
 };
 
 typedef struct {
@@ -46,6 +53,10 @@ typedef struct {
  * and store them in chunk
  */
 CompilerResult compile(VM* vm, const Statements* statements);
-void initCompiler(VM* vm, Compiler* compiler, FunctionType type);
+
+/**
+ * returns false if there is no memory for the function being compiled
+ */
+bool initCompiler(VM* vm, Compiler* compiler, FunctionType type);
 
 #endif
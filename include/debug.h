@@ -10,4 +10,9 @@
 void disassembleChunk(Chunk* chunk, const char* name);
 int disassembleInstruction(Chunk* chunk, int offset);
 
+/**
+ * the printable name of an opcode, e.g. "OP_ADD"
+ */
+const char* opcodeName(uint8_t instruction);
+
 #endif
@@ -0,0 +1,126 @@
+#ifndef MCSCRIPT_VM_GC_H
+#define MCSCRIPT_VM_GC_H
+
+#include <stddef.h>
+#include <value.h>
+#include <vm.h>
+#include <object.h>
+
+/**
+ * incremental tracing mark-sweep garbage collector
+ *
+ * vm->heap counts every byte the VM holds. once the count passes
+ * heap.nextGC, object allocations start doing collector steps: a cycle marks
+ * everything reachable from the value stack, the call frames, the
+ * globals and the functions still being compiled, then frees every other
+ * object on vm->objects. each step works until vm->gcPauseMicros is up,
+ * and the next one comes GC_STEP_BYTES of allocation later. the collector
+ * only runs there, before the new object is linked in, so code holding
+ * raw pointers into arrays that reallocate moves is never interrupted.
+ *
+ * objects allocated while marking are marked straight away, and storing
+ * into a function's constants marks the value (OBJECT_BARRIER). the
+ * stack and globals are roots without a barrier, marking ends with one
+ * more pass over them
+ *
+ * strings made by the running program start out young instead, bumped
+ * off vm->nursery. when
+ * the nursery is full a minor collection copies the young strings still
+ * reachable from the stack and the remembered globals out to the heap,
+ * where they are ordinary objects, and starts the nursery over. the
+ * stack is scanned whole, so only stores into globals need the barrier
+ *
+ * vm->strings holds every string weakly: sweeps and minor collections
+ * take out the strings they free, and promoted strings replace their
+ * young copies in it
+ */
+
+/**
+ * heap size before the first collection, and how far the heap may grow
+ * past what survived a collection before the next one
+ */
+#define GC_HEAP_INITIAL (1024 * 1024)
+#define GC_HEAP_GROW_FACTOR 2
+
+/**
+ * bytes allocated between two steps of a running cycle, and the objects
+ * a step marks or sweeps between looks at the clock
+ */
+#define GC_STEP_BYTES (64 * 1024)
+#define GC_STEP_WORK 64
+
+/**
+ * strings longer than this skip the nursery
+ */
+#define NURSERY_STRING_MAX (NURSERY_SIZE / 8)
+
+/**
+ * bytes a young string of length characters takes in the nursery
+ */
+#define YOUNG_STRING_SIZE(length) \
+  ((STRING_SIZE(length) + 7) & ~(size_t)7)
+
+#define IS_YOUNG(vm, obj) \
+  ((uintptr_t)(obj) - (uintptr_t)(vm)->nursery < NURSERY_SIZE)
+
+/**
+ * write barrier for storing value into a global slot
+ */
+#define GLOBAL_BARRIER(vm, slot, value) \
+  do { \
+    if (IS_OBJ(value) && IS_YOUNG(vm, AS_OBJ(value))) rememberGlobal(vm, slot); \
+  } while (false)
+
+void rememberGlobal(VM* vm, int slot);
+
+/**
+ * make room for a young string of length characters, running a minor
+ * collection if the nursery is full. roots are values the caller still
+ * needs, they are updated if their strings move.
+ * returns false if the string is too long for the nursery, or the
+ * nursery is full and there was no memory to empty it
+ */
+bool reserveNursery(VM* vm, int length, Value* roots, int rootCount);
+
+/**
+ * copy the reachable young strings out of the nursery and empty it
+ * returns false if there was no memory for a copy, the strings not
+ * copied yet stay young and the nursery is left as it is
+ */
+bool collectNursery(VM* vm, Value* roots, int rootCount);
+
+/**
+ * copy a young string out to the heap, or find the copy a minor
+ * collection already made. for strings kept where minor collections
+ * don't look. NULL if there is no memory for the copy
+ */
+ObjString* promoteString(VM* vm, ObjString* young);
+
+/**
+ * write barrier for storing value into an object the collector
+ * may have traced already
+ */
+#define OBJECT_BARRIER(vm, value) \
+  do { \
+    if ((vm)->gcPhase == GC_MARK) markValue(vm, value); \
+  } while (false)
+
+void markValue(VM* vm, Value value);
+void markObject(VM* vm, Obj* obj);
+
+/**
+ * do a bounded amount of collection work, starting a cycle if none is running
+ */
+void gcStep(VM* vm);
+
+/**
+ * finish the running cycle, or do a whole one, in one go
+ */
+void collectGarbage(VM* vm);
+
+/**
+ * release an object and everything it owns
+ */
+void freeObject(Obj* obj);
+
+#endif
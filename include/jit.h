@@ -0,0 +1,79 @@
+#ifndef MCSCRIPT_VM_JIT_H
+#define MCSCRIPT_VM_JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vm.h>
+#include <value.h>
+
+#if defined(JIT) && (!defined(NAN_BOXING) || !defined(__x86_64__))
+#error "the JIT needs NaN-boxed values on an x86-64 host"
+#endif
+
+/**
+ * baseline JIT: a function called JIT_THRESHOLD times is translated,
+ * one template per instruction, into x86-64 machine code. the templates
+ * handle numbers inline and call back into the interpreter for the rest
+ */
+#define JIT_THRESHOLD 64
+
+/**
+ * compiled frames nest on the C stack, so past this depth
+ * calls are left to the interpreter
+ */
+#define JIT_DEPTH_MAX 512
+
+typedef enum {
+  JIT_ERROR,
+  JIT_RETURNED, // the frame returned, its result replaces the arguments
+  JIT_TAIL_CALL, // the frame was reused for a tail call and has to be run again
+  JIT_INTERPRET // a loop's trace left off mid-function, the interpreter takes the frame
+} JitStatus;
+
+/**
+ * compiled code for a function, running the frame frameOffset bytes into
+ * vm->frame (always the top frame) until it returns
+ */
+typedef JitStatus (*JitCode)(VM* vm, size_t frameOffset);
+
+/**
+ * translate a function's chunk, setting its jitCode
+ * returns false (leaving the function interpreted) if some
+ * instruction has no template or the code could not be mapped
+ */
+bool jitCompile(VM* vm, ObjFunction* func);
+
+/**
+ * release a function's machine code
+ */
+void jitFree(ObjFunction* func);
+
+/**
+ * slow paths of the templates, defined in vm.c
+ * compiled code stores its stack top to vm->stackTop before calling them
+ * and reloads the stack top and base pointer after, since they may grow
+ * the stack. the bool ones return false on a runtime error
+ */
+bool jitArithmetic(VM* vm, uint8_t op);
+bool jitRegisterOp(VM* vm, uint8_t op, Value a, Value b, Value* dst);
+bool jitEqual(VM* vm);
+void jitUndefinedGlobal(VM* vm, int slot);
+void jitNumberError(void);
+bool jitCall(VM* vm, int callArgs);
+bool jitCallNative(VM* vm, int slot, int callArgs);
+
+/**
+ * returns 0 on a runtime error, 1 if the callee was a native that has
+ * already run and 2 if the current frame now holds the callee
+ */
+int jitTailCall(VM* vm, int callArgs);
+
+/**
+ * a back-edge whose hot counter ran out or that has a trace (see
+ * trace.h). returns true to carry on at the loop header in compiled
+ * code, false when the frame's ip now points elsewhere
+ */
+bool jitHotLoop(VM* vm, int backEdge);
+
+#endif
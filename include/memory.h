@@ -1,7 +1,9 @@
 #ifndef MCSCRIPT_VM_MEMORY_H
 #define MCSCRIPT_VM_MEMORY_H
 
+#include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 /**
  * macros for managing memory of dynamic arrays (e.g., Chunk, ValueArray)
@@ -9,24 +11,132 @@
  */
 
 #define GROW_CAPACITY(capacity) \
-  (capacity) == 0 ? 8 : (capacity) * 2
+  ((capacity) == 0 ? 8 : (capacity) * 2)
 
-#define GROW_ARRAY(type, pointer, oldCapacity, newCapacity) \
-  (type*)reallocate(pointer, sizeof(type) * oldCapacity, sizeof(type) * newCapacity)
+#define GROW_ARRAY(type, pointer, oldCapacity, newCapacity, kind) \
+  (type*)reallocate(pointer, sizeof(type) * (oldCapacity), sizeof(type) * (newCapacity), kind)
 
-#define FREE_ARRAY(type, pointer, oldCapacity) \
-  (type*)reallocate(pointer, sizeof(type) * oldCapacity, 0)
+#define FREE_ARRAY(type, pointer, oldCapacity, kind) \
+  (type*)reallocate(pointer, sizeof(type) * (oldCapacity), 0, kind)
 
-#define ALLOCATE(type, size) \
-  (type*)reallocate(NULL, 0, sizeof(type) * size)
+#define ALLOCATE(type, size, kind) \
+  (type*)reallocate(NULL, 0, sizeof(type) * (size), kind)
 
-#define FREE(type, pointer) \
-  reallocate(pointer, sizeof(type), 0)
+#define FREE(type, pointer, kind) \
+  reallocate(pointer, sizeof(type), 0, kind)
+
+/**
+ * blocks of up to POOL_MAX bytes come from per-size-class free lists
+ * (classes POOL_GRANULE bytes apart) carved out of POOL_ARENA_SIZE
+ * arenas, bigger ones from malloc. sizes passed to reallocate must
+ * be the sizes the blocks were allocated with.
+ * built with HUGE_PAGES, arenas are mapped on huge page boundaries
+ * and the kernel is asked to back them with huge pages
+ */
+#define POOL_GRANULE 16
+#define POOL_MAX 256
+#define POOL_CLASSES (POOL_MAX / POOL_GRANULE)
+#define POOL_ARENA_SIZE (2 * 1024 * 1024)
+
+/**
+ * what an allocation is for, bytes are counted per kind.
+ * a block is freed with the kind it was allocated with
+ */
+typedef enum {
+  MEM_STRING,
+  MEM_FUNCTION,
+  MEM_NATIVE,
+  MEM_ROPE,
+  MEM_CODE, // bytecode, line tables and the compiler's scratch arrays
+  MEM_CONSTANTS, // constant pools and their indexes
+  MEM_TABLE,
+  MEM_AST,
+  MEM_JIT, // machine code and what it takes to make it
+  MEM_VM, // value stack, call frames, globals and the nursery
+  MEM_KIND_COUNT
+} MemoryKind;
+
+struct FreeBlock;
+struct Arena;
+
+/**
+ * the memory of one VM: what it holds, when it collects garbage,
+ * how far it may grow, and the pools its small blocks come from.
+ * the host reads the counters and sets the limits directly
+ */
+typedef struct {
+  /**
+   * bytes held now and at most so far, in all and per kind
+   */
+  size_t bytes;
+  size_t peak;
+  size_t kindBytes[MEM_KIND_COUNT];
+  size_t kindPeak[MEM_KIND_COUNT];
+
+  /**
+   * how many bytes may be held before the next object allocation
+   * runs the garbage collector (see gc.h)
+   */
+  size_t nextGC;
+
+  /**
+   * 0 for no limit. the collector keeps nextGC at or under the soft
+   * limit, so it works harder as the heap gets close. no block is
+   * handed out past the hard limit: an object allocation collects
+   * first, anything else fails straight away. a failed allocation
+   * stops the script with an out of memory error, or the compile
+   * with a compile error
+   */
+  size_t softLimit;
+  size_t hardLimit;
+
+  /**
+   * set when reallocate refuses a block. the compiler writes its
+   * code without checking each byte and looks here once done
+   */
+  bool outOfMemory;
+
+  struct FreeBlock* freeLists[POOL_CLASSES];
+  struct Arena* arenas;
+  uint8_t* arenaTop;
+  uint8_t* arenaEnd;
+} Heap;
+
+void initHeap(Heap* heap);
+
+/**
+ * release every arena, once nothing allocated from them is in use
+ */
+void freeHeap(Heap* heap);
+
+/**
+ * charge allocations to heap from now on, NULL for the process'
+ * own heap. a VM switches to its heap whenever it is entered, only
+ * one VM may run at a time
+ */
+void useHeap(Heap* heap);
+
+/**
+ * set the limits, pulling the next collection in under the soft one
+ */
+void setHeapLimits(Heap* heap, size_t softLimit, size_t hardLimit);
+
+/**
+ * name of a kind, for reports
+ */
+const char* memoryKindName(MemoryKind kind);
 
 /**
  * allocates memory on the heap
- * will resize as needed
+ * will resize as needed. returns NULL, leaving the old block as it
+ * was, when the block can't be had or would go past the hard limit
+ */
+void* reallocate(void* pointer, size_t oldCapacity, size_t newCapacity, MemoryKind kind);
+
+/**
+ * count memory that didn't come from reallocate. growth past the
+ * hard limit is refused like reallocate refuses it, counting nothing
  */
-void* reallocate(void* pointer, size_t oldCapacity, size_t newCapacity);
+bool countMemory(size_t oldSize, size_t newSize, MemoryKind kind);
 
 #endif
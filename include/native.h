@@ -3,7 +3,10 @@
 
 #include <vm.h>
 
-void defineNatives(VM* vm);
+/**
+ * returns false if there was no memory for one of them
+ */
+bool defineNatives(VM* vm);
 
 
 
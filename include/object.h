@@ -3,6 +3,7 @@
 
 #include <value.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <ast.h>
 #include <vm.h>
 #include <chunk.h>
@@ -11,11 +12,13 @@
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
 #define IS_FUNC(value) isObjType(value, OBJ_FUNCTION)
 #define IS_NATIVE(value) isObjType(value, OBJ_NATIVE)
+#define IS_ROPE(value) isObjType(value, OBJ_ROPE)
 
 #define AS_STRING(value) (ObjString*)AS_OBJ(value)
 #define AS_CSTRING(value) ((ObjString*)AS_OBJ(value))->str
 #define AS_FUNC(value) (ObjFunction*)AS_OBJ(value)
 #define AS_NATIVE(value) (ObjNative*)AS_OBJ(value)
+#define AS_ROPE(value) (ObjRope*)AS_OBJ(value)
 #define CHUNK(func) func.chunk
 
 
@@ -25,7 +28,8 @@
 typedef enum {
   OBJ_STRING,
   OBJ_FUNCTION,
-  OBJ_NATIVE
+  OBJ_NATIVE,
+  OBJ_ROPE
 } ObjType;
 
 /**
@@ -33,21 +37,52 @@ typedef enum {
  */
 struct obj {
   ObjType type;
+
+  /**
+   * set while the garbage collector finds the object reachable
+   */
+  bool isMarked;
   Obj* next;
 };
 
 /**
  * string data type
  * "inherits" from the Obj type by making it the first
- * field in the struct
+ * field in the struct. the characters (nul terminated)
+ * are stored right after the header, in the same allocation
  */
 struct objString {
   Obj obj;
   int length;
-  char* str;
   uint32_t hash;
+  char str[];
 };
 
+/**
+ * bytes taken by a string of length characters
+ */
+#define STRING_SIZE(length) (sizeof(ObjString) + (length) + 1)
+
+/**
+ * a string made by concatenating two others, left and right are
+ * strings or ropes. the characters are only copied into one string
+ * (flat) when something needs them in one piece, the halves are
+ * dropped then. a rope is a string value everywhere but stores its
+ * characters differently, nothing but concatenation makes one
+ */
+typedef struct {
+  Obj obj;
+  int length;
+  Obj* left;
+  Obj* right;
+  ObjString* flat;
+} ObjRope;
+
+/**
+ * concatenations shorter than this are copied straight away
+ */
+#define ROPE_MIN 64
+
 /**
  * function data type
  */
@@ -55,14 +90,56 @@ struct objString {
   Obj obj;
   ObjString* name;
   int numArgs;
+
+  /**
+   * stack slots a call needs above its base pointer,
+   * checked against the VM stack when a frame is pushed
+   */
+  int maxSlots;
   Chunk chunk;
+
+  /**
+   * calls so far (counted up to JIT_THRESHOLD) and the machine code
+   * the JIT made of the chunk, if any (see jit.h)
+   */
+  int callCount;
+  void* jitCode;
+  size_t jitSize;
+
+  /**
+   * the traces of the chunk's loops, one per back-edge that
+   * got hot (see trace.h)
+   */
+  LoopTrace* loopTraces;
+  int loopTraceCount;
+  int loopTraceCapacity;
 };
 
 /**
  * function pointer to native C functions
  * I.e., clock, read file, write file, etc.
+ * the result is written through result, which may be the same slot as
+ * args[0], so it has to be written after the arguments are read.
+ * returns false if the call failed with a runtime error
+ */
+typedef bool (*NativeFunc)(VM* vm, int numArgs, Value* args, Value* result);
+
+/**
+ * arity of a native that takes any number of arguments
+ */
+#define NATIVE_VARIADIC -1
+
+/**
+ * what a native may do, for callers that want to skip work around it:
+ * callNative only checks natives that may fail, and compiled code calls
+ * natives that don't allocate without syncing the stack for the collector.
+ * nothing acts on NATIVE_PURE yet
  */
-typedef Value (*NativeFunc)(VM* vm, int numArgs, Value* args);
+typedef enum {
+  NATIVE_PURE = 1 << 0, // result depends only on the arguments, no side effects
+  NATIVE_NO_ALLOC = 1 << 1, // never allocates heap objects
+  NATIVE_MAY_ERROR = 1 << 2 // can return false, the others always succeed
+} NativeFlags;
 
 /**
  * object to wrap native C functions
@@ -70,6 +147,8 @@ typedef Value (*NativeFunc)(VM* vm, int numArgs, Value* args);
 typedef struct {
   Obj obj;
   NativeFunc func;
+  int arity;
+  uint8_t flags;
 } ObjNative;
 
 static inline bool isObjType(Value value, ObjType type) {
@@ -77,22 +156,66 @@ static inline bool isObjType(Value value, ObjType type) {
 }
 
 /**
- * wrap strings as objects on the heap and track in vm
+ * a string of length characters on the heap, tracked by vm, for the
+ * caller to fill in and hash. the allocation may collect garbage, so
+ * values the caller still needs must be reachable
+ */
+ObjString* allocateString(VM* vm, int length);
+
+/**
+ * the interned string with length characters from chars, a new
+ * string on the heap if there is none yet. never a young string.
+ * NULL when there's no memory for it
  */
-ObjString* allocateString(VM* vm, char* str);
+ObjString* copyString(VM* vm, const char* chars, int length);
 
 /**
- * create a string from an AST Expression
- * allocates char array on heap
+ * intern a string made by allocateString or allocateYoungString once
+ * it is filled in and hashed. returns the string to use in its place,
+ * either str or an older string with the same contents, NULL if
+ * the string table can't grow to take it
  */
-char* createString(const Expression* expr);
+ObjString* internString(VM* vm, ObjString* str);
+
+/**
+ * a string of length characters in the nursery, for the caller to fill
+ * in and hash. reserveNursery (gc.h) must have made room for it
+ */
+ObjString* allocateYoungString(VM* vm, int length);
 
 /**
  * hash function for a string
  */
 uint32_t hashString(const char* key, int length);
 
+/**
+ * the hash of a string that continues one hashing to hash with
+ * length more characters from key
+ */
+uint32_t extendHash(uint32_t hash, const char* key, int length);
+
+/**
+ * a rope of the strings or ropes left and right, which must be reachable
+ * while it is allocated. young halves are promoted, the rope is
+ * on the heap and minor collections don't look inside it.
+ * NULL when there's no memory for it or a promoted half
+ */
+ObjRope* newRope(VM* vm, Obj* left, Obj* right);
+
+/**
+ * the characters of a string value in one interned string, flattening
+ * a rope the first time. may collect garbage, value must be reachable.
+ * NULL when there's no memory to flatten it
+ */
+ObjString* flattenString(VM* vm, Value value);
+
+/**
+ * print a rope's characters without flattening it
+ * returns false if it ran out of memory part way
+ */
+bool printRope(ObjRope* rope);
+
 ObjFunction* newFunction(VM* vm);
-ObjNative* newNative(VM* vm, NativeFunc func);
+ObjNative* newNative(VM* vm, NativeFunc func, int arity, uint8_t flags);
 
 #endif
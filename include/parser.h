@@ -23,22 +23,41 @@ typedef enum {
 
 
 /**
- * holds the state of the tokens being analyzed
+ * bytes in one chunk of the parse arena, nodes
+ * larger than a quarter of that get a chunk to themselves
+ */
+#define AST_CHUNK_SIZE (16 * 1024)
+
+/**
+ * holds the state of the tokens being analyzed, and the chunks
+ * the nodes parsed so far were bumped off (newest first)
+ *
+ * the statements of the blocks and the arguments of the calls still
+ * open are stacked on scratch, they get an array of their own in the
+ * arena once they are closed
+ *
+ * once the arena can't grow the parse stops early and outOfMemory is
+ * set, the tree parse() returns is not fit to compile then
  */
 typedef struct {
   Token previous;
   Token current;
+  AstChunk* chunks;
+  void** scratch;
+  int scratchCount;
+  int scratchCapacity;
+  bool outOfMemory;
 } Parser;
 
 /**
  * functions for parsing prefix (i.e., unary) expressions
  */
-typedef Expression(*PrefixFn)(Parser*, Scanner*);
+typedef Expression*(*PrefixFn)(Parser*, Scanner*);
 
 /**
  * functions for parsing infix (i.e., binary) expressions
  */
-typedef Expression(*InfixFn)(Parser*, Scanner*, Expression);
+typedef Expression*(*InfixFn)(Parser*, Scanner*, Expression*);
 
 
 typedef struct {
@@ -48,10 +67,11 @@ typedef struct {
 } ParserRule;
 
 Statements parse(Parser* parser, const char* source);
+
+/**
+ * release the whole tree parse() returned in one go,
+ * does nothing for the statements of a nested block
+ */
 void freeStatements(Statements* statements);
-void freePrefix(Prefix* prefix);
-void freeInfix(Infix* infix);
-void freeGrouped(Group* group);
-void freeExpression(Expression* expr);
 
 #endif
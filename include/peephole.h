@@ -0,0 +1,30 @@
+#ifndef MCSCRIPT_VM_PEEPHOLE_H
+#define MCSCRIPT_VM_PEEPHOLE_H
+
+#include <chunk.h>
+
+#define SUPERINSTRUCTION_MAX 4
+
+/**
+ * a fused opcode and the instruction sequence it replaces
+ */
+typedef struct {
+  OpCode fused;
+  int count;
+  OpCode components[SUPERINSTRUCTION_MAX];
+} Superinstruction;
+
+/**
+ * returns the definition of a superinstruction
+ * or NULL if the opcode is a plain instruction
+ */
+const Superinstruction* findSuperinstruction(uint8_t instruction);
+
+/**
+ * rewrite a finished chunk, replacing hot instruction sequences
+ * with superinstructions and relocating jumps. without memory
+ * for the rewrite the chunk is left as it was
+ */
+void fuseSuperinstructions(Chunk* chunk);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef MCSCRIPT_VM_PROFILE_H
+#define MCSCRIPT_VM_PROFILE_H
+
+#include <stdint.h>
+
+/**
+ * opcode sequence profiler (enabled with PROFILE_OPCODES in common.h)
+ * counts how often each opcode pair and triple executes back to back,
+ * which is what the superinstruction table in peephole.c is chosen from
+ */
+void profileInstruction(uint8_t instruction);
+
+/**
+ * forget the previous opcodes (e.g., when a new script starts running)
+ */
+void resetProfileHistory();
+
+/**
+ * print the most frequent pairs and triples to stderr
+ */
+void printProfile();
+
+#endif
@@ -19,6 +19,8 @@ void freeTable(Table* table);
 
 /**
  * insert a new key/value pair into table
+ * returns whether the key is new. false as well, with nothing
+ * inserted, when the table can't grow to take it
  */
 bool tableSet(Table* table, ObjString* key, Value value);
 
@@ -30,6 +32,18 @@ bool tableGet(Table* table, ObjString* key, Value* value);
 
 bool tableDelete(Table* table, ObjString* key);
 
+/**
+ * put other in key's place, other must hash the same as key
+ * returns false if key isn't in the table
+ */
+bool tableReplaceKey(Table* table, ObjString* key, ObjString* other);
+
+/**
+ * look up a key by its characters instead of by an ObjString
+ * returns NULL when no key with those contents is in the table
+ */
+ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
+
 /**
  * copy all the entries in "from" to "to"
  */
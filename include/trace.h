@@ -0,0 +1,73 @@
+#ifndef MCSCRIPT_VM_TRACE_H
+#define MCSCRIPT_VM_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vm.h>
+
+/**
+ * tracing JIT for hot loops (built with the JIT, see jit.h)
+ *
+ * every back-edge decrements a hot counter (vm->hotCounts). when one
+ * runs out, the recorder executes one iteration of the loop itself,
+ * writing down what it did as trace IR: loads guarded to be numbers,
+ * arithmetic, stores, and guards for the branches it took. the IR is
+ * compiled to a machine code loop, and the back-edge is rewritten to
+ * OP_LOOP_TRACE so the interpreter enters the trace from then on.
+ * a failing guard is a side exit: the trace writes out the operand
+ * stack the interpreter expects at that point and run() carries on
+ */
+
+/**
+ * back-edges before a loop is recorded, and what the hot counter of a
+ * loop that can't be traced is reset to, so it seldom comes back
+ */
+#define TRACE_THRESHOLD 56
+#define TRACE_BLACKLIST_COUNT UINT16_MAX
+
+/**
+ * recordings that may fail before a loop is left to the interpreter
+ */
+#define TRACE_ATTEMPTS_MAX 4
+
+/**
+ * longest trace, in IR instructions
+ */
+#define TRACE_IR_MAX 512
+
+#define HOTCOUNT_INDEX(ip) \
+  ((((uintptr_t)(ip)) ^ ((uintptr_t)(ip) >> 7)) & (HOTCOUNT_SIZE - 1))
+
+/**
+ * a loop's trace state, found by the offset of its back-edge
+ */
+struct LoopTrace {
+  int backEdge;
+  int attempts;
+  bool blacklisted;
+
+  /**
+   * machine code for the loop, runs (VM*, frame base, stack top)
+   * and returns the bytecode offset to continue at
+   */
+  void* code;
+  size_t size;
+};
+
+typedef int (*TraceCode)(VM* vm, Value* base, Value* stackTop);
+
+/**
+ * called with frame->ip at the loop header after the back-edge at
+ * backEdge jumped, when its hot counter ran out or it has a trace.
+ * records and compiles a trace if there is none yet and runs it.
+ * afterwards frame->ip and vm->stackTop say where interpreting resumes
+ */
+void traceLoop(VM* vm, CallFrame* frame, int backEdge);
+
+/**
+ * release the traces of a function
+ */
+void freeLoopTraces(ObjFunction* func);
+
+#endif
@@ -3,21 +3,8 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-
-#define AS_NUMBER(value) value.as.number
-#define AS_BOOL(value) value.as.boolean
-#define AS_NULL(value) value.as.null
-#define AS_OBJ(value) value.as.obj
-
-#define NUMBER_VAL(num) (Value){VAL_NUMBER, {.number = num}}
-#define BOOL_VAL(val) (Value){VAL_BOOL, {.boolean = val}}
-#define NULL_VAL (Value){VAL_NULL, {.null = 0}}
-#define OBJ_VAL(object) (Value){VAL_OBJ, {.obj = (Obj*)object}}
-
-#define IS_BOOL(value) value.type == VAL_BOOL
-#define IS_NULL(value) value.type == VAL_NULL
-#define IS_OBJ(value) value.type == VAL_OBJ
-#define IS_NUM(value) value.type == VAL_NUMBER
+#include <string.h>
+#include <memory.h>
 
 typedef struct obj Obj;
 typedef struct objString ObjString;
@@ -33,7 +20,78 @@ typedef enum {
   VAL_NULL 
 } ValueType;
 
-  
+#ifdef NAN_BOXING
+
+/**
+ * NaN-boxed representation (8 bytes per value)
+ * any bit pattern that is not a quiet NaN is a number.
+ * quiet NaNs carry a tag in the low bits for the singleton values,
+ * or an object pointer in the low 48 bits when the sign bit is set
+ */
+typedef uint64_t Value;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NULL 1
+#define TAG_FALSE 2
+#define TAG_TRUE 3
+
+/**
+ * UNDEFINED_VAL is internal to the VM: it fills global slots the compiler
+ * has handed out before the script defines them, and scripts never see it
+ */
+#define TAG_UNDEFINED 4
+
+#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+
+#define AS_NUMBER(value) valueToNum(value)
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_OBJ(value) ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define NUMBER_VAL(num) numToValue(num)
+#define BOOL_VAL(val) ((val) ? TRUE_VAL : FALSE_VAL)
+#define NULL_VAL ((Value)(uint64_t)(QNAN | TAG_NULL))
+#define OBJ_VAL(object) (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(object))
+#define UNDEFINED_VAL ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NULL(value) ((value) == NULL_VAL)
+#define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_NUM(value) (((value) & QNAN) != QNAN)
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+
+static inline double valueToNum(Value value) {
+  double num;
+  memcpy(&num, &value, sizeof(Value));
+  return num;
+}
+
+static inline Value numToValue(double num) {
+  Value value;
+  memcpy(&value, &num, sizeof(double));
+  return value;
+}
+
+#else
+
+#define AS_NUMBER(value) (value).as.number
+#define AS_BOOL(value) (value).as.boolean
+#define AS_OBJ(value) (value).as.obj
+
+#define NUMBER_VAL(num) ((Value){VAL_NUMBER, {.number = num}})
+#define BOOL_VAL(val) ((Value){VAL_BOOL, {.boolean = val}})
+#define NULL_VAL ((Value){VAL_NULL, {.null = 0}})
+#define OBJ_VAL(object) ((Value){VAL_OBJ, {.obj = (Obj*)object}})
+// a null with a payload, see TAG_UNDEFINED
+#define UNDEFINED_VAL ((Value){VAL_NULL, {.null = 1}})
+
+#define IS_BOOL(value) ((value).type == VAL_BOOL)
+#define IS_NULL(value) ((value).type == VAL_NULL)
+#define IS_OBJ(value) ((value).type == VAL_OBJ)
+#define IS_NUM(value) ((value).type == VAL_NUMBER)
+#define IS_UNDEFINED(value) (IS_NULL(value) && (value).as.null == 1)
 
 typedef union {
   double number; // => VAL_NUMBER
@@ -48,33 +106,52 @@ typedef union {
 typedef struct {
   ValueType type;
   ValueData as;
-  bool isLocal;
 } Value;
 
+#endif
+
 /**
  * dynamic array to store literals in source code
+ * (and the VM's globals), counted as kind
  */
 typedef struct {
   int count;
   int capacity;
   Value* data;
+  MemoryKind kind;
 } ValueArray;
 
+/**
+ * get the type tag of a value regardless of representation
+ */
+ValueType valueType(Value val);
+
 /**
  * initialize empty ValueArray
  */
-void initValueArray(ValueArray* array);
+void initValueArray(ValueArray* array, MemoryKind kind);
 
 /**
  * add a value to the ValueArray
+ * returns false, leaving the array as it was, if it can't grow
  */
-void writeValueArray(ValueArray* array, Value val);
+bool writeValueArray(ValueArray* array, Value val);
 
 /**
  * free up memory on the heap
  */
 void freeValueArray(ValueArray* array);
 
-void printValue(Value val);
+/**
+ * compare two values for equality
+ * objects are compared by identity, strings are interned
+ * so equal contents are the same object
+ */
+bool valuesEqual(Value a, Value b);
+
+/**
+ * returns false if printing a rope ran out of memory part way
+ */
+bool printValue(Value val);
 
 #endif
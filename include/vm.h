@@ -2,16 +2,55 @@
 #define MCSCRIPT_VM_VM_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <chunk.h>
 #include <value.h>
 #include <table.h>
+#include <memory.h>
 
 #define CURRENT_CHUNK(vm) vm->compiler->func->chunk
-#define FRAMES_MAX 64
-#define STACK_MAX 256 * FRAMES_MAX
+
+/**
+ * the frame array and value stack start small and grow on demand
+ * up to these limits, past which a call is a stack overflow
+ */
+#define FRAMES_INITIAL 8
+#define FRAMES_MAX (1 << 16)
+#define STACK_INITIAL 256
+#define STACK_MAX (1 << 22)
+
+/**
+ * hot counters for loop back-edges, shared by hash of the back-edge's address
+ */
+#define HOTCOUNT_SIZE 64
+
+/**
+ * strings made while running are bump-allocated in a nursery of this
+ * many bytes, and the ones still reachable when it fills are copied out
+ * to the heap (see gc.h). global slots given a nursery string in between
+ * are remembered, past REMEMBERED_MAX of them every global is scanned
+ */
+#define NURSERY_SIZE (256 * 1024)
+#define REMEMBERED_MAX 64
+
+/**
+ * longest a step of the incremental garbage collector should take
+ * by default, in microseconds (see gc.h)
+ */
+#define GC_PAUSE_DEFAULT 200
 
 typedef struct Compiler Compiler;
 typedef struct ObjFunction ObjFunction;
+typedef struct LoopTrace LoopTrace;
+
+/**
+ * where the incremental garbage collector is in its cycle
+ */
+typedef enum {
+  GC_IDLE,
+  GC_MARK,
+  GC_SWEEP
+} GcPhase;
 
 /**
  * a stack frame for a function call
@@ -32,23 +71,103 @@ typedef struct {
    * the top most frame (index = frameCount - 1)
    * is the frame for the function being called
    */
-  CallFrame frame[FRAMES_MAX];
+  CallFrame* frame;
+  int frameCapacity;
 
   int frameCount;
 
   /**
    * call stack to keep track of values used/needed
+   * growing it moves the values, so every frame's base pointer
+   * and stackTop are fixed up afterwards
    */
-  Value valueStack[STACK_MAX];
+  Value* valueStack;
+  int stackCapacity;
 
   /**
    * points one past the last-used slot in stack
    */
   Value* stackTop;
 
+  /**
+   * one past the highest slot a frame has reserved since the last
+   * garbage collection, every slot below it holds a valid value
+   */
+  int stackHigh;
+
+  /**
+   * everything the VM allocates is counted and limited here
+   * (see memory.h)
+   */
+  Heap heap;
+
   Obj* objects;
-  Table globals;
+
+  /**
+   * objects the garbage collector marked but hasn't traced through yet.
+   * grayOverflow is set when the stack couldn't grow and a marked
+   * object was left off it
+   */
+  Obj** grayStack;
+  int grayCount;
+  int grayCapacity;
+  bool grayOverflow;
+
+  /**
+   * the collector's phase, the objects it has yet to sweep (the
+   * survivors move back to objects), and how long one step may run
+   * (in microseconds, 0 collects in one go)
+   */
+  GcPhase gcPhase;
+  Obj* sweepList;
+  int gcPauseMicros;
+
+  /**
+   * the nursery, the next free byte in it, and the global slots that
+   * may point into it (see NURSERY_SIZE)
+   */
+  uint8_t* nursery;
+  uint8_t* nurseryTop;
+  int remembered[REMEMBERED_MAX];
+  int rememberedCount;
+
+  /**
+   * global variable values, indexed by the slot the compiler
+   * assigned to each name
+   */
+  ValueArray globals;
+
+  /**
+   * maps global names to their slot in globals (as a number value)
+   * only used while compiling and for error messages
+   */
+  Table globalNames;
+
+  /**
+   * every live string, keyed by itself, so strings with equal
+   * contents are one object and compare by pointer. the collector
+   * drops the strings it frees, the set doesn't keep them alive
+   */
+  Table strings;
   Compiler* compiler;
+
+  /**
+   * compile arithmetic and conditions over locals to register
+   * instructions instead of stack instructions where possible
+   */
+  bool registerBytecode;
+
+  /**
+   * compile hot functions to machine code (builds with the JIT only),
+   * and how many compiled frames are currently nested on the C stack
+   */
+  bool jitEnabled;
+  int jitDepth;
+
+  /**
+   * back-edges left before each loop is handed to the trace compiler
+   */
+  uint16_t hotCounts[HOTCOUNT_SIZE];
 } VM;
 
 typedef enum {
@@ -57,12 +176,23 @@ typedef enum {
   COMPILE_ERROR
 } InterpretResult;
 
-void initVM(VM* vm, Compiler* compiler);
+/**
+ * returns false if there was no memory for the stacks or the natives,
+ * the VM must still be freed
+ */
+bool initVM(VM* vm, Compiler* compiler);
 void resetVM(VM* vm);
 void freeVM(VM* vm);
 InterpretResult interpret(VM* vm, const char* source);
 void push(VM* vm, Value val);
 Value pop(VM* vm);
 
+/**
+ * find the slot for a global variable
+ * the first time a name is seen it gets a new, undefined slot
+ * returns -1 if the slot could not be created
+ */
+int resolveGlobalSlot(VM* vm, const char* name, int length);
+
 
 #endif
@@ -0,0 +1,149 @@
+#ifndef MCSCRIPT_VM_X64_H
+#define MCSCRIPT_VM_X64_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * a small x86-64 encoder shared by the baseline JIT (jit.c) and the
+ * trace compiler (trace.c). only the forms those two need are here
+ */
+
+typedef enum {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15
+} Register;
+
+/**
+ * condition codes, added to the jcc/setcc opcodes
+ */
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+#define CC_A 0x7
+#define CC_P 0xa // unordered, after comparing a NaN
+
+/**
+ * a rel32 field waiting for the machine offset of a label
+ */
+typedef struct {
+  int at;
+  int label;
+} Fixup;
+
+typedef struct {
+  uint8_t* code;
+  int count;
+  int capacity;
+
+  /**
+   * machine offset of each label, -1 until it is placed
+   */
+  int* labels;
+  int labelCount;
+  int labelCapacity;
+
+  Fixup* fixups;
+  int fixupCount;
+  int fixupCapacity;
+
+  /**
+   * set once an array couldn't grow, from then on nothing is written
+   * and the code can't be finished
+   */
+  bool failed;
+} Assembler;
+
+/**
+ * start with labelCount labels (0 to labelCount - 1), none placed
+ */
+void initAssembler(Assembler* as, int labelCount);
+void freeAssembler(Assembler* as);
+
+int newLabel(Assembler* as);
+void placeLabel(Assembler* as, int label);
+
+/**
+ * point every jump at its label
+ * returns false if some label was never placed
+ */
+bool resolveFixups(Assembler* as);
+
+/**
+ * copy the code into executable memory
+ * returns NULL if it could not be mapped or would pass the
+ * heap's hard limit
+ */
+void* finishCode(Assembler* as);
+void freeCode(void* code, size_t size);
+
+void emitByte(Assembler* as, uint8_t byte);
+void emitBytes(Assembler* as, const uint8_t* bytes, int count);
+void emitInt32(Assembler* as, int32_t value);
+void emitInt64(Assembler* as, uint64_t value);
+
+/**
+ * a 64-bit instruction between two registers, reg is the ModRM reg field
+ */
+void emitRegReg(Assembler* as, uint8_t opcode, int reg, int rm);
+
+/**
+ * an instruction with a [base + disp32] operand
+ */
+void emitRegMem(Assembler* as, bool wide, uint8_t opcode, int reg, int base, int32_t disp);
+
+void emitMov(Assembler* as, int dst, int src);
+void emitLoad(Assembler* as, int dst, int base, int32_t disp);
+void emitStore(Assembler* as, int base, int32_t disp, int src);
+void emitLea(Assembler* as, int dst, int base, int32_t disp);
+void emitMovImm64(Assembler* as, int reg, uint64_t value);
+void emitMovImm32(Assembler* as, int reg, int32_t value);
+
+/**
+ * add (ext 0), sub (ext 5) or cmp (ext 7) with an immediate
+ */
+void emitAluImm(Assembler* as, int ext, int reg, int32_t value);
+
+void emitPush(Assembler* as, int reg);
+void emitPop(Assembler* as, int reg);
+void emitCall(Assembler* as, void* func);
+
+/**
+ * scalar double instructions on xmm registers 0-7: an F2-prefixed
+ * 0F opcode between two xmm registers, or with a [base + disp32] operand
+ */
+void emitSseRegReg(Assembler* as, uint8_t opcode, int dst, int src);
+void emitSseMem(Assembler* as, uint8_t opcode, int xmm, int base, int32_t disp);
+
+#define SSE_LOAD 0x10 // movsd xmm, m64
+#define SSE_STORE 0x11 // movsd m64, xmm
+#define SSE_ADD 0x58
+#define SSE_MULTIPLY 0x59
+#define SSE_SUBTRACT 0x5c
+#define SSE_DIVIDE 0x5e
+
+/**
+ * movq between a general register (rax to rdi) and xmm 0-7
+ */
+void emitMovqToXmm(Assembler* as, int xmm, int reg);
+void emitMovqFromXmm(Assembler* as, int reg, int xmm);
+
+/**
+ * ucomisd a, b
+ */
+void emitCompareDoubles(Assembler* as, int a, int b);
+
+/**
+ * jumps are always rel32, these return where the offset goes
+ */
+int emitJcc(Assembler* as, uint8_t cc);
+int emitJmp(Assembler* as);
+void patchTo(Assembler* as, int at, int target);
+void patchHere(Assembler* as, int at);
+
+void addFixup(Assembler* as, int at, int label);
+void jumpTo(Assembler* as, uint8_t cc, int label);
+void jumpAlwaysTo(Assembler* as, int label);
+
+#endif
@@ -2,6 +2,12 @@
 #include <chunk.h>
 #include <memory.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <peephole.h>
+#include <object.h>
+#include <string.h>
+
+#define INDEX_MAX_LOAD 0.75
 
 
 void initChunk(Chunk* chunk) {
@@ -9,35 +15,455 @@ void initChunk(Chunk* chunk) {
   chunk->capacity = 0;
   chunk->count = 0;
 
-  chunk->lines = NULL;
-  initValueArray(&chunk->constants);
+  initLineTable(&chunk->lines);
+  initValueArray(&chunk->constants, MEM_CONSTANTS);
+
+  chunk->constantIndex = NULL;
+  chunk->indexCapacity = 0;
 }
 
 void writeChunk(Chunk* chunk, uint8_t byte, int line) {
   if (chunk->capacity < chunk->count + 1) {
-    int oldCapacity = chunk->capacity;
-    chunk->capacity = GROW_CAPACITY(oldCapacity);
-    chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-
-    // line information
-    chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
+    int capacity = GROW_CAPACITY(chunk->capacity);
+    uint8_t* code = GROW_ARRAY(uint8_t, chunk->code, chunk->capacity, capacity, MEM_CODE);
+    if (code == NULL) return;
+    chunk->code = code;
+    chunk->capacity = capacity;
   }
 
-  chunk->lines[chunk->count] = line;
+  writeLine(&chunk->lines, chunk->count, line);
 
   chunk->code[chunk->count] = byte;
   chunk->count++;
 }
 
+void initLineTable(LineTable* lines) {
+  lines->count = 0;
+  lines->capacity = 0;
+  lines->runs = NULL;
+}
+
+void freeLineTable(LineTable* lines) {
+  FREE_ARRAY(LineRun, lines->runs, lines->capacity, MEM_CODE);
+  initLineTable(lines);
+}
+
+void writeLine(LineTable* lines, int offset, int line) {
+  if (lines->count > 0 && lines->runs[lines->count - 1].line == line) return;
+
+  if (lines->capacity < lines->count + 1) {
+    int capacity = GROW_CAPACITY(lines->capacity);
+    LineRun* runs = GROW_ARRAY(LineRun, lines->runs, lines->capacity, capacity, MEM_CODE);
+    if (runs == NULL) return;
+    lines->runs = runs;
+    lines->capacity = capacity;
+  }
+
+  lines->runs[lines->count].offset = offset;
+  lines->runs[lines->count].line = line;
+  lines->count++;
+}
+
+int getLine(const LineTable* lines, int offset) {
+  // the last run starting at or before offset
+  int low = 0;
+  int high = lines->count - 1;
+  int line = 0;
+  while (low <= high) {
+    int mid = low + (high - low) / 2;
+    if (lines->runs[mid].offset <= offset) {
+      line = lines->runs[mid].line;
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return line;
+}
+
+
+/**
+ * only numbers and strings are shared, other constants
+ * (functions) are unique anyway
+ */
+static bool isIndexed(Value val) {
+  return IS_NUM(val) || IS_STRING(val);
+}
+
+static uint32_t hashConstant(Value val) {
+  if (IS_STRING(val)) {
+    return (AS_STRING(val))->hash;
+  }
+
+  double number = AS_NUMBER(val);
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(bits));
+  return (uint32_t)(bits ^ (bits >> 32)) * 2654435761u;
+}
+
+/**
+ * numbers match on their bits so 0 and -0 stay distinct
+ */
+static bool sameConstant(Value a, Value b) {
+  if (IS_STRING(a)) return IS_OBJ(b) && AS_OBJ(a) == AS_OBJ(b);
+
+  if (!IS_NUM(b)) return false;
+  double x = AS_NUMBER(a);
+  double y = AS_NUMBER(b);
+  return memcmp(&x, &y, sizeof(double)) == 0;
+}
+
+static void insertIndex(int* slots, int capacity, uint32_t hash, int index) {
+  uint32_t slot = hash & (capacity - 1);
+  while (slots[slot] != 0) {
+    slot = (slot + 1) & (capacity - 1);
+  }
+  slots[slot] = index + 1;
+}
+
+static bool growIndex(Chunk* chunk) {
+  int capacity = GROW_CAPACITY(chunk->indexCapacity);
+  int* slots = ALLOCATE(int, capacity, MEM_CONSTANTS);
+  if (slots == NULL) return false;
+  memset(slots, 0, sizeof(int) * capacity);
+
+  // only the indexed constants are rehashed
+  for (int i = 0; i < chunk->constants.count; i++) {
+    Value val = chunk->constants.data[i];
+    if (isIndexed(val)) insertIndex(slots, capacity, hashConstant(val), i);
+  }
+
+  FREE_ARRAY(int, chunk->constantIndex, chunk->indexCapacity, MEM_CONSTANTS);
+  chunk->constantIndex = slots;
+  chunk->indexCapacity = capacity;
+  return true;
+}
+
+static int findConstant(const Chunk* chunk, Value val, uint32_t hash) {
+  if (chunk->indexCapacity == 0) return -1;
+
+  uint32_t slot = hash & (chunk->indexCapacity - 1);
+  while (chunk->constantIndex[slot] != 0) {
+    int index = chunk->constantIndex[slot] - 1;
+    if (sameConstant(chunk->constants.data[index], val)) return index;
+    slot = (slot + 1) & (chunk->indexCapacity - 1);
+  }
+  return -1;
+}
 
 int addConstant(Chunk* chunk, Value val) {
-  writeValueArray(&chunk->constants, val);
-  return chunk->constants.count - 1;
+  if (!isIndexed(val)) {
+    if (!writeValueArray(&chunk->constants, val)) return -1;
+    return chunk->constants.count - 1;
+  }
+
+  uint32_t hash = hashConstant(val);
+  int index = findConstant(chunk, val, hash);
+  if (index != -1) return index;
+
+  if (chunk->constants.count + 1 > chunk->indexCapacity * INDEX_MAX_LOAD &&
+      !growIndex(chunk)) {
+    return -1;
+  }
+
+  if (!writeValueArray(&chunk->constants, val)) return -1;
+  index = chunk->constants.count - 1;
+  insertIndex(chunk->constantIndex, chunk->indexCapacity, hash, index);
+  return index;
+}
+
+int findStringConstant(const Chunk* chunk, const char* chars, int length, uint32_t hash) {
+  if (chunk->indexCapacity == 0) return -1;
+
+  uint32_t slot = hash & (chunk->indexCapacity - 1);
+  while (chunk->constantIndex[slot] != 0) {
+    int index = chunk->constantIndex[slot] - 1;
+    Value val = chunk->constants.data[index];
+    if (IS_STRING(val)) {
+      ObjString* str = AS_STRING(val);
+      if (str->length == length && memcmp(str->str, chars, length) == 0) {
+        return index;
+      }
+    }
+    slot = (slot + 1) & (chunk->indexCapacity - 1);
+  }
+  return -1;
 }
 
 void freeChunk(Chunk* chunk) {
-  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(int, chunk->lines, chunk->capacity);
-  initChunk(chunk);
+  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity, MEM_CODE);
+  freeLineTable(&chunk->lines);
+  FREE_ARRAY(int, chunk->constantIndex, chunk->indexCapacity, MEM_CONSTANTS);
   freeValueArray(&chunk->constants);
+  initChunk(chunk);
+}
+
+int operandSize(uint8_t instruction) {
+  switch(instruction) {
+    case OP_CONSTANT:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_CALL:
+    case OP_TAIL_CALL:
+      return 1;
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_TRUE:
+    case OP_LOOP:
+    case OP_LOOP_TRACE:
+      return 2;
+    case OP_CONSTANT_LONG:
+    case OP_CALL_NATIVE:
+    case OP_JUMP_LONG:
+    case OP_JUMP_IF_FALSE_LONG:
+    case OP_JUMP_IF_TRUE_LONG:
+    case OP_LOOP_LONG:
+    case OP_LOOP_LONG_TRACE:
+      return 3;
+    case OP_ADD_R:
+    case OP_SUBTRACT_R:
+    case OP_MULTIPLY_R:
+    case OP_DIVIDE_R:
+    case OP_LESS_R:
+    case OP_GREATER_R:
+      return 3;
+    case OP_JUMP_IF_NOT_LESS_R:
+    case OP_JUMP_IF_NOT_GREATER_R:
+      return 4;
+    default: {
+      const Superinstruction* super = findSuperinstruction(instruction);
+      if (super == NULL) return 0;
+
+      int size = 0;
+      for (int i = 0; i < super->count; i++) {
+        size += operandSize(super->components[i]);
+      }
+      return size;
+    }
+  }
+}
+
+int instructionSize(uint8_t instruction) {
+  return 1 + operandSize(instruction);
+}
+
+static bool isJump(uint8_t instruction) {
+  switch(instruction) {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_TRUE:
+    case OP_LOOP:
+    case OP_JUMP_LONG:
+    case OP_JUMP_IF_FALSE_LONG:
+    case OP_JUMP_IF_TRUE_LONG:
+    case OP_LOOP_LONG:
+    case OP_LOOP_TRACE:
+    case OP_LOOP_LONG_TRACE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool isLongJump(uint8_t jump) {
+  return jump == OP_JUMP_LONG || jump == OP_JUMP_IF_FALSE_LONG ||
+    jump == OP_JUMP_IF_TRUE_LONG || jump == OP_LOOP_LONG ||
+    jump == OP_LOOP_LONG_TRACE;
+}
+
+static bool isLoop(uint8_t jump) {
+  return jump == OP_LOOP || jump == OP_LOOP_LONG ||
+    jump == OP_LOOP_TRACE || jump == OP_LOOP_LONG_TRACE;
+}
+
+/**
+ * find the operand of the jump inside an instruction
+ * returns -1 if there is no jump
+ */
+static int jumpOperand(uint8_t instruction, uint8_t* jump) {
+  // register branches jump forward after their two source operands
+  if (instruction == OP_JUMP_IF_NOT_LESS_R ||
+      instruction == OP_JUMP_IF_NOT_GREATER_R) {
+    *jump = OP_JUMP;
+    return 3;
+  }
+
+  const Superinstruction* super = findSuperinstruction(instruction);
+  if (super == NULL) {
+    *jump = instruction;
+    return isJump(instruction) ? 1 : -1;
+  }
+
+  int operand = 1;
+  for (int i = 0; i < super->count; i++) {
+    uint8_t component = super->components[i];
+    if (isJump(component)) {
+      *jump = component;
+      return operand;
+    }
+    operand += operandSize(component);
+  }
+  return -1;
+}
+
+int jumpTarget(const Chunk* chunk, int offset) {
+  uint8_t instruction = chunk->code[offset];
+  uint8_t jump;
+  int operand = jumpOperand(instruction, &jump);
+  if (operand == -1) return -1;
+
+  const uint8_t* bytes = chunk->code + offset + operand;
+  int distance = isLongJump(jump) ?
+    (bytes[0] << 16) | (bytes[1] << 8) | bytes[2] :
+    (bytes[0] << 8) | bytes[1];
+  int end = offset + instructionSize(instruction);
+
+  return isLoop(jump) ? end - distance : end + distance;
+}
+
+bool setJumpTarget(Chunk* chunk, int offset, int target) {
+  uint8_t instruction = chunk->code[offset];
+  uint8_t jump;
+  int operand = jumpOperand(instruction, &jump);
+  if (operand == -1) return false;
+
+  int end = offset + instructionSize(instruction);
+  int distance = isLoop(jump) ? end - target : target - end;
+  uint8_t* bytes = chunk->code + offset + operand;
+
+  if (isLongJump(jump)) {
+    if (distance < 0 || distance > JUMP_LONG_MAX) return false;
+    bytes[0] = (distance >> 16) & 0xff;
+    bytes[1] = (distance >> 8) & 0xff;
+    bytes[2] = distance & 0xff;
+    return true;
+  }
+
+  if (distance < 0 || distance > UINT16_MAX) return false;
+  bytes[0] = (distance >> 8) & 0xff;
+  bytes[1] = distance & 0xff;
+  return true;
+}
+
+/**
+ * change in stack height after the instruction at offset
+ */
+static int stackEffect(const Chunk* chunk, int offset) {
+  uint8_t instruction = chunk->code[offset];
+  switch(instruction) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_NULL:
+    case OP_GET_GLOBAL:
+    case OP_GET_LOCAL:
+      return 1;
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_LESS:
+    case OP_GREATER:
+    case OP_EQUAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_SET_LOCAL:
+    case OP_POP:
+    case OP_RETURN:
+      return -1;
+    case OP_CALL:
+    case OP_TAIL_CALL:
+      // the callee and its arguments are replaced by the result
+      return -chunk->code[offset + 1];
+    case OP_CALL_NATIVE:
+      // nothing is pushed for the callee, the result takes an argument's slot
+      return 1 - chunk->code[offset + 3];
+    default:
+      return 0;
+  }
+}
+
+/**
+ * register instructions write their destination slot directly,
+ * which may sit above the current stack height
+ */
+static int registerHeight(const Chunk* chunk, int offset) {
+  switch(chunk->code[offset]) {
+    case OP_ADD_R:
+    case OP_SUBTRACT_R:
+    case OP_MULTIPLY_R:
+    case OP_DIVIDE_R:
+    case OP_LESS_R:
+    case OP_GREATER_R:
+      return chunk->code[offset + 1] + 1;
+    default:
+      return 0;
+  }
+}
+
+static bool fallsThrough(uint8_t instruction) {
+  switch(instruction) {
+    case OP_JUMP:
+    case OP_JUMP_LONG:
+    case OP_LOOP:
+    case OP_LOOP_LONG:
+    case OP_LOOP_TRACE:
+    case OP_LOOP_LONG_TRACE:
+    case OP_RETURN:
+      return false;
+    default:
+      return true;
+  }
+}
+
+/**
+ * walks every reachable instruction once, the height at a jump target
+ * is the same along every path into it. expects unfused code
+ */
+int maxStackHeight(const Chunk* chunk, int argSlots) {
+  if (chunk->count == 0) return argSlots;
+
+  int* heights = ALLOCATE(int, chunk->count + 1, MEM_CODE);
+  int* worklist = ALLOCATE(int, chunk->count + 1, MEM_CODE);
+  if (heights == NULL || worklist == NULL) {
+    FREE_ARRAY(int, worklist, chunk->count + 1, MEM_CODE);
+    FREE_ARRAY(int, heights, chunk->count + 1, MEM_CODE);
+    return -1;
+  }
+
+  for (int i = 0; i <= chunk->count; i++) heights[i] = -1;
+
+  int max = argSlots;
+  int pending = 0;
+  heights[0] = argSlots;
+  worklist[pending++] = 0;
+
+  while (pending > 0) {
+    int offset = worklist[--pending];
+    uint8_t instruction = chunk->code[offset];
+    int height = heights[offset] + stackEffect(chunk, offset);
+
+    if (height > max) max = height;
+    if (registerHeight(chunk, offset) > max) max = registerHeight(chunk, offset);
+
+    int successors[2] = {-1, jumpTarget(chunk, offset)};
+    if (fallsThrough(instruction)) {
+      successors[0] = offset + instructionSize(instruction);
+    }
+
+    for (int i = 0; i < 2; i++) {
+      int next = successors[i];
+      if (next < 0 || next >= chunk->count || heights[next] != -1) continue;
+      heights[next] = height;
+      worklist[pending++] = next;
+    }
+  }
+
+  FREE_ARRAY(int, worklist, chunk->count + 1, MEM_CODE);
+  FREE_ARRAY(int, heights, chunk->count + 1, MEM_CODE);
+  return max;
 }
@@ -2,6 +2,7 @@
 #include <ast.h>
 #include <value.h>
 #include <compiler.h>
+#include <gc.h>
 #include <scanner.h>
 #include <chunk.h>
 #include <parser.h>
@@ -11,13 +12,13 @@
 #include <object.h>
 #include <string.h>
 #include <stdint.h>
+#include <peephole.h>
 
 static bool compileExpression(VM*, Expression*);
 static bool compileStatement(VM* vm, const Statement* stmt);
 static int emitJumpInstruction(VM* vm, uint8_t instr, int line);
 static void patchJump(VM* vm, int offset);
 static ObjFunction* endCompiler(VM* vm);
-static bool compileIdentifier(VM* vm, Identifier ident, bool assign);
 
 static void error(const char* msg, int line) {
   fprintf(stderr, "[line %d] ERROR: %s\n", line, msg);
@@ -39,14 +40,6 @@ static void endScope(VM* vm) {
   }
 }
 
-static void compileReturnVal(VM* vm, const Expression* expr) {
-  if (expr->type == EXPR_CALL) {
-    Token tok = {.type = TOKEN_IDENTIFIER, .length = 6, .start = "return"};
-    Identifier ident = {.length = 6, .token = tok, .start = "return"};
-    compileIdentifier(vm, ident, false);
-  }
-}
-
 static bool compilePrefix(VM* vm, Prefix* prefix) {
   if (prefix->operator == TOKEN_MINUS) {
     compileExpression(vm, prefix->expression);
@@ -64,7 +57,6 @@ static bool compilePrefix(VM* vm, Prefix* prefix) {
     return false;
   }
 
-  compileReturnVal(vm, prefix->expression);
 
   return true;
 }
@@ -73,14 +65,12 @@ static bool compileAndExpression(VM* vm, Infix* infix) {
   if (!compileExpression(vm, infix->left)) {
     return false;
   }
-  compileReturnVal(vm, infix->left);
   int leftOffset = emitJumpInstruction(vm, OP_JUMP_IF_FALSE, infix->token.line);
 
   writeChunk(&CURRENT_CHUNK(vm), OP_POP, 0);
   if (!compileExpression(vm, infix->right)) {
     return false;
   }
-  compileReturnVal(vm, infix->right);
   
   patchJump(vm, leftOffset);
 
@@ -91,14 +81,12 @@ static bool compileOrExpression(VM* vm, Infix* infix) {
   if (!compileExpression(vm, infix->left)) {
     return false;
   }
-  compileReturnVal(vm, infix->left);
   int leftOffset = emitJumpInstruction(vm, OP_JUMP_IF_TRUE, infix->token.line);
 
   writeChunk(&CURRENT_CHUNK(vm), OP_POP, 0);
   if (!compileExpression(vm, infix->right)) {
     return false;
   }
-  compileReturnVal(vm, infix->right);
 
 
   patchJump(vm, leftOffset);
@@ -115,10 +103,8 @@ static bool compileInfix(VM* vm, Infix* infix) {
   }
 
   if (!compileExpression(vm, infix->left)) return false;
-  compileReturnVal(vm, infix->left);
 
   if (!compileExpression(vm, infix->right)) return false;
-  compileReturnVal(vm, infix->right);
 
   switch(infix->operator) {
     case TOKEN_PLUS: {
@@ -168,28 +154,62 @@ static bool compileInfix(VM* vm, Infix* infix) {
   return true;
 }
 
-static void writeConstant(Chunk* chunk, Value val, int line) {
-  int i = addConstant(chunk, val);
-  writeChunk(chunk, OP_CONSTANT, line);
-  writeChunk(chunk, i, line);
+static void emitConstant(VM* vm, int index, int line) {
+  Chunk* chunk = &CURRENT_CHUNK(vm);
+  if (index <= UINT8_MAX) {
+    writeChunk(chunk, OP_CONSTANT, line);
+    writeChunk(chunk, index, line);
+    return;
+  }
+
+  if (index > CONSTANT_LONG_MAX) {
+    error("too many constants in one chunk", line);
+    return;
+  }
+
+  writeChunk(chunk, OP_CONSTANT_LONG, line);
+  writeChunk(chunk, (index >> 16) & 0xff, line);
+  writeChunk(chunk, (index >> 8) & 0xff, line);
+  writeChunk(chunk, index & 0xff, line);
 }
 
-static char* createName(const Identifier* ident) {
-  char* name = ALLOCATE(char, ident->length + 1);
-  memcpy(name, ident->start, ident->length);
-  name[ident->length] = '\0';
+static void writeConstant(VM* vm, Value val, int line) {
+  OBJECT_BARRIER(vm, val);
+  emitConstant(vm, addConstant(&CURRENT_CHUNK(vm), val), line);
+}
 
-  return name;
+/**
+ * globals are resolved to a slot in vm->globals at compile time
+ */
+static int resolveGlobal(VM* vm, const Identifier* ident) {
+  int slot = resolveGlobalSlot(vm, ident->start, ident->length);
+  if (slot == -1) {
+    error("out of memory", ident->token.line);
+    return -1;
+  }
+
+  if (slot > UINT16_MAX) {
+    error("too many global variables", ident->token.line);
+    return -1;
+  }
+
+  return slot;
+}
+
+static void emitGlobalInstruction(VM* vm, uint8_t opCode, int slot, int line) {
+  writeChunk(&CURRENT_CHUNK(vm), opCode, line);
+  writeChunk(&CURRENT_CHUNK(vm), (slot >> 8) & 0xff, line);
+  writeChunk(&CURRENT_CHUNK(vm), slot & 0xff, line);
 }
 
-static int resolveLocal(VM* vm, Identifier ident) {
+static int resolveLocal(VM* vm, const Identifier* ident) {
   Compiler* compiler = vm->compiler;
   for (int i = compiler->localCount - 1; i >= 0; i--) {
     Local local = compiler->locals[i];
-    if (local.name.length == ident.token.length) {
+    if (local.name.length == ident->token.length) {
       const char* localStart = local.name.start;
-      const char* identStart = ident.token.start;
-      int length = ident.token.length;
+      const char* identStart = ident->token.start;
+      int length = ident->token.length;
       if (memcmp(localStart, identStart, length) == 0) {
         // accounting for first slot being used by compiler
         return i - 1;
@@ -199,48 +219,207 @@ static int resolveLocal(VM* vm, Identifier ident) {
   return -1;
 }
 
-static bool compileIdentifier(VM* vm, Identifier ident, bool assign) {
+static bool compileIdentifier(VM* vm, const Identifier* ident, bool assign) {
   Compiler* compiler = vm->compiler;
   int arg = resolveLocal(vm, ident);
   uint8_t opCode;
 
 
   if (arg == -1) {
-    char* name = createName(&ident);
-    Obj* obj = (Obj*)allocateString(vm, name);
-    if (obj == NULL) {
-      free(name);
-      return false;
-    }
-    Value val = OBJ_VAL(obj);
-    writeConstant(&CURRENT_CHUNK(vm), val, ident.token.line);
+    int slot = resolveGlobal(vm, ident);
+    if (slot == -1) return false;
     opCode = assign ? OP_SET_GLOBAL : OP_GET_GLOBAL;
+    emitGlobalInstruction(vm, opCode, slot, ident->token.line);
   } else {
-    Value val = NUMBER_VAL((uint8_t)arg);
-    writeConstant(&CURRENT_CHUNK(vm), val, ident.token.line);
+    // locals live at a fixed slot in the frame, known at compile time
     opCode = assign ? OP_SET_LOCAL : OP_GET_LOCAL;
+    writeChunk(&CURRENT_CHUNK(vm), opCode, ident->token.line);
+    writeChunk(&CURRENT_CHUNK(vm), (uint8_t)arg, ident->token.line);
   }
 
-  writeChunk(&CURRENT_CHUNK(vm), opCode, ident.token.line);
   return true;
 }
 
-static bool compileCallExpression(VM* vm, const CallExpression* call) {
+/**
+ * register backend: arithmetic and comparisons whose leaves are locals
+ * and number constants compile to three-address instructions over frame
+ * slots. temporaries are handed out above the live locals, which is
+ * where the stack top sits between statements
+ */
+static int registerOpCode(TokenType operator) {
+  switch(operator) {
+    case TOKEN_PLUS: return OP_ADD_R;
+    case TOKEN_MINUS: return OP_SUBTRACT_R;
+    case TOKEN_STAR: return OP_MULTIPLY_R;
+    case TOKEN_SLASH: return OP_DIVIDE_R;
+    case TOKEN_LESS: return OP_LESS_R;
+    case TOKEN_GREATER: return OP_GREATER_R;
+    default: return -1;
+  }
+}
+
+static Expression* stripGroups(Expression* expr) {
+  while (expr->type == EXPR_GROUP) {
+    expr = expr->data.group.expr;
+  }
+  return expr;
+}
+
+/**
+ * count the temporaries and constants an expression needs
+ * returns false if part of it cannot be a register operand
+ */
+static bool registerCost(VM* vm, Expression* expr, int* temps, int* constants) {
+  expr = stripGroups(expr);
+  switch(expr->type) {
+    case EXPR_NUMBER:
+      (*constants)++;
+      return true;
+    case EXPR_IDENT: {
+      int slot = resolveLocal(vm, &expr->data.identifier);
+      return slot != -1 && slot <= RK_MAX;
+    }
+    case EXPR_INFIX: {
+      Infix* infix = &expr->data.infix;
+      if (registerOpCode(infix->operator) == -1) return false;
+      (*temps)++;
+      return registerCost(vm, infix->left, temps, constants) &&
+        registerCost(vm, infix->right, temps, constants);
+    }
+    default:
+      return false;
+  }
+}
+
+static bool isRegisterInfix(VM* vm, Expression* expr) {
+  if (!vm->registerBytecode || stripGroups(expr)->type != EXPR_INFIX) {
+    return false;
+  }
+
+  int temps = 0;
+  int constants = 0;
+  if (!registerCost(vm, expr, &temps, &constants)) return false;
+
+  int stackHeight = vm->compiler->localCount - 1;
+  return stackHeight + temps <= RK_MAX &&
+    CURRENT_CHUNK(vm).constants.count + constants <= RK_MAX;
+}
+
+static void emitRegisterInfix(VM* vm, Infix* infix, int dst, int temp);
+
+/**
+ * returns the RK operand holding expr's value, computing it
+ * into temp first if it is not a local or a constant
+ */
+static uint8_t emitRegisterOperand(VM* vm, Expression* expr, int temp) {
+  expr = stripGroups(expr);
+  switch(expr->type) {
+    case EXPR_NUMBER: {
+      Value val = NUMBER_VAL(expr->data.number.value);
+      return RK_CONSTANT | addConstant(&CURRENT_CHUNK(vm), val);
+    }
+    case EXPR_IDENT:
+      return (uint8_t)resolveLocal(vm, &expr->data.identifier);
+    default:
+      emitRegisterInfix(vm, &expr->data.infix, temp, temp);
+      return temp;
+  }
+}
+
+/**
+ * emit both operands of infix, returning them in b and c
+ */
+static void emitRegisterOperands(VM* vm, Infix* infix, int temp, uint8_t* b, uint8_t* c) {
+  *b = emitRegisterOperand(vm, infix->left, temp);
+
+  // a temporary holding the left operand stays live while the right is computed
+  int next = *b == temp ? temp + 1 : temp;
+  *c = emitRegisterOperand(vm, infix->right, next);
+}
+
+static void emitRegisterInfix(VM* vm, Infix* infix, int dst, int temp) {
+  uint8_t b;
+  uint8_t c;
+  emitRegisterOperands(vm, infix, temp, &b, &c);
+
+  int line = infix->token.line;
+  writeChunk(&CURRENT_CHUNK(vm), registerOpCode(infix->operator), line);
+  writeChunk(&CURRENT_CHUNK(vm), (uint8_t)dst, line);
+  writeChunk(&CURRENT_CHUNK(vm), b, line);
+  writeChunk(&CURRENT_CHUNK(vm), c, line);
+}
+
+/**
+ * a < or > condition over register operands becomes a single
+ * compare-and-branch that leaves nothing on the stack
+ * returns the offset to patch, or -1 if the condition needs stack code
+ */
+static int emitRegisterBranch(VM* vm, Expression* condition) {
+  // register branches only have a two-byte offset
+  if (vm->compiler->longJumps || !isRegisterInfix(vm, condition)) return -1;
+
+  Infix* infix = &stripGroups(condition)->data.infix;
+  uint8_t instr;
+  switch(infix->operator) {
+    case TOKEN_LESS: instr = OP_JUMP_IF_NOT_LESS_R; break;
+    case TOKEN_GREATER: instr = OP_JUMP_IF_NOT_GREATER_R; break;
+    default: return -1;
+  }
+
+  uint8_t b;
+  uint8_t c;
+  emitRegisterOperands(vm, infix, vm->compiler->localCount - 1, &b, &c);
+
+  int line = infix->token.line;
+  writeChunk(&CURRENT_CHUNK(vm), instr, line);
+  writeChunk(&CURRENT_CHUNK(vm), b, line);
+  writeChunk(&CURRENT_CHUNK(vm), c, line);
+  writeChunk(&CURRENT_CHUNK(vm), 0xff, 0);
+  writeChunk(&CURRENT_CHUNK(vm), 0xff, 0);
+
+  return CURRENT_CHUNK(vm).count - 2;
+}
+
+/**
+ * returns the global slot of a call's callee if that global holds a native
+ * accepting this many arguments, -1 otherwise. natives are defined before
+ * anything is compiled, and OP_CALL_NATIVE checks the slot again when it runs
+ */
+static int nativeCallSlot(VM* vm, const CallExpression* call) {
+  if (resolveLocal(vm, &call->name) != -1) return -1;
+
+  // a slot that can't be had is reported when the callee is compiled
+  int slot = resolveGlobalSlot(vm, call->name.start, call->name.length);
+  if (slot == -1 || slot > UINT16_MAX) return -1;
+
+  Value callee = vm->globals.data[slot];
+  if (!IS_NATIVE(callee)) return -1;
+
+  ObjNative* native = AS_NATIVE(callee);
+  int arity = native->arity;
+  if (arity != NATIVE_VARIADIC && arity != call->argCount) return -1;
+  return slot;
+}
+
+static bool compileCallExpression(VM* vm, const CallExpression* call, uint8_t callInstr) {
 
   for (int i = 0; i < call->argCount; i++) {
-    if (!compileExpression(vm, call->args + i)) {
+    if (!compileExpression(vm, call->args[i])) {
       return false;
     }
-    compileReturnVal(vm, call->args + i);
-    writeChunk(&CURRENT_CHUNK(vm), OP_MARK_LOCAL, call->token.line);
   }
 
-  if (!compileIdentifier(vm, call->name, false)) {
-    error("insufficient memory", call->token.line);
-    return false;
+  // natives need no frame, so a tail call to one is an ordinary native call
+  int nativeSlot = nativeCallSlot(vm, call);
+  if (nativeSlot != -1) {
+    emitGlobalInstruction(vm, OP_CALL_NATIVE, nativeSlot, call->token.line);
+    writeChunk(&CURRENT_CHUNK(vm), (uint8_t)call->argCount, call->token.line);
+    return true;
   }
 
-  writeChunk(&CURRENT_CHUNK(vm), OP_CALL, call->token.line);
+  if (!compileIdentifier(vm, &call->name, false)) return false;
+
+  writeChunk(&CURRENT_CHUNK(vm), callInstr, call->token.line);
   writeChunk(&CURRENT_CHUNK(vm), (uint8_t)call->argCount, call->token.line);
 
   return true;
@@ -249,49 +428,55 @@ static bool compileCallExpression(VM* vm, const CallExpression* call) {
 static bool compileExpression(VM* vm, Expression* expr) {
   switch(expr->type) {
     case EXPR_PREFIX: {
-      Prefix prefix = AS_EXPR_PREFIX((*expr));
-      if (compilePrefix(vm, &prefix)) break;
+      if (compilePrefix(vm, &AS_EXPR_PREFIX((*expr)))) break;
       return false;
     case EXPR_INFIX: {
-      Infix infix = AS_EXPR_INFIX((*expr));
-      if (compileInfix(vm, &infix)) break;
+      if (compileInfix(vm, &AS_EXPR_INFIX((*expr)))) break;
       return false;
     }
     case EXPR_GROUP: {
-      Group group = AS_EXPR_GROUP((*expr));
-      if (compileExpression(vm, group.expr)){
+      if (compileExpression(vm, AS_EXPR_GROUP((*expr)).expr)){
         break;
       }
       return false;
     }
     case EXPR_NUMBER: {
-      Number number = AS_EXPR_NUM((*expr));
-      Value val = NUMBER_VAL(number.value);
-      writeConstant(&CURRENT_CHUNK(vm), val, number.token.line);
+      const Number* number = &AS_EXPR_NUM((*expr));
+      Value val = NUMBER_VAL(number->value);
+      writeConstant(vm, val, number->token.line);
       break;
     }
     case EXPR_STRING: {
-      char* str = createString(expr);
-      Obj* obj = (Obj*)allocateString(vm, str);
+      const Token* token = &expr->data.string.token;
+      int line = token->line;
+
+      // not including quotation marks in value
+      const char* str = token->start + 1;
+      int length = token->length - 2;
+
+      // reuse an equal literal before allocating another string object
+      int index = findStringConstant(&CURRENT_CHUNK(vm), str, length,
+          hashString(str, length));
+      if (index != -1) {
+        emitConstant(vm, index, line);
+        break;
+      }
+
+      Obj* obj = (Obj*)copyString(vm, str, length);
       if (obj == NULL) {
-        free(str);
+        error("out of memory", line);
         return false;
       }
       Value val = OBJ_VAL(obj);
-      writeConstant(&CURRENT_CHUNK(vm), val, expr->data.string.token.line);
+      writeConstant(vm, val, line);
       break;
     }
     case EXPR_IDENT: {
-      Identifier ident = AS_EXPR_IDENT((*expr));
-      if (!compileIdentifier(vm, ident, false)) {
-        error("insufficient memory", ident.token.line);
-        return false;
-      }
+      if (!compileIdentifier(vm, &AS_EXPR_IDENT((*expr)), false)) return false;
       break;
     }
     case EXPR_CALL: {
-      CallExpression call = AS_EXPR_CALL((*expr));
-      if (!compileCallExpression(vm, &call)) return false;
+      if (!compileCallExpression(vm, &AS_EXPR_CALL((*expr)), OP_CALL)) return false;
       break;
     }
     case EXPR_ERROR:
@@ -305,14 +490,15 @@ static bool compileExpression(VM* vm, Expression* expr) {
       }
       break;
     case EXPR_NULL: 
-      writeChunk(&CURRENT_CHUNK(vm), OP_NULL, expr->data.number.token.line);
+      // a missing value has no token of its own
+      writeChunk(&CURRENT_CHUNK(vm), OP_NULL, 0);
       break;
   }
 
   return true;
 }
 
-static bool addLocal(VM* vm, Token name, bool isArg) {
+static bool addLocal(VM* vm, Token name) {
   Compiler* compiler = vm->compiler;
   Local* local = &compiler->locals[compiler->localCount++];
   local->name = name;
@@ -323,103 +509,143 @@ static bool addLocal(VM* vm, Token name, bool isArg) {
     return false;
   }
 
-  if (!isArg) {
-    writeChunk(&CURRENT_CHUNK(vm), OP_MARK_LOCAL, name.line);
-  }
-
   return true;
 }
 
-static bool compileDeclaration(VM* vm, int line, Identifier ident, bool isArg) {
+static bool compileDeclaration(VM* vm, int line, const Identifier* ident) {
   bool isLocal = vm->compiler->scopeDepth > 0;
 
-  if (!isLocal) {
-    char* name = createName(&ident);
-    Obj* obj = (Obj*)allocateString(vm, name);
-    Value val = OBJ_VAL(obj);
-    writeConstant(&CURRENT_CHUNK(vm), val, line);
-  }
-  
   // if scope depth is greater than zero, then variable is local
-  // so we do not want to create a global instruction
+  // so we do not want to create a global instruction.
+  // the value (or argument) already sits in the local's slot
   if (isLocal) {
-    return addLocal(vm, ident.token, isArg);
+    return addLocal(vm, ident->token);
   }
 
-  writeChunk(&CURRENT_CHUNK(vm), OP_DEFINE_GLOBAL, line);
+  int slot = resolveGlobal(vm, ident);
+  if (slot == -1) return false;
+
+  emitGlobalInstruction(vm, OP_DEFINE_GLOBAL, slot, line);
   return true;
 }
 
 static bool compileVarStatement(VM* vm, const Statement* stmt) {
-  Identifier ident = AS_VARSTMT((*stmt)).name;
-
-  Expression expr = AS_VARSTMT((*stmt)).value;
-  if (!compileExpression(vm, &expr)) {
+  const VarStatement* vs = &AS_VARSTMT((*stmt));
+
+  Expression* expr = vs->value;
+  if (vm->compiler->scopeDepth > 0 && isRegisterInfix(vm, expr)) {
+    // compute straight into the new local's slot, then claim it
+    int slot = vm->compiler->localCount - 1;
+    emitRegisterInfix(vm, &stripGroups(expr)->data.infix, slot, slot);
+    writeChunk(&CURRENT_CHUNK(vm), OP_GET_LOCAL, vs->token.line);
+    writeChunk(&CURRENT_CHUNK(vm), (uint8_t)slot, vs->token.line);
+  } else if (!compileExpression(vm, expr)) {
     return false;
   }
-  compileReturnVal(vm, &expr);
 
-  return compileDeclaration(vm, stmt->data.varStmt.token.line, ident, false);
+  return compileDeclaration(vm, vs->token.line, &vs->name);
 }
 
-static bool compileBlockStatement(VM* vm, const Statement* stmt) {
-  Statements stmts = AS_BLOCKSTMT((*stmt)).stmts;
+static bool compileBlock(VM* vm, const BlockStatement* block) {
+  const Statements* stmts = &block->stmts;
 
-  for (int i = 0; i < stmts.count; i++) {
-    Statement inner = stmts.stmts[i];
-    if (!compileStatement(vm, &inner)) return false;
+  for (int i = 0; i < stmts->count; i++) {
+    if (!compileStatement(vm, stmts->stmts[i])) return false;
   }
   
   return true;
 }
 
+static bool compileScopedBlock(VM* vm, const BlockStatement* block) {
+  beginScope(vm);
+  bool result = compileBlock(vm, block);
+  endScope(vm);
+  return result;
+}
+
+static uint8_t longJump(uint8_t instr) {
+  switch(instr) {
+    case OP_JUMP: return OP_JUMP_LONG;
+    case OP_JUMP_IF_FALSE: return OP_JUMP_IF_FALSE_LONG;
+    case OP_JUMP_IF_TRUE: return OP_JUMP_IF_TRUE_LONG;
+    default: return instr;
+  }
+}
+
 static int emitJumpInstruction(VM* vm, uint8_t instr, int line) {
-  writeChunk(&CURRENT_CHUNK(vm), instr, line);
+  if (vm->compiler->longJumps) {
+    writeChunk(&CURRENT_CHUNK(vm), longJump(instr), line);
+    writeChunk(&CURRENT_CHUNK(vm), 0xff, 0);
+  } else {
+    writeChunk(&CURRENT_CHUNK(vm), instr, line);
+  }
 
-  // leave two bytes for jump offset
+  // leave two (or three) bytes for jump offset
   writeChunk(&CURRENT_CHUNK(vm), 0xff, 0);
   writeChunk(&CURRENT_CHUNK(vm), 0xff, 0);
 
-  return CURRENT_CHUNK(vm).count - 2;
+  return CURRENT_CHUNK(vm).count - (vm->compiler->longJumps ? 3 : 2);
 }
 
 static void patchJump(VM* vm, int offset) {
-  int jump = CURRENT_CHUNK(vm).count - offset - 2;
+  Chunk* chunk = &CURRENT_CHUNK(vm);
+
+  // the jump's bytes may have been dropped, the compile fails anyway
+  if (vm->heap.outOfMemory) return;
+
+  if (vm->compiler->longJumps) {
+    int jump = chunk->count - offset - 3;
+    if (jump > JUMP_LONG_MAX) {
+      error("too many bytes in jump", 0);
+      return;
+    }
 
+    chunk->code[offset] = (jump >> 16) & 0xff;
+    chunk->code[offset + 1] = (jump >> 8) & 0xff;
+    chunk->code[offset + 2] = jump & 0xff;
+    return;
+  }
+
+  int jump = chunk->count - offset - 2;
   if (jump > UINT16_MAX) {
-    error("too many bytes in jump", 0);
+    // the caller compiles the function again with long jumps
+    vm->compiler->jumpOverflow = true;
     return;
   }
 
   // breaking out jump integer into 2 different bytes
-  CURRENT_CHUNK(vm).code[offset] = (jump >> 8) & 0xff;
-  CURRENT_CHUNK(vm).code[offset + 1] = jump & 0xff;
+  chunk->code[offset] = (jump >> 8) & 0xff;
+  chunk->code[offset + 1] = jump & 0xff;
 }
 
 static bool compileIfStatement(VM* vm, const Statement* stmt) {
-  IfStatement is = AS_IFSTMT((*stmt));
+  const IfStatement* is = &AS_IFSTMT((*stmt));
 
-  if (!compileExpression(vm, &is.condition)) {
-    return false;
-  }
-  compileReturnVal(vm, &is.condition);
+  // a register branch leaves no condition on the stack to pop
+  int thenOffset = emitRegisterBranch(vm, is->condition);
+  bool stackCondition = thenOffset == -1;
+  if (stackCondition) {
+    if (!compileExpression(vm, is->condition)) {
+      return false;
+    }
 
-  int thenOffset = emitJumpInstruction(vm, OP_JUMP_IF_FALSE, is.token.line);
-  writeChunk(&CURRENT_CHUNK(vm), OP_POP, is.token.line);
+    thenOffset = emitJumpInstruction(vm, OP_JUMP_IF_FALSE, is->token.line);
+    writeChunk(&CURRENT_CHUNK(vm), OP_POP, is->token.line);
+  }
 
-  Statement block = {.type = STMT_BLOCK, .data = {.blockStmt = is.block}};
-  if (!compileStatement(vm, &block)) {
+  if (!compileScopedBlock(vm, &is->block)) {
     return false;
   }
 
-  int elseOffset = emitJumpInstruction(vm, OP_JUMP, is.elseBlock.token.line);
+  int elseOffset = emitJumpInstruction(vm, OP_JUMP, is->elseBlock.token.line);
 
   patchJump(vm, thenOffset);
-  writeChunk(&CURRENT_CHUNK(vm), OP_POP, is.token.line);
+  if (stackCondition) {
+    writeChunk(&CURRENT_CHUNK(vm), OP_POP, is->token.line);
+  }
 
-  if (is.elseBlock.token.type != TOKEN_NULL) {
-    Statement elseBlock = {.type = STMT_BLOCK, .data = {.blockStmt = is.elseBlock}};
-    if (!compileBlockStatement(vm, &elseBlock)) {
+  if (is->elseBlock.token.type != TOKEN_NULL) {
+    if (!compileScopedBlock(vm, &is->elseBlock)) {
       return false;
     }
   }
@@ -431,85 +657,142 @@ static bool compileIfStatement(VM* vm, const Statement* stmt) {
 }
 
 static void emitLoop(VM* vm, int loopStart, int line) {
-  writeChunk(&CURRENT_CHUNK(vm), OP_LOOP, line);
-  int jump = (CURRENT_CHUNK(vm).count - loopStart) + 2;
+  // the distance is known here, so the long form is only used when needed
+  int jump = (CURRENT_CHUNK(vm).count - loopStart) + 3;
+  if (jump <= UINT16_MAX) {
+    writeChunk(&CURRENT_CHUNK(vm), OP_LOOP, line);
+    writeChunk(&CURRENT_CHUNK(vm), (jump >> 8) & 0xff, line);
+    writeChunk(&CURRENT_CHUNK(vm), jump & 0xff, line);
+    return;
+  }
 
-  if (jump > UINT16_MAX) {
+  jump++;
+  if (jump > JUMP_LONG_MAX) {
     error("loop body too large", line);
     return;
   }
 
+  writeChunk(&CURRENT_CHUNK(vm), OP_LOOP_LONG, line);
+  writeChunk(&CURRENT_CHUNK(vm), (jump >> 16) & 0xff, line);
   writeChunk(&CURRENT_CHUNK(vm), (jump >> 8) & 0xff, line);
   writeChunk(&CURRENT_CHUNK(vm), jump & 0xff, line);
 }
 
 static bool compileWhileStatement(VM* vm, const Statement* stmt) {
-  WhileStatement ws = AS_WHILESTMT((*stmt));
+  const WhileStatement* ws = &AS_WHILESTMT((*stmt));
   int loopStart = CURRENT_CHUNK(vm).count;
-  if (!compileExpression(vm, &ws.condition)) {
-    return false;
-  }
-  compileReturnVal(vm, &ws.condition);
-  int exitOffset = emitJumpInstruction(vm, OP_JUMP_IF_FALSE, ws.token.line);
 
-  writeChunk(&CURRENT_CHUNK(vm), OP_POP, ws.token.line);
-  Statement block = {.type = STMT_BLOCK, .data = {.blockStmt = ws.block}};
-  if (!compileStatement(vm, &block)) {
+  int exitOffset = emitRegisterBranch(vm, ws->condition);
+  bool stackCondition = exitOffset == -1;
+  if (stackCondition) {
+    if (!compileExpression(vm, ws->condition)) {
+      return false;
+    }
+
+    exitOffset = emitJumpInstruction(vm, OP_JUMP_IF_FALSE, ws->token.line);
+    writeChunk(&CURRENT_CHUNK(vm), OP_POP, ws->token.line);
+  }
+  if (!compileScopedBlock(vm, &ws->block)) {
     return false;
   }
-  emitLoop(vm, loopStart, ws.token.line);
+  emitLoop(vm, loopStart, ws->token.line);
 
   patchJump(vm, exitOffset);
-  writeChunk(&CURRENT_CHUNK(vm), OP_POP, ws.token.line);
+  if (stackCondition) {
+    writeChunk(&CURRENT_CHUNK(vm), OP_POP, ws->token.line);
+  }
 
   return true;
 }
 
 static bool compileAssignStatement(VM* vm, const Statement* stmt) {
-  AssignStatement as = AS_ASSIGNSTMT((*stmt));
-  if (!compileExpression(vm, &as.value)) {
+  const AssignStatement* as = &AS_ASSIGNSTMT((*stmt));
+
+  // a local can be the destination of a register instruction directly
+  int slot = resolveLocal(vm, &as->name);
+  if (slot != -1 && isRegisterInfix(vm, as->value)) {
+    emitRegisterInfix(vm, &stripGroups(as->value)->data.infix, slot,
+        vm->compiler->localCount - 1);
+    return true;
+  }
+
+  if (!compileExpression(vm, as->value)) {
     return false;
   }
-  compileReturnVal(vm, &as.value);
 
-  if (!compileIdentifier(vm, as.name, true)) {
+  if (!compileIdentifier(vm, &as->name, true)) {
     return false;
   }
 
   return true;
 }
 
-static bool compileFunction(VM* vm, const FunctionStatement* fs) {
-  Compiler compiler;
-  initCompiler(vm, &compiler, TYPE_FUNCTION);
-  vm->compiler->func->numArgs = fs->argCount;
-  char* str = createName(&fs->name);
-  vm->compiler->func->name = allocateString(vm, str);
+/**
+ * throw away what has been emitted for the current function
+ * and start again with long forward jumps
+ */
+static void restartWithLongJumps(VM* vm, int localCount, int scopeDepth) {
+  Compiler* compiler = vm->compiler;
+  freeChunk(&compiler->func->chunk);
+  compiler->localCount = localCount;
+  compiler->scopeDepth = scopeDepth;
+  compiler->longJumps = true;
+  compiler->jumpOverflow = false;
+}
 
+static bool compileFunctionBody(VM* vm, const FunctionStatement* fs) {
   beginScope(vm);
 
   // compile args and block
   for (int i = 0; i < fs->argCount; i++) {
-    if (!compileDeclaration(vm, fs->token.line, fs->args[i], true)) return false;
+    if (!compileDeclaration(vm, fs->token.line, &fs->args[i])) return false;
+  }
+
+  return compileBlock(vm, &fs->block);
+}
+
+static bool compileFunction(VM* vm, const FunctionStatement* fs) {
+  Compiler compiler;
+  if (!initCompiler(vm, &compiler, TYPE_FUNCTION)) {
+    error("out of memory", fs->token.line);
+    return false;
+  }
+
+  compiler.func->numArgs = fs->argCount;
+  ObjString* name = copyString(vm, fs->name.start, fs->name.length);
+  if (name == NULL) {
+    error("out of memory", fs->token.line);
+    return false;
   }
+  compiler.func->name = name;
+
+  if (!compileFunctionBody(vm, fs)) return false;
 
-  Statement block = {.data = {.blockStmt = fs->block}, .type = STMT_BLOCK};
-  if (!compileBlockStatement(vm, &block)) return false;
+  if (compiler.jumpOverflow) {
+    restartWithLongJumps(vm, 1, 0);
+    if (!compileFunctionBody(vm, fs)) return false;
+  }
   
   ObjFunction* func = endCompiler(vm);
-  writeConstant(&CURRENT_CHUNK(vm), OBJ_VAL(func), fs->token.line);
+  writeConstant(vm, OBJ_VAL(func), fs->token.line);
+
+  // bytes and constants that didn't fit were dropped as they were written
+  if (vm->heap.outOfMemory) {
+    error("out of memory", fs->token.line);
+    return false;
+  }
 
   return true;
 }
 
 static bool compileFunctionStatement(VM* vm, const Statement* stmt) {
-  FunctionStatement fs = AS_FUNCSTMT((*stmt));
+  const FunctionStatement* fs = &AS_FUNCSTMT((*stmt));
 
-  if (!compileFunction(vm, &fs)) {
+  if (!compileFunction(vm, fs)) {
     return false;
   }
 
-  if (!compileDeclaration(vm, fs.token.line, fs.name, false)) {
+  if (!compileDeclaration(vm, fs->token.line, &fs->name)) {
     return false;
   }
 
@@ -517,14 +800,19 @@ static bool compileFunctionStatement(VM* vm, const Statement* stmt) {
 }
 
 static bool compileReturnStatement(VM* vm, const Statement* stmt) {
-  ReturnStatement rs = AS_RETURNSTMT((*stmt));
+  const ReturnStatement* rs = &AS_RETURNSTMT((*stmt));
 
-  if (!compileExpression(vm, &rs.expression)) {
+  // a call in tail position replaces the current frame instead of
+  // stacking a new one, the return only runs for native callees
+  if (vm->compiler->type == TYPE_FUNCTION && rs->expression->type == EXPR_CALL) {
+    if (!compileCallExpression(vm, &AS_EXPR_CALL((*rs->expression)), OP_TAIL_CALL)) {
+      return false;
+    }
+  } else if (!compileExpression(vm, rs->expression)) {
     return false;
   }
-  compileReturnVal(vm, &rs.expression);
 
-  writeChunk(&CURRENT_CHUNK(vm), OP_RETURN, rs.token.line);
+  writeChunk(&CURRENT_CHUNK(vm), OP_RETURN, rs->token.line);
   return true;
 }
 
@@ -539,17 +827,16 @@ static bool compileStatement(VM* vm, const Statement* stmt) {
     case STMT_ASSIGN:
       return compileAssignStatement(vm, stmt);
     case STMT_EXPR: {
-      Expression expr = AS_EXPRSTMT((*stmt)).expression;
-      bool result = compileExpression(vm, &expr);
-      freeExpression(&expr);
-      return result;
-    }
-    case STMT_BLOCK: {
-      beginScope(vm);
-      bool result = compileBlockStatement(vm, stmt);
-      endScope(vm);
+      bool result = compileExpression(vm, AS_EXPRSTMT((*stmt)).expression);
+
+      // discard the unused value so local slots line up with the stack
+      if (result) {
+        writeChunk(&CURRENT_CHUNK(vm), OP_POP, AS_EXPRSTMT((*stmt)).token.line);
+      }
       return result;
     }
+    case STMT_BLOCK:
+      return compileScopedBlock(vm, &AS_BLOCKSTMT((*stmt)));
     case STMT_IF: {
       return compileIfStatement(vm, stmt);
     }
@@ -575,28 +862,68 @@ static void emitReturn(VM* vm) {
 static ObjFunction* endCompiler(VM* vm) {
   emitReturn(vm);
 
+  // a chunk missing bytes is not walked, the caller reports it
   ObjFunction* func = vm->compiler->func;
+  if (!vm->heap.outOfMemory) {
+    func->maxSlots = maxStackHeight(&func->chunk, func->numArgs);
+    fuseSuperinstructions(&func->chunk);
+  }
   vm->compiler = vm->compiler->enclosing;
 
   return func;
 }
 
-CompilerResult compile(VM* vm, const Statements* statements) {
+static bool compileStatements(VM* vm, const Statements* statements) {
   for (int i = 0; i < statements->count; i++) {
-    Statement stmt = statements->stmts[i];
-    bool isError = !compileStatement(vm, &stmt);
-    if (isError) return (CompilerResult){.hasError = true};
+    if (!compileStatement(vm, statements->stmts[i])) return false;
+  }
+  return true;
+}
+
+CompilerResult compile(VM* vm, const Statements* statements) {
+  Compiler* compiler = vm->compiler;
+  if (compiler->func == NULL) {
+    error("out of memory", 0);
+    return (CompilerResult){.hasError = true};
   }
+
+  vm->heap.outOfMemory = false;
+  int localCount = compiler->localCount;
+  int scopeDepth = compiler->scopeDepth;
+  compiler->longJumps = false;
+  compiler->jumpOverflow = false;
+
+  bool isError = !compileStatements(vm, statements);
+  if (!isError && compiler->jumpOverflow) {
+    restartWithLongJumps(vm, localCount, scopeDepth);
+    isError = !compileStatements(vm, statements);
+  }
+
+  if (isError) {
+    // an error inside a function body leaves its compiler current,
+    // the collector walks vm->compiler and it is about to go out of scope
+    vm->compiler = compiler;
+    return (CompilerResult){.hasError = true};
+  }
+
   emitReturn(vm);
-  return (CompilerResult){.hasError = false, .func = endCompiler(vm)};
+  ObjFunction* func = endCompiler(vm);
+  if (vm->heap.outOfMemory) {
+    error("out of memory", 0);
+    return (CompilerResult){.hasError = true};
+  }
+
+  return (CompilerResult){.hasError = false, .func = func};
 }
 
-void initCompiler(VM* vm, Compiler *compiler, FunctionType type) {
+bool initCompiler(VM* vm, Compiler *compiler, FunctionType type) {
   compiler->scopeDepth = 0;
   compiler->localCount = 0;
 
   compiler->func = NULL;
   compiler->type = type;
+  compiler->longJumps = false;
+  compiler->jumpOverflow = false;
   compiler->enclosing = vm->compiler;
   vm->compiler = compiler;
 
@@ -606,4 +933,6 @@ void initCompiler(VM* vm, Compiler *compiler, FunctionType type) {
   Local* local = &compiler->locals[compiler->localCount++];
   local->name = (Token){.type = TOKEN_NULL};
   local->depth = 0;
+
+  return compiler->func != NULL;
 }
@@ -3,6 +3,77 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <common.h>
+#include <value.h>
+#include <peephole.h>
+
+static const char* opcodeNames[] = {
+  [OP_CONSTANT] = "OP_CONSTANT",
+  [OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+  [OP_NEGATE] = "OP_NEGATE",
+  [OP_ADD] = "OP_ADD",
+  [OP_SUBTRACT] = "OP_SUBTRACT",
+  [OP_MULTIPLY] = "OP_MULTIPLY",
+  [OP_DIVIDE] = "OP_DIVIDE",
+  [OP_TRUE] = "OP_TRUE",
+  [OP_FALSE] = "OP_FALSE",
+  [OP_NOT] = "OP_NOT",
+  [OP_LESS] = "OP_LESS",
+  [OP_GREATER] = "OP_GREATER",
+  [OP_EQUAL] = "OP_EQUAL",
+  [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+  [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+  [OP_GET_LOCAL] = "OP_GET_LOCAL",
+  [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+  [OP_SET_LOCAL] = "OP_SET_LOCAL",
+  [OP_JUMP] = "OP_JUMP",
+  [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+  [OP_JUMP_IF_TRUE] = "OP_JUMP_IF_TRUE",
+  [OP_LOOP] = "OP_LOOP",
+  [OP_CALL] = "OP_CALL",
+  [OP_TAIL_CALL] = "OP_TAIL_CALL",
+  [OP_CALL_NATIVE] = "OP_CALL_NATIVE",
+  [OP_POP] = "OP_POP",
+  [OP_NULL] = "OP_NULL",
+  [OP_RETURN] = "OP_RETURN",
+  [OP_JUMP_LONG] = "OP_JUMP_LONG",
+  [OP_JUMP_IF_FALSE_LONG] = "OP_JUMP_IF_FALSE_LONG",
+  [OP_JUMP_IF_TRUE_LONG] = "OP_JUMP_IF_TRUE_LONG",
+  [OP_LOOP_LONG] = "OP_LOOP_LONG",
+  [OP_GET_LOCAL_GET_LOCAL] = "OP_GET_LOCAL_GET_LOCAL",
+  [OP_GET_LOCAL_CONSTANT] = "OP_GET_LOCAL_CONSTANT",
+  [OP_GET_LOCAL_CONSTANT_ADD] = "OP_GET_LOCAL_CONSTANT_ADD",
+  [OP_GET_LOCAL_CONSTANT_SUBTRACT] = "OP_GET_LOCAL_CONSTANT_SUBTRACT",
+  [OP_ADD_SET_LOCAL] = "OP_ADD_SET_LOCAL",
+  [OP_LESS_JUMP_IF_FALSE_POP] = "OP_LESS_JUMP_IF_FALSE_POP",
+  [OP_GREATER_JUMP_IF_FALSE_POP] = "OP_GREATER_JUMP_IF_FALSE_POP",
+  [OP_GET_GLOBAL_CALL] = "OP_GET_GLOBAL_CALL",
+  [OP_GET_LOCAL_CALL] = "OP_GET_LOCAL_CALL",
+  [OP_GET_GLOBAL_TAIL_CALL] = "OP_GET_GLOBAL_TAIL_CALL",
+  [OP_ADD_NUM] = "OP_ADD_NUM",
+  [OP_SUBTRACT_NUM] = "OP_SUBTRACT_NUM",
+  [OP_MULTIPLY_NUM] = "OP_MULTIPLY_NUM",
+  [OP_DIVIDE_NUM] = "OP_DIVIDE_NUM",
+  [OP_LESS_NUM] = "OP_LESS_NUM",
+  [OP_GREATER_NUM] = "OP_GREATER_NUM",
+  [OP_ADD_R] = "OP_ADD_R",
+  [OP_SUBTRACT_R] = "OP_SUBTRACT_R",
+  [OP_MULTIPLY_R] = "OP_MULTIPLY_R",
+  [OP_DIVIDE_R] = "OP_DIVIDE_R",
+  [OP_LESS_R] = "OP_LESS_R",
+  [OP_GREATER_R] = "OP_GREATER_R",
+  [OP_JUMP_IF_NOT_LESS_R] = "OP_JUMP_IF_NOT_LESS_R",
+  [OP_JUMP_IF_NOT_GREATER_R] = "OP_JUMP_IF_NOT_GREATER_R",
+  [OP_LOOP_TRACE] = "OP_LOOP_TRACE",
+  [OP_LOOP_LONG_TRACE] = "OP_LOOP_LONG_TRACE",
+};
+
+const char* opcodeName(uint8_t instruction) {
+  if (instruction >= sizeof(opcodeNames) / sizeof(opcodeNames[0]) ||
+      opcodeNames[instruction] == NULL) {
+    return "OP_UNKNOWN";
+  }
+  return opcodeNames[instruction];
+}
 
 void disassembleChunk(Chunk* chunk, const char* name) {
   printf("== %s ==\n", name);
@@ -17,6 +88,24 @@ static int simpleInstruction(const char* name, int offset) {
   return offset + 1;
 }
 
+static int byteInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t operand = chunk->code[offset + 1];
+  printf("%-16s %4d\n", name, operand);
+  return offset + 2;
+}
+
+static int shortInstruction(const char* name, Chunk* chunk, int offset) {
+  uint16_t operand = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+  printf("%-16s %4d\n", name, operand);
+  return offset + 3;
+}
+
+static int nativeCallInstruction(const char* name, Chunk* chunk, int offset) {
+  uint16_t slot = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+  printf("%-16s %4d %4d\n", name, slot, chunk->code[offset + 3]);
+  return offset + 4;
+}
+
 static int constantInstruction(const char* name, Chunk* chunk, int offset) {
   printf("%s '", name); 
   uint8_t valIndex = chunk->code[offset + 1];
@@ -27,14 +116,92 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset) {
   return offset + 2;
 }
 
+static int constantLongInstruction(const char* name, Chunk* chunk, int offset) {
+  printf("%s '", name);
+  uint32_t valIndex = (chunk->code[offset + 1] << 16) |
+    (chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+  printValue(chunk->constants.data[valIndex]);
+  printf("'\n");
+
+  return offset + 4;
+}
+
+/**
+ * superinstructions print each component's operand in turn
+ */
+static int superInstruction(const Superinstruction* super, Chunk* chunk, int offset) {
+  printf("%-16s", opcodeName(super->fused));
+
+  int operand = offset + 1;
+  for (int i = 0; i < super->count; i++) {
+    OpCode component = super->components[i];
+    switch(operandSize(component)) {
+      case 1:
+        if (component == OP_CONSTANT) {
+          printf(" '");
+          printValue(chunk->constants.data[chunk->code[operand]]);
+          printf("'");
+        } else {
+          printf(" %4d", chunk->code[operand]);
+        }
+        break;
+      case 2:
+        printf(" %4d", (chunk->code[operand] << 8) | chunk->code[operand + 1]);
+        break;
+    }
+    operand += operandSize(component);
+  }
+
+  int target = jumpTarget(chunk, offset);
+  if (target >= 0) printf(" -> %d", target);
+
+  printf("\n");
+  return operand;
+}
+
+static int jumpInstruction(const char* name, Chunk* chunk, int offset) {
+  printf("%-16s %4d -> %d\n", name, offset, jumpTarget(chunk, offset));
+  return offset + instructionSize(chunk->code[offset]);
+}
+
+static void printRK(Chunk* chunk, uint8_t operand) {
+  if (IS_RK_CONSTANT(operand)) {
+    printf(" '");
+    printValue(chunk->constants.data[operand & RK_MAX]);
+    printf("'");
+  } else {
+    printf(" r%d", operand);
+  }
+}
+
+/**
+ * register instructions: destination slot then RK operands
+ */
+static int registerInstruction(const char* name, Chunk* chunk, int offset) {
+  printf("%-16s r%d", name, chunk->code[offset + 1]);
+  printRK(chunk, chunk->code[offset + 2]);
+  printRK(chunk, chunk->code[offset + 3]);
+  printf("\n");
+  return offset + 4;
+}
+
+static int registerJumpInstruction(const char* name, Chunk* chunk, int offset) {
+  printf("%-16s", name);
+  printRK(chunk, chunk->code[offset + 1]);
+  printRK(chunk, chunk->code[offset + 2]);
+  printf(" -> %d\n", jumpTarget(chunk, offset));
+  return offset + 5;
+}
+
 int disassembleInstruction(Chunk* chunk, int offset) {
   printf("%04d ", offset);
   uint8_t instruction = chunk->code[offset];
 
-  if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+  int line = getLine(&chunk->lines, offset);
+  if (offset > 0 && line == getLine(&chunk->lines, offset - 1)) {
     printf("  |  ");
   } else {
-    printf("  %d  ", chunk->lines[offset]);
+    printf("  %d  ", line);
   }
 
   switch(instruction) {
@@ -42,6 +209,8 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return simpleInstruction("OP_RETURN", offset);
     case OP_CONSTANT:
       return constantInstruction("OP_CONSTANT", chunk, offset);
+    case OP_CONSTANT_LONG:
+      return constantLongInstruction("OP_CONSTANT_LONG", chunk, offset);
     case OP_NEGATE:
       return simpleInstruction("OP_NEGATE", offset);
     case OP_ADD:
@@ -65,34 +234,66 @@ int disassembleInstruction(Chunk* chunk, int offset) {
     case OP_LESS:
       return simpleInstruction("OP_LESS", offset);
     case OP_DEFINE_GLOBAL:
-      return simpleInstruction("OP_DEFINE_GLOBAL", offset);
+      return shortInstruction("OP_DEFINE_GLOBAL", chunk, offset);
     case OP_GET_GLOBAL:
-      return simpleInstruction("OP_GET_GLOBAL", offset);
+      return shortInstruction("OP_GET_GLOBAL", chunk, offset);
     case OP_POP:
       return simpleInstruction("OP_POP", offset);
     case OP_GET_LOCAL:
-      return simpleInstruction("OP_GET_LOCAL", offset);
+      return byteInstruction("OP_GET_LOCAL", chunk, offset);
     case OP_JUMP:
-      return simpleInstruction("OP_JUMP", offset);
+      return jumpInstruction("OP_JUMP", chunk, offset);
     case OP_JUMP_IF_FALSE:
-      return simpleInstruction("OP_JUMP_IF_FALSE", offset);
+      return jumpInstruction("OP_JUMP_IF_FALSE", chunk, offset);
     case OP_JUMP_IF_TRUE:
-      return simpleInstruction("OP_JUMP_IF_TRUE", offset);
+      return jumpInstruction("OP_JUMP_IF_TRUE", chunk, offset);
     case OP_LOOP:
-      return simpleInstruction("OP_LOOP", offset);
+      return jumpInstruction("OP_LOOP", chunk, offset);
+    case OP_JUMP_LONG:
+    case OP_JUMP_IF_FALSE_LONG:
+    case OP_JUMP_IF_TRUE_LONG:
+    case OP_LOOP_LONG:
+    case OP_LOOP_TRACE:
+    case OP_LOOP_LONG_TRACE:
+      return jumpInstruction(opcodeName(instruction), chunk, offset);
     case OP_SET_GLOBAL:
-      return simpleInstruction("OP_SET_GLOBAL", offset);
+      return shortInstruction("OP_SET_GLOBAL", chunk, offset);
     case OP_SET_LOCAL:
-      return simpleInstruction("OP_SET_LOCAL", offset);
+      return byteInstruction("OP_SET_LOCAL", chunk, offset);
     case OP_CALL:
-      return simpleInstruction("OP_CALL", offset);
-    case OP_MARK_LOCAL:
-      return simpleInstruction("OP_MARK_LOCAL", offset);
+      return byteInstruction("OP_CALL", chunk, offset);
+    case OP_TAIL_CALL:
+      return byteInstruction("OP_TAIL_CALL", chunk, offset);
+    case OP_CALL_NATIVE:
+      return nativeCallInstruction("OP_CALL_NATIVE", chunk, offset);
     case OP_NULL:
       return simpleInstruction("OP_NULL", offset);
-    default:
+    case OP_ADD_NUM:
+    case OP_SUBTRACT_NUM:
+    case OP_MULTIPLY_NUM:
+    case OP_DIVIDE_NUM:
+    case OP_LESS_NUM:
+    case OP_GREATER_NUM:
+      return simpleInstruction(opcodeName(instruction), offset);
+    case OP_ADD_R:
+    case OP_SUBTRACT_R:
+    case OP_MULTIPLY_R:
+    case OP_DIVIDE_R:
+    case OP_LESS_R:
+    case OP_GREATER_R:
+      return registerInstruction(opcodeName(instruction), chunk, offset);
+    case OP_JUMP_IF_NOT_LESS_R:
+    case OP_JUMP_IF_NOT_GREATER_R:
+      return registerJumpInstruction(opcodeName(instruction), chunk, offset);
+    default: {
+      const Superinstruction* super = findSuperinstruction(instruction);
+      if (super != NULL) {
+        return superInstruction(super, chunk, offset);
+      }
+
       printf("%d Unknown operator\n", instruction);
       return offset + 1;
+    }
 
   }
 }
@@ -0,0 +1,366 @@
+#include <gc.h>
+#include <common.h>
+#include <compiler.h>
+#include <memory.h>
+#include <object.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <table.h>
+#include <limits.h>
+#include <time.h>
+#include <jit.h>
+#include <trace.h>
+
+void freeObject(Obj* obj) {
+  switch(obj->type) {
+    case OBJ_STRING: {
+      ObjString* str = (ObjString*)obj;
+      reallocate(str, STRING_SIZE(str->length), 0, MEM_STRING);
+      break;
+    }
+    case OBJ_FUNCTION: {
+      // the name is a string object of its own on the objects list
+      ObjFunction* func = (ObjFunction*)obj;
+#ifdef JIT
+      jitFree(func);
+      freeLoopTraces(func);
+#endif
+      freeChunk(&CHUNK((*func)));
+      FREE(ObjFunction, func, MEM_FUNCTION);
+      break;
+    }
+    case OBJ_NATIVE:
+      FREE(ObjNative, obj, MEM_NATIVE);
+      break;
+    case OBJ_ROPE:
+      // the halves are objects of their own
+      FREE(ObjRope, obj, MEM_ROPE);
+      break;
+  }
+}
+
+void markObject(VM* vm, Obj* obj) {
+  if (obj == NULL || obj->isMarked) return;
+  obj->isMarked = true;
+
+  // strings and natives hold no references, nothing to trace
+  if (obj->type != OBJ_FUNCTION && obj->type != OBJ_ROPE) return;
+
+  // the gray stack is not counted in the heap,
+  // growing it must not move the collection threshold
+  if (vm->grayCount == vm->grayCapacity) {
+    int capacity = GROW_CAPACITY(vm->grayCapacity);
+    Obj** grayStack = (Obj**)realloc(vm->grayStack, sizeof(Obj*) * capacity);
+    if (grayStack == NULL) {
+      // found again by going over the marked objects
+      vm->grayOverflow = true;
+      return;
+    }
+    vm->grayStack = grayStack;
+    vm->grayCapacity = capacity;
+  }
+
+  vm->grayStack[vm->grayCount++] = obj;
+}
+
+void markValue(VM* vm, Value value) {
+  if (IS_OBJ(value)) markObject(vm, AS_OBJ(value));
+}
+
+static void markArray(VM* vm, ValueArray* array) {
+  for (int i = 0; i < array->count; i++) {
+    markValue(vm, array->data[i]);
+  }
+}
+
+/**
+ * the part of the value stack that may hold live values: everything
+ * below stackTop, and the register temps each frame keeps above it
+ */
+static Value* stackEnd(VM* vm) {
+  Value* end = vm->stackTop;
+  for (int i = 0; i < vm->frameCount; i++) {
+    CallFrame* frame = &vm->frame[i];
+    Value* frameEnd = frame->basePointer + frame->func->maxSlots;
+    if (frameEnd > end) end = frameEnd;
+  }
+
+  Value* limit = vm->valueStack + vm->stackCapacity;
+  return end > limit ? limit : end;
+}
+
+/**
+ * slots past the live part are left over from earlier calls and may
+ * point at objects that were just freed or moved, a later frame
+ * could scan them
+ */
+static void clearStack(VM* vm, Value* end) {
+  for (Value* slot = end; slot < vm->valueStack + vm->stackHigh; slot++) {
+    *slot = NULL_VAL;
+  }
+  vm->stackHigh = (int)(end - vm->valueStack);
+}
+
+void rememberGlobal(VM* vm, int slot) {
+  int count = vm->rememberedCount;
+  if (count > 0 && count <= REMEMBERED_MAX && vm->remembered[count - 1] == slot) return;
+
+  // one past REMEMBERED_MAX means every global has to be scanned
+  if (count < REMEMBERED_MAX) vm->remembered[count] = slot;
+  if (count <= REMEMBERED_MAX) vm->rememberedCount++;
+}
+
+ObjString* promoteString(VM* vm, ObjString* young) {
+  if (young->obj.next == NULL) {
+    // linked in directly, a major collection must not start in between
+    ObjString* promoted = (ObjString*)reallocate(NULL, 0, STRING_SIZE(young->length), MEM_STRING);
+    if (promoted == NULL) return NULL;
+    memcpy(promoted, young, STRING_SIZE(young->length));
+    promoted->obj.isMarked = vm->gcPhase == GC_MARK;
+    promoted->obj.next = vm->objects;
+    vm->objects = (Obj*)promoted;
+
+    young->obj.next = (Obj*)promoted;
+    tableReplaceKey(&vm->strings, young, promoted);
+  }
+
+  return (ObjString*)young->obj.next;
+}
+
+/**
+ * point slot at the heap copy of the young string it refers to
+ * returns false if there was no memory for the copy
+ */
+static bool evacuate(VM* vm, Value* slot) {
+  if (!IS_OBJ(*slot) || !IS_YOUNG(vm, AS_OBJ(*slot))) return true;
+
+  ObjString* promoted = promoteString(vm, (ObjString*)AS_OBJ(*slot));
+  if (promoted == NULL) return false;
+  *slot = OBJ_VAL(promoted);
+  return true;
+}
+
+/**
+ * every young string is interned, the ones that weren't
+ * promoted are gone once the nursery starts over
+ */
+static void dropYoungStrings(VM* vm) {
+  uint8_t* cursor = vm->nursery;
+  while (cursor < vm->nurseryTop) {
+    ObjString* young = (ObjString*)cursor;
+    if (young->obj.next == NULL) tableDelete(&vm->strings, young);
+    cursor += YOUNG_STRING_SIZE(young->length);
+  }
+}
+
+bool collectNursery(VM* vm, Value* roots, int rootCount) {
+#ifdef DEBUG_LOG_GC
+  size_t before = vm->heap.bytes;
+#endif
+
+  // slots already pointed at their copies keep them, the young
+  // originals lead to the same copies
+  for (int i = 0; i < rootCount; i++) {
+    if (!evacuate(vm, &roots[i])) return false;
+  }
+
+  Value* end = stackEnd(vm);
+  for (Value* slot = vm->valueStack; slot < end; slot++) {
+    if (!evacuate(vm, slot)) return false;
+  }
+
+  if (vm->rememberedCount > REMEMBERED_MAX) {
+    for (int i = 0; i < vm->globals.count; i++) {
+      if (!evacuate(vm, &vm->globals.data[i])) return false;
+    }
+  } else {
+    for (int i = 0; i < vm->rememberedCount; i++) {
+      if (!evacuate(vm, &vm->globals.data[vm->remembered[i]])) return false;
+    }
+  }
+
+  clearStack(vm, end);
+  dropYoungStrings(vm);
+  vm->nurseryTop = vm->nursery;
+  vm->rememberedCount = 0;
+
+#ifdef DEBUG_LOG_GC
+  printf("gc: minor, %zu bytes promoted\n", vm->heap.bytes - before);
+#endif
+  return true;
+}
+
+bool reserveNursery(VM* vm, int length, Value* roots, int rootCount) {
+  if (length > NURSERY_STRING_MAX) return false;
+
+#ifdef DEBUG_STRESS_GC
+  return collectNursery(vm, roots, rootCount);
+#else
+  if (vm->nurseryTop + YOUNG_STRING_SIZE(length) > vm->nursery + NURSERY_SIZE) {
+    return collectNursery(vm, roots, rootCount);
+  }
+  return true;
+#endif
+}
+
+static void markRoots(VM* vm, Value* end) {
+  for (Value* slot = vm->valueStack; slot < end; slot++) {
+    markValue(vm, *slot);
+  }
+
+  for (int i = 0; i < vm->frameCount; i++) {
+    markObject(vm, (Obj*)vm->frame[i].func);
+  }
+
+  markArray(vm, &vm->globals);
+  for (int i = 0; i < vm->globalNames.capacity; i++) {
+    markObject(vm, (Obj*)vm->globalNames.entries[i].key);
+  }
+
+  // the script compiler is its own enclosing compiler
+  Compiler* compiler = vm->compiler;
+  while (compiler != NULL) {
+    markObject(vm, (Obj*)compiler->func);
+    compiler = compiler->enclosing == compiler ? NULL : compiler->enclosing;
+  }
+}
+
+static void blacken(VM* vm, Obj* obj) {
+  if (obj->type == OBJ_ROPE) {
+    ObjRope* rope = (ObjRope*)obj;
+    markObject(vm, rope->left);
+    markObject(vm, rope->right);
+    markObject(vm, (Obj*)rope->flat);
+    return;
+  }
+
+  if (obj->type == OBJ_FUNCTION) {
+    ObjFunction* func = (ObjFunction*)obj;
+    markObject(vm, (Obj*)func->name);
+    markArray(vm, &func->chunk.constants);
+  }
+}
+
+/**
+ * blacken up to limit gray functions and ropes. objects left off a full
+ * gray stack are found by tracing every marked object again, which
+ * counts as one
+ * returns true once nothing is left gray
+ */
+static bool traceSome(VM* vm, int limit) {
+  while (limit-- > 0) {
+    if (vm->grayCount > 0) {
+      blacken(vm, vm->grayStack[--vm->grayCount]);
+      continue;
+    }
+    if (!vm->grayOverflow) break;
+
+    vm->grayOverflow = false;
+    for (Obj* obj = vm->objects; obj != NULL; obj = obj->next) {
+      if (obj->isMarked) blacken(vm, obj);
+    }
+  }
+  return vm->grayCount == 0 && !vm->grayOverflow;
+}
+
+/**
+ * free or keep up to limit objects from the sweep list, survivors
+ * go back on vm->objects unmarked for the next cycle
+ * returns true once the list is empty
+ */
+static bool sweepSome(VM* vm, int limit) {
+  while (vm->sweepList != NULL && limit-- > 0) {
+    Obj* obj = vm->sweepList;
+    vm->sweepList = obj->next;
+    if (obj->isMarked) {
+      obj->isMarked = false;
+      obj->next = vm->objects;
+      vm->objects = obj;
+    } else {
+      if (obj->type == OBJ_STRING) tableDelete(&vm->strings, (ObjString*)obj);
+      freeObject(obj);
+    }
+  }
+  return vm->sweepList == NULL;
+}
+
+#ifdef DEBUG_LOG_GC
+static size_t cycleStartBytes;
+#endif
+
+static void beginCycle(VM* vm) {
+#ifdef DEBUG_LOG_GC
+  cycleStartBytes = vm->heap.bytes;
+#endif
+  markRoots(vm, stackEnd(vm));
+  vm->gcPhase = GC_MARK;
+}
+
+/**
+ * the stack and globals have no barrier, so marking ends by going over
+ * the roots again in one go. everything unmarked after that is garbage,
+ * and every object allocated from here on is left out of the sweep
+ */
+static void finishMark(VM* vm) {
+  Value* end = stackEnd(vm);
+  markRoots(vm, end);
+  traceSome(vm, INT_MAX);
+  clearStack(vm, end);
+
+  vm->sweepList = vm->objects;
+  vm->objects = NULL;
+  vm->gcPhase = GC_SWEEP;
+}
+
+static void finishCycle(VM* vm) {
+  Heap* heap = &vm->heap;
+  vm->gcPhase = GC_IDLE;
+  heap->nextGC = heap->bytes * GC_HEAP_GROW_FACTOR;
+  if (heap->nextGC < GC_HEAP_INITIAL) heap->nextGC = GC_HEAP_INITIAL;
+
+  // close to the soft limit the collector runs more often,
+  // past it the heap still gets some room to avoid collecting nonstop
+  if (heap->softLimit != 0 && heap->nextGC > heap->softLimit) {
+    heap->nextGC = heap->softLimit > heap->bytes + GC_STEP_BYTES ?
+      heap->softLimit : heap->bytes + GC_STEP_BYTES;
+  }
+
+#ifdef DEBUG_LOG_GC
+  printf("gc: %zu -> %zu bytes, next at %zu\n", cycleStartBytes, heap->bytes, heap->nextGC);
+#endif
+}
+
+static uint64_t nowMicros(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void gcStep(VM* vm) {
+  if (vm->gcPauseMicros == 0) {
+    collectGarbage(vm);
+    return;
+  }
+
+  uint64_t start = nowMicros();
+  if (vm->gcPhase == GC_IDLE) beginCycle(vm);
+
+  do {
+    if (vm->gcPhase == GC_MARK) {
+      if (traceSome(vm, GC_STEP_WORK)) finishMark(vm);
+    } else if (sweepSome(vm, GC_STEP_WORK)) {
+      finishCycle(vm);
+      return;
+    }
+  } while (nowMicros() - start < (uint64_t)vm->gcPauseMicros);
+
+  vm->heap.nextGC = vm->heap.bytes + GC_STEP_BYTES;
+}
+
+void collectGarbage(VM* vm) {
+  if (vm->gcPhase == GC_IDLE) beginCycle(vm);
+  if (vm->gcPhase == GC_MARK) finishMark(vm);
+  sweepSome(vm, INT_MAX);
+  finishCycle(vm);
+}
@@ -0,0 +1,596 @@
+#ifdef JIT
+
+#include <jit.h>
+#include <chunk.h>
+#include <object.h>
+#include <peephole.h>
+#include <memory.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trace.h>
+#include <x64.h>
+#include <gc.h>
+
+/**
+ * registers kept for the whole compiled function (all callee-saved)
+ */
+#define VM_REG RBX
+#define BASE_REG R12 // frame->basePointer
+#define FRAME_REG R13 // byte offset of the frame in vm->frame
+#define TOP_REG R14 // vm->stackTop
+#define QNAN_REG R15 // QNAN, for type checks and the singleton values
+
+#define OFFSET_STACK_TOP ((int32_t)offsetof(VM, stackTop))
+#define OFFSET_FRAME ((int32_t)offsetof(VM, frame))
+#define OFFSET_FRAME_COUNT ((int32_t)offsetof(VM, frameCount))
+#define OFFSET_GLOBALS ((int32_t)(offsetof(VM, globals) + offsetof(ValueArray, data)))
+#define OFFSET_BASE_POINTER ((int32_t)offsetof(CallFrame, basePointer))
+#define OFFSET_NURSERY ((int32_t)offsetof(VM, nursery))
+
+/**
+ * labels are bytecode offsets, except for these which
+ * translate() swaps for the labels of its epilogue
+ */
+#define LABEL_ERROR -1
+#define LABEL_TAIL_CALL -2
+#define LABEL_EXIT -3
+#define LABEL_INTERPRET -4
+
+/*
+ * pieces shared by the templates
+ */
+
+static void pushReg(Assembler* as, int reg) {
+  emitStore(as, TOP_REG, 0, reg);
+  emitAluImm(as, 0, TOP_REG, sizeof(Value));
+}
+
+static void popReg(Assembler* as, int reg) {
+  emitAluImm(as, 5, TOP_REG, sizeof(Value));
+  emitLoad(as, reg, TOP_REG, 0);
+}
+
+static void syncStackTop(Assembler* as) {
+  emitStore(as, VM_REG, OFFSET_STACK_TOP, TOP_REG);
+}
+
+/**
+ * after a helper call the stack may have moved
+ */
+static void reloadFrame(Assembler* as) {
+  emitLoad(as, TOP_REG, VM_REG, OFFSET_STACK_TOP);
+  emitLoad(as, RAX, VM_REG, OFFSET_FRAME);
+  emitRegReg(as, 0x01, FRAME_REG, RAX); // add rax, r13
+  emitLoad(as, BASE_REG, RAX, OFFSET_BASE_POINTER);
+}
+
+/**
+ * a helper returning bool, anything false is a runtime error
+ */
+static void checkHelper(Assembler* as) {
+  emitBytes(as, (const uint8_t[]){0x84, 0xc0}, 2); // test al, al
+  jumpTo(as, CC_E, LABEL_ERROR);
+}
+
+/**
+ * jumps to the returned label when reg does not hold a number,
+ * clobbers rdx
+ */
+static int jumpIfNotNumber(Assembler* as, int reg) {
+  emitMov(as, RDX, reg);
+  emitRegReg(as, 0x21, QNAN_REG, RDX); // and rdx, r15
+  emitRegReg(as, 0x39, QNAN_REG, RDX); // cmp rdx, r15
+  return emitJcc(as, CC_E);
+}
+
+/**
+ * leaves the flags "below or equal" when reg is null or false
+ */
+static void testFalsey(Assembler* as, int reg) {
+  emitMov(as, RCX, reg);
+  emitRegReg(as, 0x29, QNAN_REG, RCX); // sub rcx, r15
+  emitAluImm(as, 0, RCX, -TAG_NULL);
+  emitAluImm(as, 7, RCX, TAG_FALSE - TAG_NULL);
+}
+
+/**
+ * turns the condition cc into a bool value in rax
+ */
+static void boolFromFlags(Assembler* as, uint8_t cc) {
+  emitBytes(as, (const uint8_t[]){0x0f, 0x90 | cc, 0xc0}, 3); // setcc al
+  emitBytes(as, (const uint8_t[]){0x0f, 0xb6, 0xc0}, 3); // movzx eax, al
+  // lea rax, [r15 + rax + TAG_FALSE]
+  emitBytes(as, (const uint8_t[]){0x49, 0x8d, 0x44, 0x07, TAG_FALSE}, 5);
+}
+
+static void numbersToXmm(Assembler* as) {
+  emitMovqToXmm(as, 0, RAX);
+  emitMovqToXmm(as, 1, RCX);
+}
+
+/**
+ * rax op rcx for two numbers, the result in rax
+ */
+static void emitNumberOp(Assembler* as, OpCode op) {
+  numbersToXmm(as);
+  switch(op) {
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE: {
+      uint8_t sse = op == OP_ADD ? SSE_ADD : op == OP_SUBTRACT ? SSE_SUBTRACT :
+        op == OP_MULTIPLY ? SSE_MULTIPLY : SSE_DIVIDE;
+      emitSseRegReg(as, sse, 0, 1);
+      emitMovqFromXmm(as, RAX, 0);
+      break;
+    }
+    case OP_LESS:
+      emitCompareDoubles(as, 1, 0);
+      boolFromFlags(as, CC_A);
+      break;
+    default:
+      emitCompareDoubles(as, 0, 1);
+      boolFromFlags(as, CC_A);
+      break;
+  }
+}
+
+static OpCode genericOp(uint8_t instruction) {
+  switch(instruction) {
+    case OP_ADD_NUM: case OP_ADD_R: return OP_ADD;
+    case OP_SUBTRACT_NUM: case OP_SUBTRACT_R: return OP_SUBTRACT;
+    case OP_MULTIPLY_NUM: case OP_MULTIPLY_R: return OP_MULTIPLY;
+    case OP_DIVIDE_NUM: case OP_DIVIDE_R: return OP_DIVIDE;
+    case OP_LESS_NUM: case OP_LESS_R: case OP_JUMP_IF_NOT_LESS_R: return OP_LESS;
+    case OP_GREATER_NUM: case OP_GREATER_R: case OP_JUMP_IF_NOT_GREATER_R: return OP_GREATER;
+    default: return (OpCode)instruction;
+  }
+}
+
+static void loadRK(Assembler* as, const Chunk* chunk, int reg, uint8_t operand) {
+  if (IS_RK_CONSTANT(operand)) {
+    emitMovImm64(as, reg, chunk->constants.data[operand & RK_MAX]);
+  } else {
+    emitLoad(as, reg, BASE_REG, operand * (int32_t)sizeof(Value));
+  }
+}
+
+/*
+ * templates
+ */
+
+static void emitStackArithmetic(Assembler* as, OpCode op) {
+  emitLoad(as, RAX, TOP_REG, -2 * (int32_t)sizeof(Value));
+  emitLoad(as, RCX, TOP_REG, -(int32_t)sizeof(Value));
+  int notA = jumpIfNotNumber(as, RAX);
+  int notB = jumpIfNotNumber(as, RCX);
+  emitNumberOp(as, op);
+  emitStore(as, TOP_REG, -2 * (int32_t)sizeof(Value), RAX);
+  emitAluImm(as, 5, TOP_REG, sizeof(Value));
+  int done = emitJmp(as);
+
+  patchHere(as, notA);
+  patchHere(as, notB);
+  syncStackTop(as);
+  emitMov(as, RDI, VM_REG);
+  emitMovImm32(as, RSI, op);
+  emitCall(as, (void*)jitArithmetic);
+  checkHelper(as);
+  reloadFrame(as);
+  patchHere(as, done);
+}
+
+static void emitRegisterArithmetic(Assembler* as, const Chunk* chunk, OpCode op, const uint8_t* operands) {
+  int32_t dst = operands[0] * (int32_t)sizeof(Value);
+  loadRK(as, chunk, RAX, operands[1]);
+  loadRK(as, chunk, RCX, operands[2]);
+  int notA = jumpIfNotNumber(as, RAX);
+  int notB = jumpIfNotNumber(as, RCX);
+  emitNumberOp(as, op);
+  emitStore(as, BASE_REG, dst, RAX);
+  int done = emitJmp(as);
+
+  patchHere(as, notA);
+  patchHere(as, notB);
+  syncStackTop(as);
+  emitMov(as, RDX, RAX);
+  emitMov(as, RDI, VM_REG);
+  emitMovImm32(as, RSI, op);
+  emitLea(as, R8, BASE_REG, dst);
+  emitCall(as, (void*)jitRegisterOp);
+  checkHelper(as);
+  reloadFrame(as);
+  patchHere(as, done);
+}
+
+static void emitRegisterBranch(Assembler* as, const Chunk* chunk, OpCode op,
+    const uint8_t* operands, int target) {
+  loadRK(as, chunk, RAX, operands[0]);
+  loadRK(as, chunk, RCX, operands[1]);
+  int notA = jumpIfNotNumber(as, RAX);
+  int notB = jumpIfNotNumber(as, RCX);
+  numbersToXmm(as);
+  if (op == OP_LESS) {
+    emitCompareDoubles(as, 1, 0);
+  } else {
+    emitCompareDoubles(as, 0, 1);
+  }
+  jumpTo(as, CC_BE, target);
+  int done = emitJmp(as);
+
+  patchHere(as, notA);
+  patchHere(as, notB);
+  emitCall(as, (void*)jitNumberError);
+  jumpAlwaysTo(as, LABEL_ERROR);
+  patchHere(as, done);
+}
+
+static void emitGlobalCheck(Assembler* as, int reg, uint16_t slot) {
+  emitLea(as, RCX, QNAN_REG, TAG_UNDEFINED);
+  emitRegReg(as, 0x39, RCX, reg); // cmp reg, rcx
+  int defined = emitJcc(as, CC_NE);
+  emitMov(as, RDI, VM_REG);
+  emitMovImm32(as, RSI, slot);
+  emitCall(as, (void*)jitUndefinedGlobal);
+  jumpAlwaysTo(as, LABEL_ERROR);
+  patchHere(as, defined);
+}
+
+/**
+ * GLOBAL_BARRIER for the value in rax, just stored to slot. an object
+ * value less the tag bits and the nursery's address is below
+ * NURSERY_SIZE only if it's young, anything else comes out larger
+ */
+static void emitGlobalBarrier(Assembler* as, uint16_t slot) {
+  emitMovImm64(as, RCX, SIGN_BIT | QNAN);
+  emitRegReg(as, 0x29, RCX, RAX); // sub rax, rcx
+  emitRegMem(as, true, 0x2b, RAX, VM_REG, OFFSET_NURSERY); // sub rax, [vm->nursery]
+  emitAluImm(as, 7, RAX, NURSERY_SIZE - 1);
+  int old = emitJcc(as, CC_A);
+  emitMov(as, RDI, VM_REG);
+  emitMovImm32(as, RSI, slot);
+  emitCall(as, (void*)rememberGlobal);
+  patchHere(as, old);
+}
+
+/**
+ * a back-edge counts down the loop's hot counter as the interpreter's
+ * does, and hands the loop to the trace compiler when it runs out (or
+ * every time, once the loop has a trace). a loop that left off
+ * somewhere other than its header carries on in the interpreter
+ */
+static void emitLoop(Assembler* as, VM* vm, const Chunk* chunk, int offset, int target) {
+  uint8_t instruction = chunk->code[offset];
+  if (instruction == OP_LOOP || instruction == OP_LOOP_LONG) {
+    uint16_t* counter = &vm->hotCounts[HOTCOUNT_INDEX(chunk->code + offset)];
+    emitMovImm64(as, RAX, (uint64_t)(uintptr_t)counter);
+    emitBytes(as, (const uint8_t[]){0x66, 0x83, 0x28, 0x01}, 4); // sub word [rax], 1
+    jumpTo(as, CC_NE, target);
+  }
+
+  syncStackTop(as);
+  emitMov(as, RDI, VM_REG);
+  emitMovImm32(as, RSI, offset);
+  emitCall(as, (void*)jitHotLoop);
+  emitMov(as, RCX, RAX); // reloadFrame() needs rax
+  reloadFrame(as);
+  emitBytes(as, (const uint8_t[]){0x84, 0xc9}, 2); // test cl, cl
+  jumpTo(as, CC_NE, target);
+  jumpAlwaysTo(as, LABEL_INTERPRET);
+}
+
+static void emitHelperCall(Assembler* as, void* helper, int32_t first, int32_t second) {
+  syncStackTop(as);
+  emitMov(as, RDI, VM_REG);
+  emitMovImm32(as, RSI, first);
+  emitMovImm32(as, RDX, second);
+  emitCall(as, helper);
+}
+
+/**
+ * a call to the native in a global slot. when the slot holds a native
+ * that doesn't allocate, the native is called straight from here while
+ * the slot still holds a native with the same C function: no collection
+ * can run, so vm->stackTop is left stale and the frame needn't be
+ * reloaded, and natives that can't fail aren't checked. anything else
+ * goes through jitCallNative
+ */
+static void emitNativeCall(Assembler* as, VM* vm, uint16_t slot, uint8_t callArgs) {
+  Value callee = vm->globals.data[slot];
+  ObjNative* native = IS_NATIVE(callee) ? AS_NATIVE(callee) : NULL;
+  bool direct = native != NULL && (native->flags & NATIVE_NO_ALLOC) &&
+    (native->arity == NATIVE_VARIADIC || native->arity == callArgs);
+
+  int done = 0;
+  if (direct) {
+    // the native isn't kept alive by this code, once it is reassigned and
+    // collected another object may take its address. the guard looks at
+    // what the slot points to instead of comparing the pointer
+    int32_t args = -(int32_t)(callArgs * sizeof(Value));
+    emitLoad(as, RAX, VM_REG, OFFSET_GLOBALS);
+    emitLoad(as, RAX, RAX, slot * (int32_t)sizeof(Value));
+    emitMovImm64(as, RCX, SIGN_BIT | QNAN);
+    emitMov(as, RDX, RAX);
+    emitRegReg(as, 0x21, RCX, RDX); // and rdx, rcx
+    emitRegReg(as, 0x39, RCX, RDX); // cmp rdx, rcx
+    int notObject = emitJcc(as, CC_NE);
+    emitRegReg(as, 0x29, RCX, RAX); // sub rax, rcx
+    emitRegMem(as, false, 0x81, 7, RAX, (int32_t)offsetof(Obj, type)); // cmp dword
+    emitInt32(as, OBJ_NATIVE);
+    int notNative = emitJcc(as, CC_NE);
+    emitMovImm64(as, RCX, (uint64_t)(uintptr_t)native->func);
+    emitRegMem(as, true, 0x39, RCX, RAX, (int32_t)offsetof(ObjNative, func)); // cmp [rax], rcx
+    int otherFunc = emitJcc(as, CC_NE);
+
+    emitMov(as, RDI, VM_REG);
+    emitMovImm32(as, RSI, callArgs);
+    emitLea(as, RDX, TOP_REG, args);
+    emitMov(as, RCX, RDX);
+    emitCall(as, (void*)native->func);
+    if (native->flags & NATIVE_MAY_ERROR) {
+      checkHelper(as);
+    }
+    emitLea(as, TOP_REG, TOP_REG, args + (int32_t)sizeof(Value));
+    done = emitJmp(as);
+    patchHere(as, notObject);
+    patchHere(as, notNative);
+    patchHere(as, otherFunc);
+  }
+
+  emitHelperCall(as, (void*)jitCallNative, slot, callArgs);
+  checkHelper(as);
+  reloadFrame(as);
+  if (direct) patchHere(as, done);
+}
+
+/**
+ * emit one plain instruction, operands points just past the opcode
+ * and target is its jump target (if it jumps)
+ * returns false if there is no template for it
+ */
+static bool emitInstruction(Assembler* as, VM* vm, const Chunk* chunk, uint8_t instruction,
+    const uint8_t* operands, int target) {
+  switch(instruction) {
+    case OP_CONSTANT:
+      emitMovImm64(as, RAX, chunk->constants.data[operands[0]]);
+      pushReg(as, RAX);
+      return true;
+    case OP_CONSTANT_LONG: {
+      uint32_t index = (operands[0] << 16) | (operands[1] << 8) | operands[2];
+      emitMovImm64(as, RAX, chunk->constants.data[index]);
+      pushReg(as, RAX);
+      return true;
+    }
+    case OP_NULL:
+    case OP_TRUE:
+    case OP_FALSE: {
+      int tag = instruction == OP_NULL ? TAG_NULL :
+        instruction == OP_TRUE ? TAG_TRUE : TAG_FALSE;
+      emitLea(as, RAX, QNAN_REG, tag);
+      pushReg(as, RAX);
+      return true;
+    }
+    case OP_POP:
+      emitAluImm(as, 5, TOP_REG, sizeof(Value));
+      return true;
+    case OP_GET_LOCAL:
+      emitLoad(as, RAX, BASE_REG, operands[0] * (int32_t)sizeof(Value));
+      pushReg(as, RAX);
+      return true;
+    case OP_SET_LOCAL:
+      popReg(as, RAX);
+      emitStore(as, BASE_REG, operands[0] * (int32_t)sizeof(Value), RAX);
+      return true;
+    case OP_GET_GLOBAL: {
+      uint16_t slot = (operands[0] << 8) | operands[1];
+      emitLoad(as, RAX, VM_REG, OFFSET_GLOBALS);
+      emitLoad(as, RAX, RAX, slot * (int32_t)sizeof(Value));
+      emitGlobalCheck(as, RAX, slot);
+      pushReg(as, RAX);
+      return true;
+    }
+    case OP_SET_GLOBAL:
+    case OP_DEFINE_GLOBAL: {
+      uint16_t slot = (operands[0] << 8) | operands[1];
+      emitLoad(as, RDX, VM_REG, OFFSET_GLOBALS);
+      if (instruction == OP_SET_GLOBAL) {
+        emitLoad(as, RAX, RDX, slot * (int32_t)sizeof(Value));
+        emitGlobalCheck(as, RAX, slot);
+      }
+      popReg(as, RAX);
+      emitStore(as, RDX, slot * (int32_t)sizeof(Value), RAX);
+      emitGlobalBarrier(as, slot);
+      return true;
+    }
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_LESS:
+    case OP_GREATER:
+    case OP_ADD_NUM:
+    case OP_SUBTRACT_NUM:
+    case OP_MULTIPLY_NUM:
+    case OP_DIVIDE_NUM:
+    case OP_LESS_NUM:
+    case OP_GREATER_NUM:
+      emitStackArithmetic(as, genericOp(instruction));
+      return true;
+    case OP_ADD_R:
+    case OP_SUBTRACT_R:
+    case OP_MULTIPLY_R:
+    case OP_DIVIDE_R:
+    case OP_LESS_R:
+    case OP_GREATER_R:
+      emitRegisterArithmetic(as, chunk, genericOp(instruction), operands);
+      return true;
+    case OP_JUMP_IF_NOT_LESS_R:
+    case OP_JUMP_IF_NOT_GREATER_R:
+      emitRegisterBranch(as, chunk, genericOp(instruction), operands, target);
+      return true;
+    case OP_EQUAL:
+      syncStackTop(as);
+      emitMov(as, RDI, VM_REG);
+      emitCall(as, (void*)jitEqual);
+      checkHelper(as);
+      reloadFrame(as);
+      return true;
+    case OP_NEGATE:
+      emitLoad(as, RAX, TOP_REG, -(int32_t)sizeof(Value));
+      addFixup(as, jumpIfNotNumber(as, RAX), LABEL_ERROR);
+      emitMovImm64(as, RCX, SIGN_BIT);
+      emitRegReg(as, 0x31, RCX, RAX); // xor rax, rcx
+      emitStore(as, TOP_REG, -(int32_t)sizeof(Value), RAX);
+      return true;
+    case OP_NOT:
+      emitLoad(as, RAX, TOP_REG, -(int32_t)sizeof(Value));
+      testFalsey(as, RAX);
+      boolFromFlags(as, CC_BE);
+      emitStore(as, TOP_REG, -(int32_t)sizeof(Value), RAX);
+      return true;
+    case OP_JUMP:
+    case OP_JUMP_LONG:
+      jumpAlwaysTo(as, target);
+      return true;
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_FALSE_LONG:
+    case OP_JUMP_IF_TRUE:
+    case OP_JUMP_IF_TRUE_LONG: {
+      bool ifFalse = instruction == OP_JUMP_IF_FALSE || instruction == OP_JUMP_IF_FALSE_LONG;
+      emitLoad(as, RAX, TOP_REG, -(int32_t)sizeof(Value));
+      testFalsey(as, RAX);
+      jumpTo(as, ifFalse ? CC_BE : CC_A, target);
+      return true;
+    }
+    case OP_CALL:
+      emitHelperCall(as, (void*)jitCall, operands[0], 0);
+      checkHelper(as);
+      reloadFrame(as);
+      return true;
+    case OP_CALL_NATIVE:
+      emitNativeCall(as, vm, (operands[0] << 8) | operands[1], operands[2]);
+      return true;
+    case OP_TAIL_CALL:
+      emitHelperCall(as, (void*)jitTailCall, operands[0], 0);
+      emitBytes(as, (const uint8_t[]){0x83, 0xf8, 2}, 3); // cmp eax, 2
+      jumpTo(as, CC_E, LABEL_TAIL_CALL);
+      checkHelper(as);
+      reloadFrame(as);
+      return true;
+    case OP_RETURN:
+      // the result takes the caller's slot where the arguments began
+      emitLoad(as, RAX, TOP_REG, -(int32_t)sizeof(Value));
+      emitStore(as, BASE_REG, 0, RAX);
+      emitLea(as, TOP_REG, BASE_REG, sizeof(Value));
+      syncStackTop(as);
+      emitRegMem(as, false, 0xff, 1, VM_REG, OFFSET_FRAME_COUNT); // dec dword
+      emitMovImm32(as, RAX, JIT_RETURNED);
+      jumpAlwaysTo(as, LABEL_EXIT);
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool translate(Assembler* as, VM* vm, const Chunk* chunk) {
+  // prologue: five pushes keep the stack 16-byte aligned for helper calls
+  emitPush(as, RBX);
+  emitPush(as, R12);
+  emitPush(as, R13);
+  emitPush(as, R14);
+  emitPush(as, R15);
+  emitMov(as, VM_REG, RDI);
+  emitMov(as, FRAME_REG, RSI);
+  emitMovImm64(as, QNAN_REG, QNAN);
+  reloadFrame(as);
+
+  for (int offset = 0; offset < chunk->count;) {
+    uint8_t instruction = chunk->code[offset];
+    placeLabel(as, offset);
+    int target = jumpTarget(chunk, offset);
+
+    // a superinstruction runs as its components in order
+    const Superinstruction* super = findSuperinstruction(instruction);
+    if (instruction == OP_LOOP || instruction == OP_LOOP_LONG ||
+        instruction == OP_LOOP_TRACE || instruction == OP_LOOP_LONG_TRACE) {
+      emitLoop(as, vm, chunk, offset, target);
+    } else if (super == NULL) {
+      if (!emitInstruction(as, vm, chunk, instruction, chunk->code + offset + 1, target)) {
+        return false;
+      }
+    } else {
+      const uint8_t* operands = chunk->code + offset + 1;
+      for (int i = 0; i < super->count; i++) {
+        if (!emitInstruction(as, vm, chunk, super->components[i], operands, target)) {
+          return false;
+        }
+        operands += operandSize(super->components[i]);
+      }
+    }
+
+    offset += instructionSize(instruction);
+  }
+
+  int errorLabel = newLabel(as);
+  placeLabel(as, errorLabel);
+  emitMovImm32(as, RAX, JIT_ERROR);
+  jumpAlwaysTo(as, LABEL_EXIT);
+
+  int interpretLabel = newLabel(as);
+  placeLabel(as, interpretLabel);
+  emitMovImm32(as, RAX, JIT_INTERPRET);
+  jumpAlwaysTo(as, LABEL_EXIT);
+
+  int tailCallLabel = newLabel(as);
+  placeLabel(as, tailCallLabel);
+  emitMovImm32(as, RAX, JIT_TAIL_CALL);
+
+  int exitLabel = newLabel(as);
+  placeLabel(as, exitLabel);
+  emitPop(as, R15);
+  emitPop(as, R14);
+  emitPop(as, R13);
+  emitPop(as, R12);
+  emitPop(as, RBX);
+  emitByte(as, 0xc3); // ret
+
+  for (int i = 0; i < as->fixupCount; i++) {
+    Fixup* fixup = &as->fixups[i];
+    switch(fixup->label) {
+      case LABEL_ERROR: fixup->label = errorLabel; break;
+      case LABEL_INTERPRET: fixup->label = interpretLabel; break;
+      case LABEL_TAIL_CALL: fixup->label = tailCallLabel; break;
+      case LABEL_EXIT: fixup->label = exitLabel; break;
+      default:
+        // a jump out of the chunk
+        if (fixup->label >= chunk->count) return false;
+    }
+  }
+  return resolveFixups(as);
+}
+
+bool jitCompile(VM* vm, ObjFunction* func) {
+  const Chunk* chunk = &func->chunk;
+  Assembler as;
+  initAssembler(&as, chunk->count);
+
+  void* code = translate(&as, vm, chunk) ? finishCode(&as) : NULL;
+  if (code == NULL) {
+    freeAssembler(&as);
+    return false;
+  }
+
+  func->jitCode = code;
+  func->jitSize = as.count;
+  freeAssembler(&as);
+  return true;
+}
+
+void jitFree(ObjFunction* func) {
+  freeCode(func->jitCode, func->jitSize);
+  func->jitCode = NULL;
+  func->jitSize = 0;
+}
+
+#endif
@@ -48,6 +48,14 @@ static const char* readFile(const char* fileName) {
   return source;
 }
 
+static void printMemory(const Heap* heap) {
+  fprintf(stderr, "memory: %zu bytes live, %zu peak\n", heap->bytes, heap->peak);
+  for (int kind = 0; kind < MEM_KIND_COUNT; kind++) {
+    fprintf(stderr, "  %-10s %10zu live %10zu peak\n", memoryKindName(kind),
+        heap->kindBytes[kind], heap->kindPeak[kind]);
+  }
+}
+
 static void repl(VM* vm, Compiler* compiler) {
   printf("Welcome to VMScript v. 0.1 Programming language\n");
   printf("Begin typing commands. Type 'exit' to terminate\n");
@@ -79,17 +87,49 @@ int main(int argc, char** argv) {
   Compiler compiler;
 
   VM vm;
-  initVM(&vm, &compiler);
-  initCompiler(&vm, &compiler, TYPE_SCRIPT);
-  
-  if (argc == 1) {
+  if (!initVM(&vm, &compiler) || !initCompiler(&vm, &compiler, TYPE_SCRIPT)) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    return -1;
+  }
+
+  // choose the bytecode form for this run, overriding the build default,
+  // whether hot functions may be compiled to machine code, how long
+  // a garbage collector step may pause the script (in microseconds),
+  // the heap limits (in bytes) and whether to report memory use at exit
+  size_t softLimit = 0;
+  size_t hardLimit = 0;
+  bool memoryStats = false;
+  int arg = 1;
+  for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+    if (strcmp(argv[arg], "--stack") == 0) {
+      vm.registerBytecode = false;
+    } else if (strcmp(argv[arg], "--registers") == 0) {
+      vm.registerBytecode = true;
+    } else if (strcmp(argv[arg], "--no-jit") == 0) {
+      vm.jitEnabled = false;
+    } else if (strncmp(argv[arg], "--gc-pause=", 11) == 0) {
+      vm.gcPauseMicros = atoi(argv[arg] + 11);
+    } else if (strncmp(argv[arg], "--heap-soft=", 12) == 0) {
+      softLimit = strtoull(argv[arg] + 12, NULL, 10);
+    } else if (strncmp(argv[arg], "--heap-hard=", 12) == 0) {
+      hardLimit = strtoull(argv[arg] + 12, NULL, 10);
+    } else if (strcmp(argv[arg], "--mem-stats") == 0) {
+      memoryStats = true;
+    } else {
+      break;
+    }
+  }
+  setHeapLimits(&vm.heap, softLimit, hardLimit);
+
+  if (argc == arg) {
     // run repl
     repl(&vm, &compiler);
-  } else if (argc == 2) {
-    const char* source = readFile(argv[1]);
+  } else if (argc == arg + 1) {
+    const char* source = readFile(argv[arg]);
     InterpretResult result = interpret(&vm, source);
     free((char*)source);
     source = NULL;
+    if (memoryStats) printMemory(&vm.heap);
 
     if (result == COMPILE_ERROR) {
       fprintf(stderr, "compilation error\n");
@@ -101,7 +141,7 @@ int main(int argc, char** argv) {
       exit(80);
     }
   } else {
-    fprintf(stderr, "usage: mcscript_vm <path | optional>\n");
+    fprintf(stderr, "usage: mcscript_vm [--stack | --registers] [--no-jit] [--gc-pause=<us>] [--heap-soft=<bytes>] [--heap-hard=<bytes>] [--mem-stats] <path | optional>\n");
     return -1;
   }
 
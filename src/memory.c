@@ -1,14 +1,222 @@
 #include <memory.h>
 
+#include <gc.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
-void* reallocate(void* pointer, size_t oldCapacity, size_t newCapacity) {
-  if (newCapacity == 0) {
-    free(pointer);
+#ifdef HUGE_PAGES
+#include <sys/mman.h>
+#endif
+
+/**
+ * a free block, linked through its first bytes
+ */
+typedef struct FreeBlock {
+  struct FreeBlock* next;
+} FreeBlock;
+
+/**
+ * arenas are linked through a header at their start,
+ * blocks are bumped off the current one
+ */
+typedef struct Arena {
+  struct Arena* next;
+} Arena;
+
+/**
+ * what is allocated outside any VM (and before the first one
+ * is set up) is charged to the process' own heap
+ */
+static Heap processHeap = {.nextGC = GC_HEAP_INITIAL};
+static Heap* heap = &processHeap;
+
+static const char* kindNames[MEM_KIND_COUNT] = {
+  [MEM_STRING] = "strings",
+  [MEM_FUNCTION] = "functions",
+  [MEM_NATIVE] = "natives",
+  [MEM_ROPE] = "ropes",
+  [MEM_CODE] = "code",
+  [MEM_CONSTANTS] = "constants",
+  [MEM_TABLE] = "tables",
+  [MEM_AST] = "ast",
+  [MEM_JIT] = "jit",
+  [MEM_VM] = "vm",
+};
+
+void initHeap(Heap* target) {
+  memset(target, 0, sizeof(Heap));
+  target->nextGC = GC_HEAP_INITIAL;
+}
+
+void useHeap(Heap* target) {
+  heap = target != NULL ? target : &processHeap;
+}
+
+void setHeapLimits(Heap* target, size_t softLimit, size_t hardLimit) {
+  target->softLimit = softLimit;
+  target->hardLimit = hardLimit;
+  if (softLimit != 0 && target->nextGC > softLimit) target->nextGC = softLimit;
+}
+
+const char* memoryKindName(MemoryKind kind) {
+  return kindNames[kind];
+}
+
+static bool passesHardLimit(size_t oldSize, size_t newSize) {
+  // only growth is refused, shrinking and freeing always succeed
+  return newSize > oldSize && heap->hardLimit != 0 &&
+      heap->bytes + (newSize - oldSize) > heap->hardLimit;
+}
+
+bool countMemory(size_t oldSize, size_t newSize, MemoryKind kind) {
+  if (passesHardLimit(oldSize, newSize)) {
+    heap->outOfMemory = true;
+    return false;
+  }
+
+  // a caller passing the wrong old size must not wrap the counts around
+  heap->bytes += newSize;
+  heap->bytes -= oldSize < heap->bytes ? oldSize : heap->bytes;
+  heap->kindBytes[kind] += newSize;
+  heap->kindBytes[kind] -= oldSize < heap->kindBytes[kind] ? oldSize : heap->kindBytes[kind];
+
+  if (newSize > oldSize) {
+    if (heap->bytes > heap->peak) heap->peak = heap->bytes;
+    if (heap->kindBytes[kind] > heap->kindPeak[kind]) heap->kindPeak[kind] = heap->kindBytes[kind];
+  }
+  return true;
+}
+
+static int sizeClass(size_t size) {
+  return (int)((size + POOL_GRANULE - 1) / POOL_GRANULE) - 1;
+}
+
+static Arena* newArena(void) {
+#ifdef HUGE_PAGES
+  // over-map so the arena can start on a huge page boundary
+  size_t length = POOL_ARENA_SIZE * 2;
+  uint8_t* mapped = mmap(NULL, length, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) return NULL;
+
+  uint8_t* start = (uint8_t*)(((uintptr_t)mapped + POOL_ARENA_SIZE - 1) &
+      ~(uintptr_t)(POOL_ARENA_SIZE - 1));
+  if (start > mapped) munmap(mapped, start - mapped);
+  munmap(start + POOL_ARENA_SIZE, mapped + length - (start + POOL_ARENA_SIZE));
+#ifdef MADV_HUGEPAGE
+  madvise(start, POOL_ARENA_SIZE, MADV_HUGEPAGE);
+#endif
+  return (Arena*)start;
+#else
+  return malloc(POOL_ARENA_SIZE);
+#endif
+}
+
+static void* poolAllocate(int class) {
+  FreeBlock* block = heap->freeLists[class];
+  if (block != NULL) {
+    heap->freeLists[class] = block->next;
+    return block;
+  }
+
+  size_t size = (size_t)(class + 1) * POOL_GRANULE;
+  if (heap->arenaTop == NULL || heap->arenaTop + size > heap->arenaEnd) {
+    // the few bytes left at the end of the old arena are given up
+    Arena* arena = newArena();
+    if (arena == NULL) return NULL;
+    arena->next = heap->arenas;
+    heap->arenas = arena;
+    heap->arenaTop = (uint8_t*)arena + POOL_GRANULE;
+    heap->arenaEnd = (uint8_t*)arena + POOL_ARENA_SIZE;
+  }
+
+  void* result = heap->arenaTop;
+  heap->arenaTop += size;
+  return result;
+}
+
+static void poolFree(void* pointer, int class) {
+  FreeBlock* block = pointer;
+  block->next = heap->freeLists[class];
+  heap->freeLists[class] = block;
+}
+
+void* reallocate(void* pointer, size_t oldCapacity, size_t newCapacity, MemoryKind kind) {
+  // a block that was never had is freed without counting it
+  if (pointer == NULL && newCapacity == 0) return NULL;
+
+  if (passesHardLimit(oldCapacity, newCapacity)) {
+    heap->outOfMemory = true;
+    return NULL;
+  }
+
+  bool oldPooled = pointer != NULL && oldCapacity > 0 && oldCapacity <= POOL_MAX;
+  bool newPooled = newCapacity > 0 && newCapacity <= POOL_MAX;
+
+  if (!oldPooled && !newPooled) {
+    if (newCapacity == 0) {
+      free(pointer);
+      countMemory(oldCapacity, 0, kind);
+      return NULL;
+    }
+
+    void* result = realloc(pointer, newCapacity);
+    if (result == NULL) {
+      heap->outOfMemory = true;
+      return NULL;
+    }
+    countMemory(oldCapacity, newCapacity, kind);
+    return result;
+  }
+
+  // blocks in the same class are resized in place
+  if (oldPooled && newPooled && sizeClass(oldCapacity) == sizeClass(newCapacity)) {
+    countMemory(oldCapacity, newCapacity, kind);
+    return pointer;
+  }
+
+  void* result = NULL;
+  if (newPooled) {
+    result = poolAllocate(sizeClass(newCapacity));
+  } else if (newCapacity > 0) {
+    result = malloc(newCapacity);
+  }
+  if (newCapacity > 0 && result == NULL) {
+    // the old block is left as it was
+    heap->outOfMemory = true;
     return NULL;
   }
 
-  void* result = realloc(pointer, newCapacity);
-  if (result == NULL) exit(1);
+  if (pointer != NULL) {
+    if (result != NULL) {
+      memcpy(result, pointer, oldCapacity < newCapacity ? oldCapacity : newCapacity);
+    }
+
+    if (oldPooled) {
+      poolFree(pointer, sizeClass(oldCapacity));
+    } else {
+      free(pointer);
+    }
+  }
+
+  countMemory(oldCapacity, newCapacity, kind);
   return result;
 }
+
+void freeHeap(Heap* target) {
+  while (target->arenas != NULL) {
+    Arena* next = target->arenas->next;
+#ifdef HUGE_PAGES
+    munmap(target->arenas, POOL_ARENA_SIZE);
+#else
+    free(target->arenas);
+#endif
+    target->arenas = next;
+  }
+
+  target->arenaTop = NULL;
+  target->arenaEnd = NULL;
+  memset(target->freeLists, 0, sizeof(target->freeLists));
+}
@@ -10,39 +10,62 @@
  * native C functions
  *
  */
-static Value print(VM* vm, int numArgs, Value* args) {
+static bool print(VM* vm, int numArgs, Value* args, Value* result) {
   for (int i = 0; i < numArgs; i++) {
-    printValue(args[i]);
+    if (!printValue(args[i])) {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return false;
+    }
     printf(" ");
   }
   printf("\n");
 
-  return NULL_VAL;
+  *result = NULL_VAL;
+  return true;
 }
 
-static Value writeTextToFile(VM* vm, int numArgs, Value* args) {
-  if (numArgs != 2) {
-    fprintf(stderr, "ERROR: expecting two arguments\n");
-    return NULL_VAL;
+/**
+ * replace rope arguments by their flattened strings,
+ * for natives that need the characters in one piece
+ * returns false if there was no memory for one
+ */
+static bool flattenArgs(VM* vm, int numArgs, Value* args) {
+  for (int i = 0; i < numArgs; i++) {
+    if (!IS_ROPE(args[i])) continue;
+
+    ObjString* flat = flattenString(vm, args[i]);
+    if (flat == NULL) {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return false;
+    }
+    args[i] = OBJ_VAL(flat);
   }
+  return true;
+}
 
+static bool writeTextToFile(VM* vm, int numArgs, Value* args, Value* result) {
+  // arity is checked by the caller
+  if (!flattenArgs(vm, numArgs, args)) return false;
   Value fileNameVal = args[0];
   if (!(IS_OBJ(fileNameVal)) || !(IS_STRING(fileNameVal))) {
     fprintf(stderr, "ERROR: expecting a string for the file name\n");
-    return NULL_VAL;
+    *result = NULL_VAL;
+    return true;
   }
 
   const char* fileName = AS_CSTRING(fileNameVal);
   FILE* file = fopen(fileName, "w");
   if (file == NULL) {
     fprintf(stderr, "ERROR: could not open file\n");
-    return NULL_VAL;
+    *result = NULL_VAL;
+    return true;
   }
 
   Value dataVal = args[1];
   if (!(IS_OBJ(dataVal)) || !(IS_STRING(dataVal))) {
     fprintf(stderr, "ERROR: expecting a string for data\n");
-    return NULL_VAL;
+    *result = NULL_VAL;
+    return true;
   }
 
   const char* data = AS_CSTRING(dataVal);
@@ -50,46 +73,64 @@ static Value writeTextToFile(VM* vm, int numArgs, Value* args) {
 
   if (fclose(file) == -1) {
     fprintf(stderr, "ERROR: error closing file\n");
-    return NULL_VAL;
+    *result = NULL_VAL;
+    return true;
   }
-  return BOOL_VAL(true);
+  *result = BOOL_VAL(true);
+  return true;
 }
 
-static Value readFile(VM* vm, int numArgs, Value* args) {
-  if (numArgs != 1 || !(IS_OBJ(args[0])) || !(IS_STRING(args[0]))) {
+static bool readFile(VM* vm, int numArgs, Value* args, Value* result) {
+  if (!flattenArgs(vm, numArgs, args)) return false;
+  if (!(IS_OBJ(args[0])) || !(IS_STRING(args[0]))) {
     fprintf(stderr, "ERROR: must pass one string for file name\n");
-    return NULL_VAL;
+    *result = NULL_VAL;
+    return true;
   }
 
   const char* fileName = AS_CSTRING(args[0]);
   FILE* file = fopen(fileName, "r");
   if (file == NULL) {
     fprintf(stderr, "ERROR: could not open file\n");
-    return NULL_VAL;
+    *result = NULL_VAL;
+    return true;
   }
 
   fseek(file, 0, SEEK_END);
   int size = ftell(file);
   rewind(file);
 
-  char* str = ALLOCATE(char, size + 1);
+  // read straight into the string, if reading fails
+  // the unused object is left to the garbage collector
+  ObjString* obj = allocateString(vm, size);
+  if (obj == NULL) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    fclose(file);
+    return false;
+  }
 
-  int bytesRead = fread(str, 1, size, file);
+  int bytesRead = fread(obj->str, 1, size, file);
   if (bytesRead != size) {
     fprintf(stderr, "ERROR: error reading file\n");
-    free(str);
-    return NULL_VAL;
+    fclose(file);
+    *result = NULL_VAL;
+    return true;
   }
-  str[size] = '\0';
 
   if (fclose(file) == -1) {
     fprintf(stderr, "ERROR: error closing file\n");
-    free(str);
-    return NULL_VAL;
+    *result = NULL_VAL;
+    return true;
   }
 
-  ObjString* obj = allocateString(vm, str);
-  return OBJ_VAL(obj);
+  obj->hash = hashString(obj->str, size);
+  ObjString* interned = internString(vm, obj);
+  if (interned == NULL) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    return false;
+  }
+  *result = OBJ_VAL(interned);
+  return true;
 }
 
 /*
@@ -97,26 +138,22 @@ static Value readFile(VM* vm, int numArgs, Value* args) {
  *
  */
 
-static ObjString* createKey(VM* vm, const char* str) {
-  int length = strlen(str);
-  char* keyStr = ALLOCATE(char, length + 1);
-  strcpy(keyStr, str);
-  keyStr[length] = '\0';
-  ObjString* key = allocateString(vm, keyStr);
-
-  return key;
-}
+static bool defineNative(VM* vm, const char* name, NativeFunc func,
+    int arity, uint8_t flags) {
+  // the name is allocated first, the native isn't reachable until it is stored
+  int slot = resolveGlobalSlot(vm, name, strlen(name));
+  if (slot == -1) return false;
 
-void defineNatives(VM* vm) {
-  ObjNative* native = newNative(vm, print);
-  ObjString* key = createKey(vm, "print");
-  tableSet(&vm->globals, key, OBJ_VAL(native));
+  ObjNative* native = newNative(vm, func, arity, flags);
+  if (native == NULL) return false;
 
-  native = newNative(vm, readFile);
-  key = createKey(vm, "readFile");
-  tableSet(&vm->globals, key, OBJ_VAL(native));
+  vm->globals.data[slot] = OBJ_VAL(native);
+  return true;
+}
 
-  native = newNative(vm, writeTextToFile);
-  key = createKey(vm, "readTextToFile");
-  tableSet(&vm->globals, key, OBJ_VAL(native));
+bool defineNatives(VM* vm) {
+  // printing a rope can run out of memory, it allocates nothing on the heap
+  return defineNative(vm, "print", print, NATIVE_VARIADIC, NATIVE_NO_ALLOC | NATIVE_MAY_ERROR) &&
+    defineNative(vm, "readFile", readFile, 1, NATIVE_MAY_ERROR) &&
+    defineNative(vm, "readTextToFile", writeTextToFile, 2, NATIVE_MAY_ERROR);
 }
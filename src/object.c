@@ -3,10 +3,17 @@
 #include <stdlib.h>
 #include <memory.h>
 #include <string.h>
+#include <stdio.h>
+#include <common.h>
+#include <gc.h>
+#include <table.h>
 
 uint32_t hashString(const char* key, int length) {
   // this is a hash function
-  uint32_t hash = 2166136261u;
+  return extendHash(2166136261u, key, length);
+}
+
+uint32_t extendHash(uint32_t hash, const char* key, int length) {
   for (int i = 0; i < length; i++) {
     hash ^= (uint8_t)key[i];
     hash *= 16777619;
@@ -15,73 +22,271 @@ uint32_t hashString(const char* key, int length) {
   return hash;
 }
 
-static void trackObject(VM* vm, Obj* obj) {
+/**
+ * whether size more bytes keep the heap under its hard limit,
+ * collecting everything unreachable first if they don't
+ */
+static bool heapHasRoom(VM* vm, size_t size) {
+  Heap* heap = &vm->heap;
+  if (heap->hardLimit == 0 || heap->bytes + size <= heap->hardLimit) return true;
+
+  collectGarbage(vm);
+  return heap->bytes + size <= heap->hardLimit;
+}
+
+/**
+ * the only place garbage is collected: the new object doesn't exist
+ * yet, and its caller holds it until it is stored somewhere reachable.
+ * returns NULL if the heap has no room for it
+ */
+static Obj* allocateObject(VM* vm, size_t size, ObjType type, MemoryKind kind) {
+#ifdef DEBUG_STRESS_GC
+  collectGarbage(vm);
+#else
+  if (vm->heap.bytes > vm->heap.nextGC) gcStep(vm);
+#endif
+
+  if (!heapHasRoom(vm, size)) {
+    vm->heap.outOfMemory = true;
+    return NULL;
+  }
+
+  Obj* obj = (Obj*)reallocate(NULL, 0, size, kind);
+  if (obj == NULL) return NULL;
+  obj->type = type;
+
+  // allocated black while marking, the cycle already counts it as live
+  obj->isMarked = vm->gcPhase == GC_MARK;
   obj->next = vm->objects;
   vm->objects = obj;
+  return obj;
 }
 
-ObjString* allocateString(VM* vm, char* buff) {
-  ObjString* obj = ALLOCATE(ObjString, 1);
+ObjString* allocateString(VM* vm, int length) {
+  ObjString* obj = (ObjString*)allocateObject(vm, STRING_SIZE(length), OBJ_STRING, MEM_STRING);
   if (obj == NULL) {
     return NULL;
   }
-  
-  int length = strlen(buff);
 
-  obj->obj.type = OBJ_STRING;
   obj->length = length;
-  obj->str = buff;
-  obj->hash = hashString(buff, obj->length);
-
-  trackObject(vm, (Obj*)obj);
+  obj->hash = 0;
+  obj->str[length] = '\0';
 
   return obj;
 }
 
+/**
+ * the interned string with these contents, if there is one
+ */
+static ObjString* findInterned(VM* vm, const char* chars, int length, uint32_t hash) {
+  ObjString* str = tableFindString(&vm->strings, chars, length, hash);
+
+  // while sweeping, an unmarked string may be garbage the sweep hasn't
+  // reached yet. marking it keeps it alive through this cycle
+  if (str != NULL && vm->gcPhase == GC_SWEEP) str->obj.isMarked = true;
+  return str;
+}
 
+ObjString* copyString(VM* vm, const char* chars, int length) {
+  uint32_t hash = hashString(chars, length);
+  ObjString* interned = findInterned(vm, chars, length, hash);
+  if (interned != NULL) {
+    // the caller may keep it where minor collections don't look
+    return IS_YOUNG(vm, interned) ? promoteString(vm, interned) : interned;
+  }
 
-char* createString(const Expression* expr) {
-  if (expr->type != EXPR_STRING) {
+  ObjString* obj = allocateString(vm, length);
+  if (obj == NULL) {
     return NULL;
   }
 
-  String stringExpr = expr->data.string;
+  memcpy(obj->str, chars, length);
+  obj->hash = hash;
 
-  // not including quotation marks in value
-  int length = stringExpr.token.length - 2;
-  char* chars = ALLOCATE(char, length + 1);
-  if (chars == NULL) {
-    return NULL;
+  // an uninterned copy would break equality by identity, it is left to the collector
+  if (!tableSet(&vm->strings, obj, NULL_VAL)) return NULL;
+  return obj;
+}
+
+ObjString* internString(VM* vm, ObjString* str) {
+  ObjString* interned = findInterned(vm, str->str, str->length, str->hash);
+  if (interned == NULL) {
+    return tableSet(&vm->strings, str, NULL_VAL) ? str : NULL;
+  }
+
+  // a young duplicate is the last thing bumped off the nursery,
+  // a heap one is left to the collector
+  size_t size = YOUNG_STRING_SIZE(str->length);
+  if ((uint8_t*)str + size == vm->nurseryTop) vm->nurseryTop -= size;
+  return interned;
+}
+
+ObjString* allocateYoungString(VM* vm, int length) {
+  ObjString* obj = (ObjString*)vm->nurseryTop;
+  vm->nurseryTop += YOUNG_STRING_SIZE(length);
+
+  // young strings aren't on the objects list, next is set once
+  // the string has been copied out of the nursery
+  obj->obj.type = OBJ_STRING;
+  obj->obj.isMarked = false;
+  obj->obj.next = NULL;
+  obj->length = length;
+  obj->hash = 0;
+  obj->str[length] = '\0';
+
+  return obj;
+}
+
+static int textLength(Obj* text) {
+  return text->type == OBJ_ROPE ? ((ObjRope*)text)->length : ((ObjString*)text)->length;
+}
+
+/**
+ * the half to keep in a new rope: a flattened rope is replaced by
+ * its string, a young string by its copy on the heap
+ */
+static Obj* ropeHalf(VM* vm, Obj* half) {
+  if (half->type == OBJ_ROPE) {
+    ObjRope* rope = (ObjRope*)half;
+    return rope->flat != NULL ? (Obj*)rope->flat : half;
+  }
+  return IS_YOUNG(vm, half) ? (Obj*)promoteString(vm, (ObjString*)half) : half;
+}
+
+ObjRope* newRope(VM* vm, Obj* left, Obj* right) {
+  ObjRope* rope = (ObjRope*)allocateObject(vm, sizeof(ObjRope), OBJ_ROPE, MEM_ROPE);
+  if (rope == NULL) return NULL;
+
+  rope->length = textLength(left) + textLength(right);
+  rope->flat = NULL;
+  rope->left = NULL;
+  rope->right = NULL;
+
+  // promoting doesn't collect, the halves stay where they are until stored
+  Obj* leftHalf = ropeHalf(vm, left);
+  Obj* rightHalf = ropeHalf(vm, right);
+  if (leftHalf == NULL || rightHalf == NULL) return NULL;
+  rope->left = leftHalf;
+  rope->right = rightHalf;
+
+  // the rope may have been allocated black
+  OBJECT_BARRIER(vm, OBJ_VAL(rope->left));
+  OBJECT_BARRIER(vm, OBJ_VAL(rope->right));
+  return rope;
+}
+
+typedef void (*LeafVisitor)(ObjString* leaf, void* context);
+
+/**
+ * call visit on each string under rope from left to right, a rope
+ * flattened already counts as its string. ropes built up in a loop
+ * are as deep as the loop ran long, the walk keeps its own stack.
+ * returns false if that stack can't grow, the walk stops part way
+ */
+static bool visitLeaves(ObjRope* rope, LeafVisitor visit, void* context) {
+  // not counted in the heap, like the gray stack
+  Obj** pending = NULL;
+  int count = 0;
+  int capacity = 0;
+
+  Obj* node = (Obj*)rope;
+  while (true) {
+    while (node->type == OBJ_ROPE && ((ObjRope*)node)->flat == NULL) {
+      if (count == capacity) {
+        capacity = GROW_CAPACITY(capacity);
+        Obj** grown = (Obj**)realloc(pending, sizeof(Obj*) * capacity);
+        if (grown == NULL) {
+          free(pending);
+          return false;
+        }
+        pending = grown;
+      }
+      pending[count++] = ((ObjRope*)node)->right;
+      node = ((ObjRope*)node)->left;
+    }
+
+    visit(node->type == OBJ_ROPE ? ((ObjRope*)node)->flat : (ObjString*)node, context);
+    if (count == 0) break;
+    node = pending[--count];
   }
 
-  memcpy(chars, stringExpr.token.start + 1, length);
-  chars[length] = '\0';
+  free(pending);
+  return true;
+}
+
+typedef struct {
+  char* cursor;
+  uint32_t hash;
+} Flattening;
 
-  return chars;
+static void copyLeaf(ObjString* leaf, void* context) {
+  Flattening* flattening = (Flattening*)context;
+  memcpy(flattening->cursor, leaf->str, leaf->length);
+  flattening->cursor += leaf->length;
+  flattening->hash = extendHash(flattening->hash, leaf->str, leaf->length);
+}
+
+ObjString* flattenString(VM* vm, Value value) {
+  if (IS_STRING(value)) return AS_STRING(value);
+
+  ObjRope* rope = AS_ROPE(value);
+  if (rope->flat != NULL) return rope->flat;
+
+  // the rope keeps its halves alive if allocating collects
+  ObjString* flat = allocateString(vm, rope->length);
+  if (flat == NULL) return NULL;
+
+  Flattening flattening = {flat->str, hashString("", 0)};
+  if (!visitLeaves(rope, copyLeaf, &flattening)) return NULL;
+  flat->hash = flattening.hash;
+
+  // a half-built or uninterned flat string is left to the collector
+  ObjString* interned = internString(vm, flat);
+  if (interned == NULL) return NULL;
+
+  rope->flat = interned;
+  rope->left = NULL;
+  rope->right = NULL;
+  OBJECT_BARRIER(vm, OBJ_VAL(rope->flat));
+  return rope->flat;
+}
+
+static void printLeaf(ObjString* leaf, void* context) {
+  (void)context;
+  printf("%s", leaf->str);
+}
+
+bool printRope(ObjRope* rope) {
+  return visitLeaves(rope, printLeaf, NULL);
 }
 
 ObjFunction* newFunction(VM* vm) {
-  ObjFunction* func = ALLOCATE(ObjFunction, 1);
+  ObjFunction* func = (ObjFunction*)allocateObject(vm, sizeof(ObjFunction),
+      OBJ_FUNCTION, MEM_FUNCTION);
 
   if (func == NULL) return NULL;
 
   func->name = NULL;
   func->numArgs = 0;
-  func->obj.type = OBJ_FUNCTION;
+  func->maxSlots = 0;
+  func->callCount = 0;
+  func->jitCode = NULL;
+  func->jitSize = 0;
+  func->loopTraces = NULL;
+  func->loopTraceCount = 0;
+  func->loopTraceCapacity = 0;
   initChunk(&func->chunk);
 
-  trackObject(vm, (Obj*)func);
-
   return func;
 }
 
-ObjNative* newNative(VM* vm, NativeFunc func) {
-  ObjNative* native = ALLOCATE(ObjNative, 1);
+ObjNative* newNative(VM* vm, NativeFunc func, int arity, uint8_t flags) {
+  ObjNative* native = (ObjNative*)allocateObject(vm, sizeof(ObjNative),
+      OBJ_NATIVE, MEM_NATIVE);
   if (native == NULL) return NULL;
 
-  native->obj.type = OBJ_NATIVE;
   native->func = func;
-
-  trackObject(vm, (Obj*)native);
+  native->arity = arity;
+  native->flags = flags;
   return native;
 }
@@ -2,19 +2,158 @@
 #include <scanner.h>
 #include <parser.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <memory.h>
 
-static Expression number(Parser*, Scanner*);
-static Expression unary(Parser*, Scanner*);
-static Expression binary(Parser*, Scanner*, Expression);
-static Expression parseExpression(Parser*, Scanner*, Precedence);
-static Expression grouped(Parser*, Scanner*);
+/**
+ * a chunk of the parse arena, nodes are bumped off data
+ */
+struct AstChunk {
+  AstChunk* next;
+  size_t size;
+  size_t used;
+  uint8_t data[];
+};
+
+#define AST_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+#define ALLOCATE_NODE(parser, type, count) \
+  (type*)astAllocate(parser, sizeof(type) * (count))
+
+#define GROW_NODES(parser, type, pointer, oldCount, newCount) \
+  (type*)astGrow(parser, pointer, sizeof(type) * (oldCount), \
+      sizeof(type) * (newCount))
+
+/**
+ * nodes only take the bytes of the variant their type selects
+ */
+#define NEW_EXPRESSION(parser, type, field) \
+  newExpression(parser, type, offsetof(Expression, data) + \
+      sizeof(((Expression*)NULL)->data.field))
+
+#define NEW_STATEMENT(parser, type, field) \
+  newStatement(parser, type, offsetof(Statement, data) + \
+      sizeof(((Statement*)NULL)->data.field))
+
+static Expression* number(Parser*, Scanner*);
+static Expression* unary(Parser*, Scanner*);
+static Expression* binary(Parser*, Scanner*, Expression*);
+static Expression* parseExpression(Parser*, Scanner*, Precedence);
+static Expression* grouped(Parser*, Scanner*);
 static bool expect(Parser*, Scanner*, TokenType);
-static Expression boolean(Parser*, Scanner*);
-static Expression identifier(Parser*, Scanner*);
-static void append(Statements* statements, Statement stmt);
-static Statement parseStatement(Parser* parser, Scanner* scanner);
+static Expression* boolean(Parser*, Scanner*);
+static Expression* identifier(Parser*, Scanner*);
+static void pushNode(Parser* parser, void* node);
+static Statement* parseStatement(Parser* parser, Scanner* scanner);
+static Statements closeStatements(Parser* parser, int base);
+
+static void error(Parser* parser, const char* msg);
+
+/**
+ * report running out of memory once per parse
+ */
+static void outOfMemory(Parser* parser) {
+  if (!parser->outOfMemory) error(parser, "out of memory");
+  parser->outOfMemory = true;
+}
+
+static AstChunk* newChunk(size_t size) {
+  AstChunk* chunk = (AstChunk*)reallocate(NULL, 0, sizeof(AstChunk) + size, MEM_AST);
+  if (chunk == NULL) return NULL;
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+  return chunk;
+}
+
+/**
+ * returns NULL once the arena can't grow
+ */
+static void* astAllocate(Parser* parser, size_t size) {
+  size = AST_ALIGN(size);
+  AstChunk* chunk = parser->chunks;
+
+  if (chunk == NULL || chunk->used + size > chunk->size) {
+    if (chunk != NULL && size > AST_CHUNK_SIZE / 4) {
+      // linked in behind the current chunk, which still has room
+      AstChunk* own = newChunk(size);
+      if (own == NULL) {
+        outOfMemory(parser);
+        return NULL;
+      }
+      own->used = size;
+      own->next = chunk->next;
+      chunk->next = own;
+      return own->data;
+    }
+
+    chunk = newChunk(size > AST_CHUNK_SIZE ? size : AST_CHUNK_SIZE);
+    if (chunk == NULL) {
+      outOfMemory(parser);
+      return NULL;
+    }
+    chunk->next = parser->chunks;
+    parser->chunks = chunk;
+  }
+
+  void* result = chunk->data + chunk->used;
+  chunk->used += size;
+  return result;
+}
+
+/**
+ * grows in place when pointer was the last thing bumped off the
+ * current chunk, otherwise the old copy stays until the arena goes
+ */
+static void* astGrow(Parser* parser, void* pointer, size_t oldSize, size_t newSize) {
+  oldSize = AST_ALIGN(oldSize);
+  newSize = AST_ALIGN(newSize);
+  AstChunk* chunk = parser->chunks;
+
+  if (pointer != NULL && chunk != NULL &&
+      (uint8_t*)pointer + oldSize == chunk->data + chunk->used &&
+      chunk->used - oldSize + newSize <= chunk->size) {
+    chunk->used += newSize - oldSize;
+    return pointer;
+  }
+
+  void* result = astAllocate(parser, newSize);
+  if (pointer != NULL && result != NULL) memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+  return result;
+}
+
+/**
+ * where the nodes go once the arena can't grow, so the parse can
+ * unwind without checking each one. its contents are never used
+ */
+static union {
+  Expression expr;
+  Statement stmt;
+} sinkNode;
+
+static Expression* newExpression(Parser* parser, ExpressionType type, size_t size) {
+  Expression* expr = (Expression*)astAllocate(parser, size);
+  if (expr == NULL) expr = &sinkNode.expr;
+  expr->type = type;
+  return expr;
+}
+
+static Statement* newStatement(Parser* parser, StatementType type, size_t size) {
+  Statement* stmt = (Statement*)astAllocate(parser, size);
+  if (stmt == NULL) stmt = &sinkNode.stmt;
+  stmt->type = type;
+  return stmt;
+}
+
+/**
+ * for EXPR_NULL and EXPR_ERROR, which carry no data
+ */
+static Expression* emptyExpression(Parser* parser, ExpressionType type) {
+  return newExpression(parser, type, offsetof(Expression, data));
+}
 
 static void error(Parser* parser, const char* msg) {
   fprintf(stderr, "[line %d]: Error: %s\n", parser->previous.line, msg);
@@ -25,70 +164,87 @@ static void advance(Parser* parser, Scanner* scanner) {
   parser->current = scanToken(scanner);
 }
 
-static Expression string(Parser* parser, Scanner* scanner) {
-  String string = {.token = parser->previous};
-  Expression expr = {.data = {.string = string}, .type = EXPR_STRING};
+static Expression* string(Parser* parser, Scanner* scanner) {
+  Expression* expr = NEW_EXPRESSION(parser, EXPR_STRING, string);
+  expr->data.string = (String){.token = parser->previous};
 
   return expr;
 }
 
-static Expression identifier(Parser* parser, Scanner* scanner) {
+static Expression* identifier(Parser* parser, Scanner* scanner) {
   Identifier ident = {
     .length = parser->previous.length,
     .start = parser->previous.start,
     .token = parser->previous
   };
-  Expression expr = {.data = {.identifier = ident}, .type = EXPR_IDENT};
+  Expression* expr = NEW_EXPRESSION(parser, EXPR_IDENT, identifier);
+  expr->data.identifier = ident;
 
   return expr;
 }
 
-static bool parseCallParams(Parser* parser, Scanner* scanner, CallExpression* ce) {
-  ce->capacity = GROW_CAPACITY(0);
-  ce->args = GROW_ARRAY(Expression, ce->args, 0, ce->capacity);
-
-  Expression expr = parseExpression(parser, scanner, PREC_NONE);
-  if (expr.type == EXPR_ERROR) return false;
-  ce->args[ce->argCount++] = expr;
+/**
+ * the arguments are stacked on scratch above base
+ */
+static bool parseCallParams(Parser* parser, Scanner* scanner, int base) {
+  Expression* expr = parseExpression(parser, scanner, PREC_NONE);
+  if (expr->type == EXPR_ERROR) return false;
+  pushNode(parser, expr);
   
   while (parser->current.type == TOKEN_COMMA) {
     advance(parser, scanner);
     advance(parser, scanner);
 
-    if (ce->capacity < ce->argCount + 1) {
-      int oldCapacity = ce->capacity;
-      ce->capacity = GROW_CAPACITY(oldCapacity);
-      ce->args = GROW_ARRAY(Expression, ce->args, oldCapacity, ce->capacity);
+    if (parser->scratchCount - base == ARGS_MAX) {
+      error(parser, "too many arguments");
+      return false;
     }
 
     expr = parseExpression(parser, scanner, PREC_NONE);
-    if (expr.type == EXPR_ERROR) {
+    if (expr->type == EXPR_ERROR) {
       return false;
     }
-    ce->args[ce->argCount++] = expr;
+    pushNode(parser, expr);
   }
 
   return true;
 }
 
-static Expression call(Parser* parser, Scanner* scanner, Expression expr) {
+static Expression* call(Parser* parser, Scanner* scanner, Expression* expr) {
+  if (expr->type != EXPR_IDENT) {
+    error(parser, "expected function name");
+    return emptyExpression(parser, EXPR_ERROR);
+  }
+
   CallExpression ce = {
     .token = parser->previous,
-    .name = expr.data.identifier,
-    .argCount = 0
+    .name = expr->data.identifier,
+    .argCount = 0,
+    .args = NULL
   };
 
   if (parser->current.type != TOKEN_RIGHT_PAREN) {
     advance(parser, scanner);
-    if (!parseCallParams(parser, scanner, &ce)) {
-      return (Expression){.type = EXPR_ERROR};
+    int base = parser->scratchCount;
+    if (!parseCallParams(parser, scanner, base)) {
+      parser->scratchCount = base;
+      return emptyExpression(parser, EXPR_ERROR);
+    }
+
+    ce.argCount = parser->scratchCount - base;
+    ce.args = ALLOCATE_NODE(parser, Expression*, ce.argCount);
+    if (ce.args == NULL) ce.argCount = 0;
+    for (int i = 0; i < ce.argCount; i++) {
+      ce.args[i] = parser->scratch[base + i];
     }
+    parser->scratchCount = base;
   }
 
   // consume closing paren
   advance(parser, scanner);
 
-  Expression resultExpr = {.type = EXPR_CALL, .data = {.call = ce}};
+  Expression* resultExpr = NEW_EXPRESSION(parser, EXPR_CALL, call);
+  resultExpr->data.call = ce;
   return resultExpr;
 }
 
@@ -121,85 +277,76 @@ static ParserRule getRule(TokenType type) {
   return rules[type];
 }
 
-static Expression boolean(Parser* parser, Scanner* scanner) {
+static Expression* boolean(Parser* parser, Scanner* scanner) {
   Boolean boolean = {.token = parser->previous};
   boolean.value = parser->previous.type == TOKEN_TRUE ? true : false;
-  Expression expr = {.type = EXPR_BOOL, .data = {.boolean = boolean}};
+  Expression* expr = NEW_EXPRESSION(parser, EXPR_BOOL, boolean);
+  expr->data.boolean = boolean;
   return expr;
 }
 
-static Expression grouped(Parser* parser, Scanner* scanner) {
+static Expression* grouped(Parser* parser, Scanner* scanner) {
   Group group = {.token = parser->previous};
 
   advance(parser, scanner);
-  Expression innerExpr = parseExpression(parser, scanner, getRule(parser->previous.type).precedence);
-  Expression* innerExprP = (Expression*)malloc(sizeof(Expression));
-  *innerExprP = innerExpr;
-
-  group.expr = innerExprP;
+  group.expr = parseExpression(parser, scanner, getRule(parser->previous.type).precedence);
 
   // jump over right paren
   if (!expect(parser, scanner, TOKEN_RIGHT_PAREN)) {
     // handle error
     error(parser, "unexpected token");
-    Expression expr = {.type = EXPR_ERROR};
-    return expr;
+    return emptyExpression(parser, EXPR_ERROR);
   }
   
-  Expression expr = {.type = EXPR_GROUP};
-  expr.data.group = group;
+  Expression* expr = NEW_EXPRESSION(parser, EXPR_GROUP, group);
+  expr->data.group = group;
 
   return expr;
 }
 
-static Expression binary(Parser* parser, Scanner* scanner, Expression left) {
+static Expression* binary(Parser* parser, Scanner* scanner, Expression* left) {
   Infix infix = {.token = parser->previous, .operator = parser->previous.type};
-  Expression* leftP = (Expression*)malloc(sizeof(Expression));
-  *leftP = left;
-  infix.left = leftP;
+  infix.left = left;
 
   // getting the precedence of the operator
   Precedence prec = getRule(parser->previous.type).precedence;
   advance(parser, scanner);
 
-  Expression right = parseExpression(parser, scanner, prec);
-  Expression* rightP = (Expression*)malloc(sizeof(Expression));
-  *rightP = right;
-  infix.right = rightP;
+  infix.right = parseExpression(parser, scanner, prec);
 
-  Expression expr = {.type = EXPR_INFIX};
-  expr.data.infix = infix;
+  Expression* expr = NEW_EXPRESSION(parser, EXPR_INFIX, infix);
+  expr->data.infix = infix;
 
   return expr;
 }
 
-static Expression unary(Parser* parser, Scanner* scanner) {
+static Expression* unary(Parser* parser, Scanner* scanner) {
   Prefix prefix = {.token = parser->previous, .operator = parser->previous.type};
   advance(parser, scanner);
 
-  Expression* prefixExpr = (Expression*)malloc(sizeof(Expression));
-  *prefixExpr = parseExpression(parser, scanner, PREC_UNARY);
-
-  prefix.expression = prefixExpr;
+  prefix.expression = parseExpression(parser, scanner, PREC_UNARY);
 
-  Expression expr = {.type = EXPR_PREFIX};
-  expr.data.prefix = prefix;
+  Expression* expr = NEW_EXPRESSION(parser, EXPR_PREFIX, prefix);
+  expr->data.prefix = prefix;
 
   return expr;
 }
 
-static Expression number(Parser* parser, Scanner* scanner) {
+static Expression* number(Parser* parser, Scanner* scanner) {
   Number number = {.token = parser->previous};
 
-  char* buff = (char*)malloc(number.token.length + 1);
-  snprintf(buff, sizeof(buff), "%.*s", number.token.length, number.token.start);
-  buff[number.token.length] = '\0';
+  // the token isn't terminated, long literals are copied to the arena
+  char small[32];
+  int length = number.token.length;
+  char* buff = length < (int)sizeof(small) ? small : ALLOCATE_NODE(parser, char, length + 1);
+  if (buff == NULL) return emptyExpression(parser, EXPR_ERROR);
+  memcpy(buff, number.token.start, length);
+  buff[length] = '\0';
   double value = strtod(buff, NULL);
   number.value = value;
 
-  Expression expr = {.type = EXPR_NUMBER};
-  expr.data.number = number;
-  free(buff);
+  Expression* expr = NEW_EXPRESSION(parser, EXPR_NUMBER, number);
+  expr->data.number = number;
 
   return expr;
 }
@@ -222,7 +369,7 @@ static Precedence peekPrecedence(TokenType type) {
   return getRule(type).precedence;
 }
 
-static Expression parseExpression(Parser* parser, Scanner* scanner, Precedence prec) {
+static Expression* parseExpression(Parser* parser, Scanner* scanner, Precedence prec) {
   ParserRule rule = getRule(parser->previous.type);
   PrefixFn prefixFn = rule.prefix;
   if (prefixFn == NULL) {
@@ -230,11 +377,10 @@ static Expression parseExpression(Parser* parser, Scanner* scanner, Precedence p
     char buff[256];
     snprintf(buff, sizeof(buff), "no parser function for token %d", parser->previous.type);
     error(parser, buff);
-    Expression expr = {.type = EXPR_ERROR};
-    return expr;
+    return emptyExpression(parser, EXPR_ERROR);
   }
 
-  Expression expr = prefixFn(parser, scanner);
+  Expression* expr = prefixFn(parser, scanner);
 
   while (prec < peekPrecedence(parser->current.type) && parser->current.type != TOKEN_EOF) {
     ParserRule infixRule = getRule(parser->current.type);
@@ -262,8 +408,7 @@ static ReturnStatement parseReturnStatement(Parser* parser, Scanner* scanner) {
   ReturnStatement rs;
   rs.token = parser->previous;
   if (parser->current.type == TOKEN_SEMICOLON) {
-    Expression expr = {.type = EXPR_NULL};
-    rs.expression = expr;
+    rs.expression = emptyExpression(parser, EXPR_NULL);
     return rs;
   }
 
@@ -290,7 +435,7 @@ static VarStatement parseVarStatement(Parser* parser, Scanner* scanner) {
     advance(parser, scanner);
     vs.value = parseExpression(parser, scanner, getRule(parser->previous.type).precedence);
   } else {
-    vs.value = (Expression){.type = EXPR_NULL};
+    vs.value = emptyExpression(parser, EXPR_NULL);
   }
 
   return vs;
@@ -304,19 +449,16 @@ static ExpressionStatement parseExpressionStatement(Parser* parser, Scanner* sca
 
 static BlockStatement parseBlockStatement(Parser* parser, Scanner* scanner) {
   BlockStatement bs = {.token = parser->previous};
-  Statements statements = {
-    .count = 0,
-    .capacity = 0,
-    .stmts = NULL
-  };
+  int base = parser->scratchCount;
   advance(parser, scanner);
 
   while (true) {
-    Statement stmt = parseStatement(parser, scanner);
-    if (stmt.type != STMT_NULL) {
-      append(&statements, stmt);    
+    Statement* stmt = parseStatement(parser, scanner);
+    if (stmt != NULL) {
+      pushNode(parser, stmt);
     }
 
+    if (parser->outOfMemory) break;
     if (parser->current.type == TOKEN_EOF) {
       error(parser, "expected closing brace");
       break;
@@ -330,7 +472,7 @@ static BlockStatement parseBlockStatement(Parser* parser, Scanner* scanner) {
     advance(parser, scanner);
   }
 
-  bs.stmts = statements;
+  bs.stmts = closeStatements(parser, base);
   return bs;
 }
 
@@ -346,9 +488,8 @@ static IfStatement parseIfStatement(Parser* parser, Scanner* scanner) {
   // consume the left paren
   advance(parser, scanner);
 
-  Expression booleanExpr = parseExpression(parser, scanner, PREC_NONE);
-  if (booleanExpr.type == EXPR_ERROR) return is;
-  is.condition = booleanExpr;
+  is.condition = parseExpression(parser, scanner, PREC_NONE);
+  if (is.condition->type == EXPR_ERROR) return is;
 
   if (!expect(parser, scanner, TOKEN_RIGHT_PAREN)) {
     error(parser, "expected closing paren");
@@ -389,7 +530,7 @@ static WhileStatement parseWhileStatement(Parser* parser, Scanner* scanner) {
 
   ws.condition = parseExpression(parser, scanner, PREC_NONE);
 
-  if (ws.condition.type == EXPR_ERROR) {
+  if (ws.condition->type == EXPR_ERROR) {
     return errorResult;
   }
 
@@ -420,14 +561,40 @@ static AssignStatement parseAssignStatement(Parser* parser, Scanner* scanner) {
   advance(parser, scanner);
 
   as.value = parseExpression(parser, scanner, PREC_NONE);
-  if (as.value.type == EXPR_ERROR) {
+  if (as.value->type == EXPR_ERROR) {
     return errorResult;
   }
 
   return as;
 }
+/**
+ * nothing else is allocated while the parameters are read,
+ * so their array grows in place at the top of the arena
+ */
+static bool parseParam(Parser* parser, FunctionStatement* fs, int* capacity) {
+  if (parser->previous.type != TOKEN_IDENTIFIER) {
+    error(parser, "must pass identifiers in function definition");
+    return false;
+  }
+
+  if (fs->argCount == ARGS_MAX) {
+    error(parser, "too many parameters");
+    return false;
+  }
+
+  if (*capacity < fs->argCount + 1) {
+    int oldCapacity = *capacity;
+    *capacity = GROW_CAPACITY(oldCapacity);
+    fs->args = GROW_NODES(parser, Identifier, fs->args, oldCapacity, *capacity);
+    if (fs->args == NULL) return false;
+  }
+
+  fs->args[fs->argCount++] = createName(parser);
+  return true;
+}
+
 static FunctionStatement parseFunctionStatement(Parser* parser, Scanner* scanner) {
-  FunctionStatement fs = {.token = parser->previous, .argCount = 0};
+  FunctionStatement fs = {.token = parser->previous, .argCount = 0, .args = NULL};
   FunctionStatement errorResult = {.token ={.type = TOKEN_NULL}};
   // consume function keyword
   advance(parser, scanner);
@@ -440,22 +607,19 @@ static FunctionStatement parseFunctionStatement(Parser* parser, Scanner* scanner
   }
   
   if (parser->current.type != TOKEN_RIGHT_PAREN) {
+    int capacity = 0;
     advance(parser, scanner);
-    if (parser->previous.type != TOKEN_IDENTIFIER) {
-      error(parser, "must pass identifiers in function definition");
-      return errorResult;
-    }
-    fs.args[fs.argCount++] = createName(parser);
+    if (!parseParam(parser, &fs, &capacity)) return errorResult;
 
     while (parser->current.type == TOKEN_COMMA) {
       advance(parser, scanner);
       advance(parser, scanner);
-      if (parser->previous.type != TOKEN_IDENTIFIER) {
-        error(parser, "must pass identifiers in function definition");
-        return errorResult;
-      }
-      fs.args[fs.argCount++] = createName(parser);
+      if (!parseParam(parser, &fs, &capacity)) return errorResult;
     }
+
+    // give the unused capacity back, in place as nothing came after
+    Identifier* args = GROW_NODES(parser, Identifier, fs.args, capacity, fs.argCount);
+    if (args != NULL) fs.args = args;
   }
 
   // consume closing paren
@@ -471,102 +635,137 @@ static FunctionStatement parseFunctionStatement(Parser* parser, Scanner* scanner
   return fs;
 }
 
-static Statement parseStatement(Parser* parser, Scanner* scanner) {
-  Statement stmt;
+/**
+ * for STMT_ERROR, which carries no data
+ */
+static Statement* errorStatement(Parser* parser) {
+  return newStatement(parser, STMT_ERROR, offsetof(Statement, data));
+}
+
+/**
+ * returns NULL for an empty statement
+ */
+static Statement* parseStatement(Parser* parser, Scanner* scanner) {
+  Statement* stmt;
   switch(parser->previous.type) {
     case TOKEN_RETURN: {
       ReturnStatement rs = parseReturnStatement(parser, scanner);
-      stmt.type = STMT_RETURN;
-      stmt.data.returnStmt = rs;
+      stmt = NEW_STATEMENT(parser, STMT_RETURN, returnStmt);
+      stmt->data.returnStmt = rs;
       break;
     }
     case TOKEN_VAR: {
       VarStatement vs = parseVarStatement(parser, scanner);
-      stmt.type = vs.token.type == TOKEN_NULL ? STMT_ERROR : STMT_VAR;
-      stmt.data.varStmt = vs;
+      if (vs.token.type == TOKEN_NULL) return errorStatement(parser);
+      stmt = NEW_STATEMENT(parser, STMT_VAR, varStmt);
+      stmt->data.varStmt = vs;
       break;
     }
     case TOKEN_LEFT_BRACE: {
       // parse block statement
       BlockStatement bs = parseBlockStatement(parser, scanner);
-      stmt.type = STMT_BLOCK;
-      stmt.data.blockStmt = bs;
+      stmt = NEW_STATEMENT(parser, STMT_BLOCK, blockStmt);
+      stmt->data.blockStmt = bs;
       break;
     }
     case TOKEN_IF: {
       IfStatement is = parseIfStatement(parser, scanner);
-      stmt.type = is.token.type == TOKEN_NULL ? STMT_ERROR : STMT_IF;
-      stmt.data.ifStmt = is;
+      if (is.token.type == TOKEN_NULL) return errorStatement(parser);
+      stmt = NEW_STATEMENT(parser, STMT_IF, ifStmt);
+      stmt->data.ifStmt = is;
       break;
     }
     case TOKEN_WHILE: {
       WhileStatement ws = parseWhileStatement(parser, scanner);
-      stmt.type = ws.token.type == TOKEN_NULL ? STMT_ERROR : STMT_WHILE;
-      stmt.data.whileStmt = ws;
+      if (ws.token.type == TOKEN_NULL) return errorStatement(parser);
+      stmt = NEW_STATEMENT(parser, STMT_WHILE, whileStmt);
+      stmt->data.whileStmt = ws;
       break;
     }
     case TOKEN_IDENTIFIER: {
       if (parser->current.type == TOKEN_LEFT_PAREN) {
         ExpressionStatement es = parseExpressionStatement(parser, scanner);
-        stmt.type = STMT_EXPR;
-        stmt.data.expressionStmt = es;
+        stmt = NEW_STATEMENT(parser, STMT_EXPR, expressionStmt);
+        stmt->data.expressionStmt = es;
         break;
       }
 
       AssignStatement as = parseAssignStatement(parser, scanner);
-      stmt.type = as.token.type == TOKEN_NULL ? STMT_ERROR : STMT_ASSIGN;
-      stmt.data.assignStmt = as;
+      if (as.token.type == TOKEN_NULL) return errorStatement(parser);
+      stmt = NEW_STATEMENT(parser, STMT_ASSIGN, assignStmt);
+      stmt->data.assignStmt = as;
       break;
     }
     case TOKEN_FUNCTION: {
       FunctionStatement fs = parseFunctionStatement(parser, scanner);
-      stmt.type = fs.token.type == TOKEN_NULL ? STMT_ERROR : STMT_FUNCTION;
-      stmt.data.funcStmt = fs;
+      if (fs.token.type == TOKEN_NULL) return errorStatement(parser);
+      stmt = NEW_STATEMENT(parser, STMT_FUNCTION, funcStmt);
+      stmt->data.funcStmt = fs;
       break;
     }
     case TOKEN_SEMICOLON:
-      stmt.type = STMT_NULL;
-      break;
+      return NULL;
     default: {
       ExpressionStatement es = parseExpressionStatement(parser, scanner);
-      stmt.type = STMT_EXPR;
-      stmt.data.expressionStmt = es;
+      stmt = NEW_STATEMENT(parser, STMT_EXPR, expressionStmt);
+      stmt->data.expressionStmt = es;
       break;
     }
   }
   return stmt;
 }
 
-static void append(Statements* statements, Statement stmt) {
-  if (statements->capacity < statements->count + 1) {
-    int oldCapacity = statements->capacity;
-    statements->capacity = GROW_CAPACITY(statements->capacity);
-    statements->stmts = GROW_ARRAY(Statement, statements->stmts, oldCapacity, statements->capacity);
+static void pushNode(Parser* parser, void* node) {
+  if (parser->scratchCapacity < parser->scratchCount + 1) {
+    int capacity = GROW_CAPACITY(parser->scratchCapacity);
+    void** scratch = GROW_ARRAY(void*, parser->scratch, parser->scratchCapacity, capacity, MEM_AST);
+    if (scratch == NULL) {
+      outOfMemory(parser);
+      return;
+    }
+    parser->scratch = scratch;
+    parser->scratchCapacity = capacity;
   }
 
-  statements->stmts[statements->count] = stmt;
-  statements->count++;
+  parser->scratch[parser->scratchCount++] = node;
+}
+
+/**
+ * move the statements stacked on scratch since base into the arena
+ */
+static Statements closeStatements(Parser* parser, int base) {
+  Statements statements = {.count = parser->scratchCount - base, .stmts = NULL};
+
+  if (statements.count > 0) {
+    statements.stmts = ALLOCATE_NODE(parser, Statement*, statements.count);
+    if (statements.stmts == NULL) statements.count = 0;
+    for (int i = 0; i < statements.count; i++) {
+      statements.stmts[i] = parser->scratch[base + i];
+    }
+  }
+
+  parser->scratchCount = base;
+  return statements;
 }
 
 
 Statements parse(Parser* parser, const char* source) {
   Scanner scanner;
   initScanner(&scanner, source);
+  parser->chunks = NULL;
+  parser->scratch = NULL;
+  parser->scratchCount = 0;
+  parser->scratchCapacity = 0;
+  parser->outOfMemory = false;
   initParser(parser, &scanner);
 
-  Statements statements = {
-    .capacity = 0,
-    .count = 0,
-    .stmts = NULL
-  };
-
   while (true) {
-    Statement stmt = parseStatement(parser, &scanner);
-    if (stmt.type != STMT_NULL) {
-      append(&statements, stmt);    
+    Statement* stmt = parseStatement(parser, &scanner);
+    if (stmt != NULL) {
+      pushNode(parser, stmt);
     }
 
-    if (parser->current.type == TOKEN_EOF) {
+    if (parser->current.type == TOKEN_EOF || parser->outOfMemory) {
       break;
     }
 
@@ -575,74 +774,26 @@ Statements parse(Parser* parser, const char* source) {
 
   freeScanner(&scanner);
 
+  Statements statements = closeStatements(parser, 0);
+  FREE_ARRAY(void*, parser->scratch, parser->scratchCapacity, MEM_AST);
+  parser->scratch = NULL;
+  parser->scratchCapacity = 0;
+
+  statements.chunks = parser->chunks;
+  parser->chunks = NULL;
   return statements;
 }
 
 
 void freeStatements(Statements* statements) {
-  if (statements->stmts != NULL) {
-    free(statements->stmts);
+  AstChunk* chunk = statements->chunks;
+  while (chunk != NULL) {
+    AstChunk* next = chunk->next;
+    reallocate(chunk, sizeof(AstChunk) + chunk->size, 0, MEM_AST);
+    chunk = next;
   }
 
   statements->stmts = NULL;
-  statements->capacity = 0;
+  statements->chunks = NULL;
   statements->count = 0;
 }
-
-void freePrefix(Prefix* prefix) {
-  if (prefix->expression != NULL) {
-    free(prefix->expression);
-  }
-
-  prefix->expression = NULL;
-}
-
-void freeInfix(Infix* infix) {
-  if (infix->left != NULL) {
-    free(infix->left);
-    infix->left = NULL;
-  }
-
-  if (infix->right != NULL) {
-    free(infix->right);
-    infix->right = NULL;
-  }
-}
-
-void freeGrouped(Group* group) {
-  if (group->expr != NULL) {
-    free(group->expr);
-    group->expr = NULL;
-  }
-}
-
-static void freeCall(CallExpression* call) {
-  for (int i = 0; i < call->argCount; i++) {
-    freeExpression(call->args + i);
-  }
-  FREE_ARRAY(Expression, call->args, call->capacity);
-  call->args = NULL;
-}
-
-void freeExpression(Expression* expr) {
-  switch(expr->type) {
-    case EXPR_PREFIX:
-      freeExpression(expr->data.prefix.expression);
-      freePrefix(&expr->data.prefix);
-      break;
-    case EXPR_INFIX:
-      freeExpression(expr->data.infix.left);
-      freeExpression(expr->data.infix.right);
-      freeInfix(&expr->data.infix);
-      break;
-    case EXPR_GROUP:
-      freeExpression(expr->data.group.expr);
-      freeGrouped(&expr->data.group);
-      break;
-    case EXPR_CALL:
-      freeCall(&expr->data.call);
-      break;
-    default:
-      return;
-  }
-}
@@ -0,0 +1,159 @@
+#include <peephole.h>
+#include <chunk.h>
+#include <memory.h>
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * the superinstruction set
+ * chosen from opcode pair/triple profiles of loop- and call-heavy
+ * scripts (build with PROFILE_OPCODES to collect new ones).
+ * longer sequences come first so they win over their prefixes
+ */
+static const Superinstruction superinstructions[] = {
+  {OP_GET_LOCAL_CONSTANT_ADD, 3, {OP_GET_LOCAL, OP_CONSTANT, OP_ADD}},
+  {OP_GET_LOCAL_CONSTANT_SUBTRACT, 3, {OP_GET_LOCAL, OP_CONSTANT, OP_SUBTRACT}},
+  {OP_LESS_JUMP_IF_FALSE_POP, 3, {OP_LESS, OP_JUMP_IF_FALSE, OP_POP}},
+  {OP_GREATER_JUMP_IF_FALSE_POP, 3, {OP_GREATER, OP_JUMP_IF_FALSE, OP_POP}},
+  {OP_GET_LOCAL_GET_LOCAL, 2, {OP_GET_LOCAL, OP_GET_LOCAL}},
+  {OP_GET_LOCAL_CONSTANT, 2, {OP_GET_LOCAL, OP_CONSTANT}},
+  {OP_ADD_SET_LOCAL, 2, {OP_ADD, OP_SET_LOCAL}},
+  {OP_GET_GLOBAL_CALL, 2, {OP_GET_GLOBAL, OP_CALL}},
+  {OP_GET_LOCAL_CALL, 2, {OP_GET_LOCAL, OP_CALL}},
+  {OP_GET_GLOBAL_TAIL_CALL, 2, {OP_GET_GLOBAL, OP_TAIL_CALL}},
+};
+
+#define SUPERINSTRUCTION_COUNT \
+  (int)(sizeof(superinstructions) / sizeof(superinstructions[0]))
+
+const Superinstruction* findSuperinstruction(uint8_t instruction) {
+  for (int i = 0; i < SUPERINSTRUCTION_COUNT; i++) {
+    if (superinstructions[i].fused == instruction) {
+      return &superinstructions[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * check if a superinstruction's components start at offset
+ * only the first component may be a jump target, otherwise a jump
+ * would land in the middle of the fused instruction
+ */
+static bool matches(const Chunk* chunk, const bool* isTarget,
+    const Superinstruction* super, int offset) {
+  for (int i = 0; i < super->count; i++) {
+    if (offset >= chunk->count) return false;
+    if (i > 0 && isTarget[offset]) return false;
+    if (chunk->code[offset] != super->components[i]) return false;
+
+    offset += instructionSize(chunk->code[offset]);
+  }
+  return true;
+}
+
+static const Superinstruction* match(const Chunk* chunk, const bool* isTarget, int offset) {
+  for (int i = 0; i < SUPERINSTRUCTION_COUNT; i++) {
+    if (matches(chunk, isTarget, &superinstructions[i], offset)) {
+      return &superinstructions[i];
+    }
+  }
+  return NULL;
+}
+
+void fuseSuperinstructions(Chunk* chunk) {
+  int count = chunk->count;
+  if (count == 0) return;
+
+  bool* isTarget = ALLOCATE(bool, count + 1, MEM_CODE);
+
+  // new location of every old instruction start
+  int* relocated = ALLOCATE(int, count + 1, MEM_CODE);
+
+  // fused code never grows, so the old capacity is enough.
+  // targets holds the old jump target of each new jump instruction
+  uint8_t* code = ALLOCATE(uint8_t, chunk->capacity, MEM_CODE);
+  int* targets = ALLOCATE(int, chunk->capacity, MEM_CODE);
+
+  // fusing only ever merges line runs, plus one for a chunk whose
+  // first run doesn't start at 0, so the new table never grows
+  LineTable lines;
+  initLineTable(&lines);
+  lines.runs = ALLOCATE(LineRun, chunk->lines.count + 1, MEM_CODE);
+  lines.capacity = chunk->lines.count + 1;
+
+  if (isTarget == NULL || relocated == NULL || code == NULL || targets == NULL ||
+      lines.runs == NULL) {
+    freeLineTable(&lines);
+    FREE_ARRAY(int, targets, chunk->capacity, MEM_CODE);
+    FREE_ARRAY(uint8_t, code, chunk->capacity, MEM_CODE);
+    FREE_ARRAY(int, relocated, count + 1, MEM_CODE);
+    FREE_ARRAY(bool, isTarget, count + 1, MEM_CODE);
+    return;
+  }
+
+  memset(isTarget, 0, sizeof(bool) * (count + 1));
+  for (int offset = 0; offset < count; offset += instructionSize(chunk->code[offset])) {
+    int target = jumpTarget(chunk, offset);
+    if (target >= 0 && target <= count) isTarget[target] = true;
+  }
+
+  int newCount = 0;
+
+  for (int offset = 0; offset < count;) {
+    relocated[offset] = newCount;
+    targets[newCount] = -1;
+    const Superinstruction* super = match(chunk, isTarget, offset);
+
+    if (super == NULL) {
+      int size = instructionSize(chunk->code[offset]);
+      targets[newCount] = jumpTarget(chunk, offset);
+      memcpy(code + newCount, chunk->code + offset, size);
+      writeLine(&lines, newCount, getLine(&chunk->lines, offset));
+      newCount += size;
+      offset += size;
+      continue;
+    }
+
+    int start = newCount;
+    code[newCount] = super->fused;
+    writeLine(&lines, newCount, getLine(&chunk->lines, offset));
+    newCount++;
+
+    for (int i = 0; i < super->count; i++) {
+      int target = jumpTarget(chunk, offset);
+      if (target >= 0) targets[start] = target;
+
+      int operands = operandSize(chunk->code[offset]);
+      memcpy(code + newCount, chunk->code + offset + 1, operands);
+      if (operands > 0) writeLine(&lines, newCount, getLine(&chunk->lines, offset));
+      newCount += operands;
+      offset += 1 + operands;
+    }
+  }
+  relocated[count] = newCount;
+
+  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity, MEM_CODE);
+  // give back the runs that were merged
+  LineRun* runs = GROW_ARRAY(LineRun, lines.runs, lines.capacity, lines.count, MEM_CODE);
+  if (runs != NULL || lines.count == 0) {
+    lines.runs = runs;
+    lines.capacity = lines.count;
+  }
+
+  freeLineTable(&chunk->lines);
+  chunk->code = code;
+  chunk->lines = lines;
+  chunk->count = newCount;
+
+  // jumps only ever get shorter, so the new distances always fit
+  for (int offset = 0; offset < newCount; offset += instructionSize(code[offset])) {
+    if (targets[offset] >= 0 && targets[offset] <= count) {
+      setJumpTarget(chunk, offset, relocated[targets[offset]]);
+    }
+  }
+
+  FREE_ARRAY(int, targets, chunk->capacity, MEM_CODE);
+  FREE_ARRAY(int, relocated, count + 1, MEM_CODE);
+  FREE_ARRAY(bool, isTarget, count + 1, MEM_CODE);
+}
@@ -0,0 +1,97 @@
+#include <profile.h>
+#include <debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRIPLES_MAX 4096
+#define REPORT_MAX 20
+
+typedef struct {
+  uint32_t key;
+  uint64_t count;
+} SequenceCount;
+
+static uint64_t pairs[UINT8_MAX + 1][UINT8_MAX + 1];
+
+/**
+ * open addressing table keyed by the three opcodes packed into 24 bits
+ */
+static SequenceCount triples[TRIPLES_MAX];
+
+/**
+ * the two previously executed opcodes (-1 if none)
+ */
+static int history[2] = {-1, -1};
+
+static void countTriple(uint32_t key) {
+  uint32_t index = (key * 2654435761u) % TRIPLES_MAX;
+
+  for (int probes = 0; probes < TRIPLES_MAX; probes++) {
+    SequenceCount* entry = &triples[index];
+    if (entry->count == 0 || entry->key == key) {
+      entry->key = key;
+      entry->count++;
+      return;
+    }
+    index = (index + 1) % TRIPLES_MAX;
+  }
+}
+
+void profileInstruction(uint8_t instruction) {
+  if (history[1] != -1) {
+    pairs[history[1]][instruction]++;
+
+    if (history[0] != -1) {
+      countTriple((uint32_t)history[0] << 16 | (uint32_t)history[1] << 8 | instruction);
+    }
+  }
+
+  history[0] = history[1];
+  history[1] = instruction;
+}
+
+void resetProfileHistory() {
+  history[0] = -1;
+  history[1] = -1;
+}
+
+static int compareCounts(const void* a, const void* b) {
+  uint64_t countA = ((const SequenceCount*)a)->count;
+  uint64_t countB = ((const SequenceCount*)b)->count;
+  if (countA == countB) return 0;
+  return countA < countB ? 1 : -1;
+}
+
+void printProfile() {
+  static SequenceCount sorted[(UINT8_MAX + 1) * (UINT8_MAX + 1)];
+  int count = 0;
+
+  for (int a = 0; a <= UINT8_MAX; a++) {
+    for (int b = 0; b <= UINT8_MAX; b++) {
+      if (pairs[a][b] == 0) continue;
+      sorted[count++] = (SequenceCount){.key = (uint32_t)(a << 8 | b), .count = pairs[a][b]};
+    }
+  }
+  qsort(sorted, count, sizeof(SequenceCount), compareCounts);
+
+  fprintf(stderr, "== opcode pairs ==\n");
+  for (int i = 0; i < count && i < REPORT_MAX; i++) {
+    fprintf(stderr, "%12llu  %s %s\n", (unsigned long long)sorted[i].count,
+        opcodeName(sorted[i].key >> 8), opcodeName(sorted[i].key & 0xff));
+  }
+
+  count = 0;
+  for (int i = 0; i < TRIPLES_MAX; i++) {
+    if (triples[i].count != 0) sorted[count++] = triples[i];
+  }
+  qsort(sorted, count, sizeof(SequenceCount), compareCounts);
+
+  fprintf(stderr, "== opcode triples ==\n");
+  for (int i = 0; i < count && i < REPORT_MAX; i++) {
+    fprintf(stderr, "%12llu  %s %s %s\n", (unsigned long long)sorted[i].count,
+        opcodeName(sorted[i].key >> 16), opcodeName((sorted[i].key >> 8) & 0xff),
+        opcodeName(sorted[i].key & 0xff));
+  }
+}
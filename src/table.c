@@ -15,7 +15,7 @@ void initTable(Table *table) {
 }
 
 void freeTable(Table* table) {
-  FREE_ARRAY(Table, table->entries, table->capacity);
+  FREE_ARRAY(Entry, table->entries, table->capacity, MEM_TABLE);
   initTable(table);
 }
 
@@ -28,19 +28,16 @@ void tableAddAll(Table* to, Table* from) {
   }
 }
 
-static inline bool keysEqual(const ObjString* a, const ObjString* b) {
-  return strcmp(a->str, b->str) == 0;
-}
-
-
-
 /**
+ * keys are interned, equal strings are the same object
+ * so a key matches on its pointer alone
+ *
  * find the entry with the given key if it exists
  * if it doesn't, then return address of new entry
  * to use
  */
 static Entry* findEntry(Entry* entries, ObjString* key, int capacity) {
-  uint32_t index = key->hash % capacity;
+  uint32_t index = key->hash & (capacity - 1);
   Entry* tombstone = NULL;
 
   /**
@@ -58,15 +55,15 @@ static Entry* findEntry(Entry* entries, ObjString* key, int capacity) {
         if (tombstone == NULL) tombstone = entry;
       }
     }
-    else if (keysEqual(entry->key, key)) {
+    else if (entry->key == key) {
       return entry;
     }
-    index = (index + 1) % capacity;
+    index = (index + 1) & (capacity - 1);
   }
 }
 
 bool tableDelete(Table* table, ObjString* key) {
-  if (key == NULL) return false;
+  if (key == NULL || table->count == 0) return false;
 
   Entry* entry = findEntry(table->entries, key, table->capacity);
   if (entry->key == NULL) return false;
@@ -90,12 +87,44 @@ bool tableGet(Table* table, ObjString* key, Value* value) {
   return true;
 }
 
+bool tableReplaceKey(Table* table, ObjString* key, ObjString* other) {
+  if (table->count == 0) return false;
+
+  Entry* entry = findEntry(table->entries, key, table->capacity);
+  if (entry->key == NULL) return false;
+
+  entry->key = other;
+  return true;
+}
+
+ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
+  if (table->count == 0) return NULL;
+
+  uint32_t index = hash & (table->capacity - 1);
+  while (true) {
+    Entry* entry = &table->entries[index];
+    if (entry->key == NULL) {
+      // stop at an empty entry, keep probing past tombstones
+      if (IS_NULL(entry->value)) return NULL;
+    } else if (entry->key->length == length && entry->key->hash == hash &&
+        memcmp(entry->key->str, chars, length) == 0) {
+      return entry->key;
+    }
+    index = (index + 1) & (table->capacity - 1);
+  }
+}
 
 /**
  * create an array of entries will null values
+ * returns false, leaving the table as it was, if there's no memory for it
  */
-static void adjustCapacity(Table* table, int oldCapacity) {
-  Entry* entries = ALLOCATE(Entry, table->capacity);
+static bool adjustCapacity(Table* table, int oldCapacity) {
+  Entry* entries = ALLOCATE(Entry, table->capacity, MEM_TABLE);
+  if (entries == NULL) {
+    table->capacity = oldCapacity;
+    return false;
+  }
+
   for (int i = 0; i < table->capacity; i++) {
     entries[i].key = NULL;
     entries[i].value = NULL_VAL;
@@ -122,10 +151,11 @@ static void adjustCapacity(Table* table, int oldCapacity) {
       table->count++;
     }
 
-    FREE_ARRAY(Entry, table->entries, 0);
+    FREE_ARRAY(Entry, table->entries, oldCapacity, MEM_TABLE);
   }
   
   table->entries = entries;
+  return true;
 }
 
 
@@ -133,7 +163,7 @@ bool tableSet(Table* table, ObjString* key, Value value) {
   if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
     int oldCapacity = table->capacity;
     table->capacity = GROW_CAPACITY(table->capacity);
-    adjustCapacity(table, oldCapacity);
+    if (!adjustCapacity(table, oldCapacity)) return false;
   }
 
   Entry* entry = findEntry(table->entries, key, table->capacity);
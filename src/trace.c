@@ -0,0 +1,934 @@
+#ifdef JIT
+
+#include <trace.h>
+#include <chunk.h>
+#include <object.h>
+#include <peephole.h>
+#include <memory.h>
+#include <x64.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * the deepest operand stack a trace follows, the most stack entries its
+ * side exits may write out between them, and the most locals and globals
+ * an iteration may touch
+ */
+#define TRACE_STACK_MAX 64
+#define TRACE_ENTRIES_MAX 1024
+#define TRACE_GLOBALS_MAX 32
+#define TRACE_STORES_MAX 4
+
+#define NO_REF -1
+
+/**
+ * a slot the operand stack has grown over since it was last stored
+ */
+#define CLOBBERED -2
+
+/**
+ * registers kept for the whole trace (all callee-saved)
+ */
+#define VM_REG RBX
+#define BASE_REG R12 // frame->basePointer
+#define GLOBALS_REG R13 // vm->globals.data
+#define TOP_REG R14 // vm->stackTop when the trace was entered
+#define QNAN_REG R15
+
+#define OFFSET_STACK_TOP ((int32_t)offsetof(VM, stackTop))
+#define OFFSET_GLOBALS ((int32_t)(offsetof(VM, globals) + offsetof(ValueArray, data)))
+
+typedef enum {
+  IR_CONST,
+
+  /**
+   * loads guard that they read a number, and exit to the
+   * instruction that did the load when they don't
+   */
+  IR_LOAD_SLOT,
+  IR_LOAD_GLOBAL,
+
+  IR_ADD,
+  IR_SUBTRACT,
+  IR_MULTIPLY,
+  IR_DIVIDE,
+  IR_NEGATE,
+
+  /**
+   * comparisons make no code of their own, they are compiled as
+   * part of the guard that tests them
+   */
+  IR_LESS,
+  IR_GREATER,
+  IR_EQUAL,
+
+  IR_STORE_SLOT,
+  IR_STORE_GLOBAL,
+
+  /**
+   * exit unless the comparison came out as it did while recording
+   */
+  IR_GUARD_TRUE,
+  IR_GUARD_FALSE
+} IrOp;
+
+/**
+ * refs are indices of IR instructions, and every value-producing
+ * instruction other than a constant gets a spill slot of its own
+ */
+typedef struct {
+  IrOp op;
+
+  /**
+   * operand refs, or for loads and stores the slot in a (and the
+   * stored ref in b)
+   */
+  int a;
+  int b;
+
+  /**
+   * the value the instruction had while recording
+   */
+  Value value;
+
+  /**
+   * the side exit of loads and guards
+   */
+  int exit;
+
+  /**
+   * comparisons that a guard already pinned down
+   */
+  bool guarded;
+} IrIns;
+
+/**
+ * an operand stack entry: the ref that computes it, or NO_REF for a
+ * value that is the same on every iteration
+ */
+typedef struct {
+  int ref;
+  Value value;
+} StackEntry;
+
+/**
+ * where a side exit resumes and the operand stack it writes out
+ * (entries first to first + count - 1)
+ */
+typedef struct {
+  int offset;
+  int first;
+  int count;
+} Snapshot;
+
+typedef struct {
+  bool global;
+  int slot;
+  StackEntry entry;
+} PendingStore;
+
+/**
+ * the jump of an instruction being recorded
+ */
+typedef struct {
+  int target;
+  int end;
+
+  /**
+   * POPs that follow the jump in its superinstruction, -1 when
+   * something else follows
+   */
+  int pops;
+} Jump;
+
+typedef struct {
+  VM* vm;
+  CallFrame* frame;
+  Chunk* chunk;
+
+  /**
+   * the real stack top, where the operand stack followed here begins
+   */
+  Value* stackBase;
+
+  /**
+   * the frame slot at stackBase. locals from here on are declared in
+   * the loop body and live on the operand stack while in scope
+   */
+  int baseSlot;
+
+  IrIns ir[TRACE_IR_MAX];
+  int irCount;
+
+  StackEntry stack[TRACE_STACK_MAX];
+  int stackCount;
+
+  Snapshot snapshots[TRACE_IR_MAX];
+  int snapshotCount;
+  StackEntry entries[TRACE_ENTRIES_MAX];
+  int entryCount;
+
+  /**
+   * the ref each local slot and global holds so far in the
+   * iteration, so it is only loaded (and guarded) once
+   */
+  int slotRefs[UINT8_MAX + 1];
+  int globalSlots[TRACE_GLOBALS_MAX];
+  int globalRefs[TRACE_GLOBALS_MAX];
+  int globalCount;
+
+  /**
+   * the instruction being recorded, the stack it started with, and
+   * its stores. they are only done once the whole instruction has
+   * been recorded, so an abort can leave the interpreter before it
+   */
+  int offset;
+  StackEntry before[TRACE_STACK_MAX];
+  int beforeCount;
+  PendingStore stores[TRACE_STORES_MAX];
+  int storeCount;
+} Recorder;
+
+/*
+ * the loop table
+ */
+
+static LoopTrace* findLoopTrace(ObjFunction* func, int backEdge) {
+  for (int i = 0; i < func->loopTraceCount; i++) {
+    if (func->loopTraces[i].backEdge == backEdge) return &func->loopTraces[i];
+  }
+
+  if (func->loopTraceCount == func->loopTraceCapacity) {
+    int capacity = GROW_CAPACITY(func->loopTraceCapacity);
+    LoopTrace* traces = GROW_ARRAY(LoopTrace, func->loopTraces,
+        func->loopTraceCapacity, capacity, MEM_JIT);
+    if (traces == NULL) return NULL;
+    func->loopTraces = traces;
+    func->loopTraceCapacity = capacity;
+  }
+
+  LoopTrace* trace = &func->loopTraces[func->loopTraceCount++];
+  trace->backEdge = backEdge;
+  trace->attempts = 0;
+  trace->blacklisted = false;
+  trace->code = NULL;
+  trace->size = 0;
+  return trace;
+}
+
+void freeLoopTraces(ObjFunction* func) {
+  for (int i = 0; i < func->loopTraceCount; i++) {
+    freeCode(func->loopTraces[i].code, func->loopTraces[i].size);
+  }
+  FREE_ARRAY(LoopTrace, func->loopTraces, func->loopTraceCapacity, MEM_JIT);
+  func->loopTraces = NULL;
+  func->loopTraceCount = 0;
+  func->loopTraceCapacity = 0;
+}
+
+/*
+ * recording
+ */
+
+static int emitIr(Recorder* r, IrOp op, int a, int b, Value value) {
+  if (r->irCount == TRACE_IR_MAX) return NO_REF;
+
+  r->ir[r->irCount] = (IrIns){op, a, b, value, -1, false};
+  return r->irCount++;
+}
+
+static bool isComparison(IrOp op) {
+  return op == IR_LESS || op == IR_GREATER || op == IR_EQUAL;
+}
+
+/**
+ * write down the stack a side exit leaves for the interpreter
+ * returns the snapshot, or -1 if it can't be written out
+ */
+static int takeSnapshot(Recorder* r, int offset, const StackEntry* stack, int count) {
+  if (r->snapshotCount == TRACE_IR_MAX || r->entryCount + count > TRACE_ENTRIES_MAX) {
+    return -1;
+  }
+
+  Snapshot* snapshot = &r->snapshots[r->snapshotCount];
+  snapshot->offset = offset;
+  snapshot->first = r->entryCount;
+  snapshot->count = count;
+
+  for (int i = 0; i < count; i++) {
+    StackEntry entry = stack[i];
+    if (entry.ref != NO_REF) {
+      const IrIns* ins = &r->ir[entry.ref];
+      // a comparison only has a known value once a guard pinned it down
+      if (isComparison(ins->op) && !ins->guarded) return -1;
+      if (ins->op == IR_CONST || isComparison(ins->op)) entry.ref = NO_REF;
+    }
+    r->entries[r->entryCount++] = entry;
+  }
+  return r->snapshotCount++;
+}
+
+static bool pushEntry(Recorder* r, int ref, Value value) {
+  if (r->stackCount == TRACE_STACK_MAX) return false;
+
+  int slot = r->baseSlot + r->stackCount;
+  if (slot <= UINT8_MAX) r->slotRefs[slot] = CLOBBERED;
+  r->stack[r->stackCount++] = (StackEntry){ref, value};
+  return true;
+}
+
+static bool popEntry(Recorder* r, StackEntry* entry) {
+  if (r->stackCount == 0) return false;
+
+  *entry = r->stack[--r->stackCount];
+  return true;
+}
+
+static bool popNumber(Recorder* r, StackEntry* entry) {
+  return popEntry(r, entry) && IS_NUM(entry->value);
+}
+
+/**
+ * the operand stack entry holding a slot, or NULL if it is in memory
+ */
+static StackEntry* stackSlot(Recorder* r, int slot) {
+  int index = slot - r->baseSlot;
+  return index >= 0 && index < r->stackCount ? &r->stack[index] : NULL;
+}
+
+static bool constant(Recorder* r, Value value, StackEntry* entry) {
+  if (!IS_NUM(value)) return false;
+
+  entry->ref = emitIr(r, IR_CONST, 0, 0, value);
+  entry->value = value;
+  return entry->ref != NO_REF;
+}
+
+/**
+ * a number load, guarded against anything else. a failed guard
+ * exits to the instruction doing the load
+ */
+static bool guardedLoad(Recorder* r, IrOp op, int slot, Value value, StackEntry* entry) {
+  if (!IS_NUM(value)) return false;
+
+  int exit = takeSnapshot(r, r->offset, r->before, r->beforeCount);
+  if (exit == -1) return false;
+
+  entry->ref = emitIr(r, op, slot, 0, value);
+  entry->value = value;
+  if (entry->ref == NO_REF) return false;
+
+  r->ir[entry->ref].exit = exit;
+  return true;
+}
+
+static bool loadSlot(Recorder* r, int slot, StackEntry* entry) {
+  StackEntry* onStack = stackSlot(r, slot);
+  if (onStack != NULL) {
+    *entry = *onStack;
+    return true;
+  }
+
+  for (int i = 0; i < r->storeCount; i++) {
+    if (!r->stores[i].global && r->stores[i].slot == slot) {
+      *entry = r->stores[i].entry;
+      return true;
+    }
+  }
+
+  Value value = r->frame->basePointer[slot];
+  if (r->slotRefs[slot] == CLOBBERED) return false;
+  if (r->slotRefs[slot] != NO_REF) {
+    *entry = (StackEntry){r->slotRefs[slot], value};
+    return true;
+  }
+
+  if (!guardedLoad(r, IR_LOAD_SLOT, slot, value, entry)) return false;
+  r->slotRefs[slot] = entry->ref;
+  return true;
+}
+
+static int findGlobal(Recorder* r, int slot) {
+  for (int i = 0; i < r->globalCount; i++) {
+    if (r->globalSlots[i] == slot) return i;
+  }
+  return -1;
+}
+
+static bool loadGlobal(Recorder* r, int slot, StackEntry* entry) {
+  for (int i = 0; i < r->storeCount; i++) {
+    if (r->stores[i].global && r->stores[i].slot == slot) {
+      *entry = r->stores[i].entry;
+      return true;
+    }
+  }
+
+  Value value = r->vm->globals.data[slot];
+  int index = findGlobal(r, slot);
+  if (index != -1) {
+    *entry = (StackEntry){r->globalRefs[index], value};
+    return true;
+  }
+
+  if (r->globalCount == TRACE_GLOBALS_MAX) return false;
+  if (!guardedLoad(r, IR_LOAD_GLOBAL, slot, value, entry)) return false;
+
+  r->globalSlots[r->globalCount] = slot;
+  r->globalRefs[r->globalCount++] = entry->ref;
+  return true;
+}
+
+static bool loadRK(Recorder* r, uint8_t operand, StackEntry* entry) {
+  if (IS_RK_CONSTANT(operand)) {
+    return constant(r, r->chunk->constants.data[operand & RK_MAX], entry);
+  }
+  return loadSlot(r, operand, entry);
+}
+
+static bool store(Recorder* r, bool global, int slot, StackEntry entry) {
+  if (!IS_NUM(entry.value) || r->storeCount == TRACE_STORES_MAX) return false;
+
+  r->stores[r->storeCount++] = (PendingStore){global, slot, entry};
+  return true;
+}
+
+static bool storeSlot(Recorder* r, int slot, StackEntry entry) {
+  StackEntry* onStack = stackSlot(r, slot);
+  if (onStack != NULL) {
+    *onStack = entry;
+    return true;
+  }
+  return store(r, false, slot, entry);
+}
+
+/**
+ * number arithmetic and comparisons, folded when both sides are constants
+ */
+static bool binary(Recorder* r, IrOp op, StackEntry a, StackEntry b, StackEntry* result) {
+  if (!IS_NUM(a.value) || !IS_NUM(b.value)) return false;
+
+  double x = AS_NUMBER(a.value);
+  double y = AS_NUMBER(b.value);
+  Value value;
+  switch(op) {
+    case IR_ADD: value = NUMBER_VAL(x + y); break;
+    case IR_SUBTRACT: value = NUMBER_VAL(x - y); break;
+    case IR_MULTIPLY: value = NUMBER_VAL(x * y); break;
+    case IR_DIVIDE: value = NUMBER_VAL(x / y); break;
+    case IR_LESS: value = BOOL_VAL(x < y); break;
+    case IR_GREATER: value = BOOL_VAL(x > y); break;
+    default: value = BOOL_VAL(x == y); break;
+  }
+
+  result->value = value;
+  if (r->ir[a.ref].op == IR_CONST && r->ir[b.ref].op == IR_CONST) {
+    if (isComparison(op)) {
+      result->ref = NO_REF;
+      return true;
+    }
+    return constant(r, value, result);
+  }
+
+  result->ref = emitIr(r, op, a.ref, b.ref, value);
+  return result->ref != NO_REF;
+}
+
+static bool stackBinary(Recorder* r, IrOp op) {
+  StackEntry a;
+  StackEntry b;
+  StackEntry result;
+  return popNumber(r, &b) && popNumber(r, &a) && binary(r, op, a, b, &result) &&
+    pushEntry(r, result.ref, result.value);
+}
+
+/**
+ * a branch on condition went one way while recording, guard that it
+ * keeps doing so. the side exit takes the other way, with the condition
+ * (when it is on the stack) written out as it came out there
+ */
+static bool guardBranch(Recorder* r, StackEntry condition, bool onStack, bool taken, const Jump* jump) {
+  // constants and numbers (always truthy) go the same way every time
+  if (condition.ref == NO_REF) return true;
+
+  IrIns* comparison = &r->ir[condition.ref];
+  if (!isComparison(comparison->op) || comparison->guarded) return true;
+
+  // the instruction's stores have not been done when the guard fails
+  if (r->storeCount > 0) return false;
+
+  StackEntry stack[TRACE_STACK_MAX];
+  int count = r->stackCount;
+  memcpy(stack, r->stack, sizeof(StackEntry) * count);
+  if (onStack) {
+    stack[count - 1] = (StackEntry){NO_REF, BOOL_VAL(!AS_BOOL(condition.value))};
+  }
+
+  int offset = jump->target;
+  if (taken) {
+    // the other way falls through the rest of the superinstruction
+    if (jump->pops < 0 || jump->pops > count) return false;
+    count -= jump->pops;
+    offset = jump->end;
+  }
+
+  int exit = takeSnapshot(r, offset, stack, count);
+  if (exit == -1) return false;
+
+  IrOp op = AS_BOOL(condition.value) ? IR_GUARD_TRUE : IR_GUARD_FALSE;
+  int guard = emitIr(r, op, condition.ref, 0, condition.value);
+  if (guard == NO_REF) return false;
+
+  r->ir[guard].exit = exit;
+  comparison->guarded = true;
+  return true;
+}
+
+static bool stackBranch(Recorder* r, bool ifFalse, const Jump* jump, bool* taken) {
+  if (r->stackCount == 0) return false;
+
+  StackEntry condition = r->stack[r->stackCount - 1];
+  if (!IS_BOOL(condition.value) && !IS_NUM(condition.value) &&
+      !IS_NULL(condition.value)) {
+    return false;
+  }
+
+  bool falsey = IS_NULL(condition.value) ||
+    (IS_BOOL(condition.value) && !AS_BOOL(condition.value));
+  *taken = falsey == ifFalse;
+  return guardBranch(r, condition, true, *taken, jump);
+}
+
+static IrOp arithmeticOp(uint8_t instruction) {
+  switch(instruction) {
+    case OP_ADD: case OP_ADD_NUM: case OP_ADD_R: return IR_ADD;
+    case OP_SUBTRACT: case OP_SUBTRACT_NUM: case OP_SUBTRACT_R: return IR_SUBTRACT;
+    case OP_MULTIPLY: case OP_MULTIPLY_NUM: case OP_MULTIPLY_R: return IR_MULTIPLY;
+    case OP_DIVIDE: case OP_DIVIDE_NUM: case OP_DIVIDE_R: return IR_DIVIDE;
+    case OP_LESS: case OP_LESS_NUM: case OP_JUMP_IF_NOT_LESS_R: return IR_LESS;
+    case OP_EQUAL: return IR_EQUAL;
+    default: return IR_GREATER;
+  }
+}
+
+/**
+ * record one plain instruction (or superinstruction component),
+ * operands points just past its opcode
+ * returns false to abort the trace
+ */
+static bool recordOp(Recorder* r, uint8_t instruction, const uint8_t* operands,
+    const Jump* jump, bool* taken) {
+  StackEntry entry;
+  *taken = false;
+
+  switch(instruction) {
+    case OP_CONSTANT:
+      return constant(r, r->chunk->constants.data[operands[0]], &entry) &&
+        pushEntry(r, entry.ref, entry.value);
+    case OP_CONSTANT_LONG: {
+      uint32_t index = (operands[0] << 16) | (operands[1] << 8) | operands[2];
+      return constant(r, r->chunk->constants.data[index], &entry) &&
+        pushEntry(r, entry.ref, entry.value);
+    }
+    case OP_NULL:
+      return pushEntry(r, NO_REF, NULL_VAL);
+    case OP_TRUE:
+      return pushEntry(r, NO_REF, TRUE_VAL);
+    case OP_FALSE:
+      return pushEntry(r, NO_REF, FALSE_VAL);
+    case OP_POP:
+      return popEntry(r, &entry);
+    case OP_GET_LOCAL:
+      return loadSlot(r, operands[0], &entry) && pushEntry(r, entry.ref, entry.value);
+    case OP_SET_LOCAL:
+      return popEntry(r, &entry) && storeSlot(r, operands[0], entry);
+    case OP_GET_GLOBAL:
+      return loadGlobal(r, (operands[0] << 8) | operands[1], &entry) &&
+        pushEntry(r, entry.ref, entry.value);
+    case OP_SET_GLOBAL:
+    case OP_DEFINE_GLOBAL: {
+      int slot = (operands[0] << 8) | operands[1];
+      if (instruction == OP_SET_GLOBAL && IS_UNDEFINED(r->vm->globals.data[slot])) {
+        return false;
+      }
+      return popNumber(r, &entry) && store(r, true, slot, entry);
+    }
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_LESS:
+    case OP_GREATER:
+    case OP_ADD_NUM:
+    case OP_SUBTRACT_NUM:
+    case OP_MULTIPLY_NUM:
+    case OP_DIVIDE_NUM:
+    case OP_LESS_NUM:
+    case OP_GREATER_NUM:
+    case OP_EQUAL:
+      return stackBinary(r, arithmeticOp(instruction));
+    case OP_NEGATE: {
+      if (!popNumber(r, &entry)) return false;
+      Value value = NUMBER_VAL(-AS_NUMBER(entry.value));
+      if (r->ir[entry.ref].op == IR_CONST) {
+        return constant(r, value, &entry) && pushEntry(r, entry.ref, value);
+      }
+      int ref = emitIr(r, IR_NEGATE, entry.ref, 0, value);
+      return ref != NO_REF && pushEntry(r, ref, value);
+    }
+    case OP_ADD_R:
+    case OP_SUBTRACT_R:
+    case OP_MULTIPLY_R:
+    case OP_DIVIDE_R: {
+      StackEntry a;
+      StackEntry b;
+      return loadRK(r, operands[1], &a) && loadRK(r, operands[2], &b) &&
+        binary(r, arithmeticOp(instruction), a, b, &entry) &&
+        storeSlot(r, operands[0], entry);
+    }
+    case OP_JUMP_IF_NOT_LESS_R:
+    case OP_JUMP_IF_NOT_GREATER_R: {
+      StackEntry a;
+      StackEntry b;
+      if (!loadRK(r, operands[0], &a) || !loadRK(r, operands[1], &b) ||
+          !binary(r, arithmeticOp(instruction), a, b, &entry)) {
+        return false;
+      }
+      *taken = !AS_BOOL(entry.value);
+      return guardBranch(r, entry, false, *taken, jump);
+    }
+    case OP_JUMP:
+    case OP_JUMP_LONG:
+      *taken = true;
+      return true;
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_FALSE_LONG:
+      return stackBranch(r, true, jump, taken);
+    case OP_JUMP_IF_TRUE:
+    case OP_JUMP_IF_TRUE_LONG:
+      return stackBranch(r, false, jump, taken);
+    default:
+      return false;
+  }
+}
+
+/**
+ * record the instruction at r->offset and do its stores
+ * returns the offset of the next instruction, or -1 to abort
+ */
+static int recordInstruction(Recorder* r) {
+  int offset = r->offset;
+  uint8_t instruction = r->chunk->code[offset];
+  Jump jump = {jumpTarget(r->chunk, offset), offset + instructionSize(instruction), 0};
+
+  memcpy(r->before, r->stack, sizeof(StackEntry) * r->stackCount);
+  r->beforeCount = r->stackCount;
+  r->storeCount = 0;
+
+  const Superinstruction* super = findSuperinstruction(instruction);
+  OpCode plain = (OpCode)instruction;
+  const OpCode* components = super == NULL ? &plain : super->components;
+  int count = super == NULL ? 1 : super->count;
+  const uint8_t* operands = r->chunk->code + offset + 1;
+  bool taken = false;
+
+  for (int i = 0; i < count && !taken; i++) {
+    jump.pops = 0;
+    for (int j = i + 1; j < count; j++) {
+      jump.pops = components[j] == OP_POP && jump.pops >= 0 ? jump.pops + 1 : -1;
+    }
+
+    if (!recordOp(r, components[i], operands, &jump, &taken)) return -1;
+    operands += operandSize(components[i]);
+  }
+
+  // the stores can't fail once the first one is done
+  if (r->irCount + r->storeCount > TRACE_IR_MAX ||
+      r->globalCount + r->storeCount > TRACE_GLOBALS_MAX) {
+    return -1;
+  }
+
+  for (int i = 0; i < r->storeCount; i++) {
+    PendingStore* pending = &r->stores[i];
+    IrOp op = pending->global ? IR_STORE_GLOBAL : IR_STORE_SLOT;
+    emitIr(r, op, pending->slot, pending->entry.ref, pending->entry.value);
+
+    if (pending->global) {
+      int index = findGlobal(r, pending->slot);
+      if (index == -1) {
+        index = r->globalCount++;
+        r->globalSlots[index] = pending->slot;
+      }
+      r->globalRefs[index] = pending->entry.ref;
+      r->vm->globals.data[pending->slot] = pending->entry.value;
+    } else {
+      r->slotRefs[pending->slot] = pending->entry.ref;
+      r->frame->basePointer[pending->slot] = pending->entry.value;
+    }
+  }
+  r->storeCount = 0;
+
+  return taken ? jump.target : jump.end;
+}
+
+/**
+ * run one iteration of the loop from its header, recording it
+ * returns true with frame->ip back at the header when the iteration
+ * reached the back-edge. otherwise the operand stack of the instruction
+ * that could not be recorded is written out and frame->ip points at it
+ */
+static bool recordIteration(Recorder* r, int header, int backEdge) {
+  r->offset = header;
+  while (r->offset != backEdge) {
+    int next = -1;
+    if (r->offset >= header && r->offset < backEdge) {
+      next = recordInstruction(r);
+    } else {
+      // the iteration left the loop
+      memcpy(r->before, r->stack, sizeof(StackEntry) * r->stackCount);
+      r->beforeCount = r->stackCount;
+    }
+
+    if (next == -1) {
+      for (int i = 0; i < r->beforeCount; i++) {
+        r->stackBase[i] = r->before[i].value;
+      }
+      r->vm->stackTop = r->stackBase + r->beforeCount;
+      r->frame->ip = r->chunk->code + r->offset;
+      return false;
+    }
+    r->offset = next;
+  }
+
+  r->frame->ip = r->chunk->code + header;
+  return r->stackCount == 0;
+}
+
+/*
+ * code generation
+ */
+
+static int32_t spill(int ref) {
+  return ref * (int32_t)sizeof(Value);
+}
+
+static void loadValue(Assembler* as, const Recorder* r, int reg, int ref) {
+  if (r->ir[ref].op == IR_CONST) {
+    emitMovImm64(as, reg, r->ir[ref].value);
+  } else {
+    emitLoad(as, reg, RSP, spill(ref));
+  }
+}
+
+static void loadNumber(Assembler* as, const Recorder* r, int xmm, int ref) {
+  if (r->ir[ref].op == IR_CONST) {
+    emitMovImm64(as, RAX, r->ir[ref].value);
+    emitMovqToXmm(as, xmm, RAX);
+  } else {
+    emitSseMem(as, SSE_LOAD, xmm, RSP, spill(ref));
+  }
+}
+
+static void emitGuardedLoad(Assembler* as, int base, int slot, int ref, int exitLabel) {
+  emitLoad(as, RAX, base, slot * (int32_t)sizeof(Value));
+  emitMov(as, RDX, RAX);
+  emitRegReg(as, 0x21, QNAN_REG, RDX); // and rdx, r15
+  emitRegReg(as, 0x39, QNAN_REG, RDX); // cmp rdx, r15
+  jumpTo(as, CC_E, exitLabel);
+  emitStore(as, RSP, spill(ref), RAX);
+}
+
+static void emitIrIns(Assembler* as, const Recorder* r, int ref, int firstExit) {
+  const IrIns* ins = &r->ir[ref];
+  switch(ins->op) {
+    case IR_CONST:
+    case IR_LESS:
+    case IR_GREATER:
+    case IR_EQUAL:
+      break;
+    case IR_LOAD_SLOT:
+      emitGuardedLoad(as, BASE_REG, ins->a, ref, firstExit + ins->exit);
+      break;
+    case IR_LOAD_GLOBAL:
+      emitGuardedLoad(as, GLOBALS_REG, ins->a, ref, firstExit + ins->exit);
+      break;
+    case IR_ADD:
+    case IR_SUBTRACT:
+    case IR_MULTIPLY:
+    case IR_DIVIDE: {
+      uint8_t sse = ins->op == IR_ADD ? SSE_ADD : ins->op == IR_SUBTRACT ? SSE_SUBTRACT :
+        ins->op == IR_MULTIPLY ? SSE_MULTIPLY : SSE_DIVIDE;
+      loadNumber(as, r, 0, ins->a);
+      loadNumber(as, r, 1, ins->b);
+      emitSseRegReg(as, sse, 0, 1);
+      emitSseMem(as, SSE_STORE, 0, RSP, spill(ref));
+      break;
+    }
+    case IR_NEGATE:
+      loadValue(as, r, RAX, ins->a);
+      emitMovImm64(as, RCX, SIGN_BIT);
+      emitRegReg(as, 0x31, RCX, RAX); // xor rax, rcx
+      emitStore(as, RSP, spill(ref), RAX);
+      break;
+    case IR_STORE_SLOT:
+      loadValue(as, r, RAX, ins->b);
+      emitStore(as, BASE_REG, ins->a * (int32_t)sizeof(Value), RAX);
+      break;
+    case IR_STORE_GLOBAL:
+      loadValue(as, r, RAX, ins->b);
+      emitStore(as, GLOBALS_REG, ins->a * (int32_t)sizeof(Value), RAX);
+      break;
+    case IR_GUARD_TRUE:
+    case IR_GUARD_FALSE: {
+      // a < b is b > a, and ucomisd sets "above" for the greater operand first
+      const IrIns* comparison = &r->ir[ins->a];
+      bool less = comparison->op == IR_LESS;
+      int exit = firstExit + ins->exit;
+      loadNumber(as, r, 0, less ? comparison->b : comparison->a);
+      loadNumber(as, r, 1, less ? comparison->a : comparison->b);
+      emitCompareDoubles(as, 0, 1);
+
+      if (comparison->op != IR_EQUAL) {
+        jumpTo(as, ins->op == IR_GUARD_TRUE ? CC_BE : CC_A, exit);
+      } else if (ins->op == IR_GUARD_TRUE) {
+        // equal is "equal" and not unordered
+        jumpTo(as, CC_NE, exit);
+        jumpTo(as, CC_P, exit);
+      } else {
+        int unordered = emitJcc(as, CC_P);
+        jumpTo(as, CC_E, exit);
+        patchHere(as, unordered);
+      }
+      break;
+    }
+  }
+}
+
+/**
+ * the trace loops over its IR until a guard fails, then writes out the
+ * exit's operand stack above the stack top it was entered with and
+ * returns the offset to resume at. values live in spill slots on the
+ * C stack, one per ref
+ */
+static bool compileTrace(const Recorder* r, LoopTrace* trace) {
+  Assembler as;
+  initAssembler(&as, 0);
+  int32_t frameSize = (spill(r->irCount) + 15) & ~15;
+
+  // five pushes and a multiple of 16 keep the stack aligned
+  emitPush(&as, RBX);
+  emitPush(&as, R12);
+  emitPush(&as, R13);
+  emitPush(&as, R14);
+  emitPush(&as, R15);
+  emitAluImm(&as, 5, RSP, frameSize);
+  emitMov(&as, VM_REG, RDI);
+  emitMov(&as, BASE_REG, RSI);
+  emitMov(&as, TOP_REG, RDX);
+  emitLoad(&as, GLOBALS_REG, VM_REG, OFFSET_GLOBALS);
+  emitMovImm64(&as, QNAN_REG, QNAN);
+
+  int firstExit = as.labelCount;
+  for (int i = 0; i < r->snapshotCount; i++) {
+    newLabel(&as);
+  }
+  int loop = newLabel(&as);
+  int epilogue = newLabel(&as);
+
+  placeLabel(&as, loop);
+  for (int ref = 0; ref < r->irCount; ref++) {
+    emitIrIns(&as, r, ref, firstExit);
+  }
+  jumpAlwaysTo(&as, loop);
+
+  for (int i = 0; i < r->snapshotCount; i++) {
+    const Snapshot* snapshot = &r->snapshots[i];
+    placeLabel(&as, firstExit + i);
+    for (int j = 0; j < snapshot->count; j++) {
+      const StackEntry* entry = &r->entries[snapshot->first + j];
+      if (entry->ref == NO_REF) {
+        emitMovImm64(&as, RAX, entry->value);
+      } else {
+        loadValue(&as, r, RAX, entry->ref);
+      }
+      emitStore(&as, TOP_REG, j * (int32_t)sizeof(Value), RAX);
+    }
+    emitLea(&as, RAX, TOP_REG, snapshot->count * (int32_t)sizeof(Value));
+    emitStore(&as, VM_REG, OFFSET_STACK_TOP, RAX);
+    emitMovImm32(&as, RAX, snapshot->offset);
+    jumpAlwaysTo(&as, epilogue);
+  }
+
+  placeLabel(&as, epilogue);
+  emitAluImm(&as, 0, RSP, frameSize);
+  emitPop(&as, R15);
+  emitPop(&as, R14);
+  emitPop(&as, R13);
+  emitPop(&as, R12);
+  emitPop(&as, RBX);
+  emitByte(&as, 0xc3); // ret
+
+  void* code = resolveFixups(&as) ? finishCode(&as) : NULL;
+  if (code != NULL) {
+    trace->code = code;
+    trace->size = as.count;
+  }
+  freeAssembler(&as);
+  return code != NULL;
+}
+
+/**
+ * record and compile a trace for the loop, the frame is left
+ * where interpreting resumes whether or not that worked
+ */
+static bool recordTrace(VM* vm, CallFrame* frame, LoopTrace* trace) {
+  // without memory for the recorder the loop stays interpreted for now
+  Recorder* r = ALLOCATE(Recorder, 1, MEM_JIT);
+  if (r == NULL) return false;
+  r->vm = vm;
+  r->frame = frame;
+  r->chunk = &frame->func->chunk;
+  r->stackBase = vm->stackTop;
+  r->baseSlot = (int)(vm->stackTop - frame->basePointer);
+  r->irCount = 0;
+  r->stackCount = 0;
+  r->snapshotCount = 0;
+  r->entryCount = 0;
+  r->globalCount = 0;
+  r->storeCount = 0;
+  for (int i = 0; i <= UINT8_MAX; i++) {
+    r->slotRefs[i] = NO_REF;
+  }
+
+  int header = jumpTarget(r->chunk, trace->backEdge);
+  bool compiled = recordIteration(r, header, trace->backEdge) && compileTrace(r, trace);
+  FREE(Recorder, r, MEM_JIT);
+
+  if (!compiled && ++trace->attempts == TRACE_ATTEMPTS_MAX) {
+    trace->blacklisted = true;
+  }
+  return compiled;
+}
+
+void traceLoop(VM* vm, CallFrame* frame, int backEdge) {
+  ObjFunction* func = frame->func;
+  uint16_t* counter = &vm->hotCounts[HOTCOUNT_INDEX(func->chunk.code + backEdge)];
+  *counter = TRACE_THRESHOLD;
+  if (!vm->jitEnabled) return;
+
+  LoopTrace* trace = findLoopTrace(func, backEdge);
+  if (trace == NULL) return;
+  if (trace->code == NULL) {
+    if (trace->blacklisted || !recordTrace(vm, frame, trace)) {
+      if (trace->blacklisted) *counter = TRACE_BLACKLIST_COUNT;
+      return;
+    }
+
+    uint8_t* loop = func->chunk.code + backEdge;
+    *loop = *loop == OP_LOOP ? OP_LOOP_TRACE : OP_LOOP_LONG_TRACE;
+  }
+
+  int offset = ((TraceCode)trace->code)(vm, frame->basePointer, vm->stackTop);
+  frame->ip = func->chunk.code + offset;
+}
+
+#endif
@@ -2,31 +2,66 @@
 #include <memory.h>
 #include <stdio.h>
 #include <object.h>
+#include <string.h>
 
 
-void initValueArray(ValueArray* array) {
+void initValueArray(ValueArray* array, MemoryKind kind) {
   array->data = NULL;
   array->capacity = 0;
   array->count = 0;
+  array->kind = kind;
 }
 
-void writeValueArray(ValueArray* array, Value val) {
+bool writeValueArray(ValueArray* array, Value val) {
   if (array->capacity < array->count + 1) {
-    int oldCapacity = array->capacity;
-    array->capacity = GROW_CAPACITY(oldCapacity);
-    array->data = GROW_ARRAY(Value, array->data, oldCapacity, array->capacity);
+    int capacity = GROW_CAPACITY(array->capacity);
+    Value* data = GROW_ARRAY(Value, array->data, array->capacity, capacity, array->kind);
+    if (data == NULL) return false;
+    array->data = data;
+    array->capacity = capacity;
   }
 
   array->data[array->count] = val;
   array->count++;
+  return true;
 }
 
 void freeValueArray(ValueArray* array) {
-  FREE_ARRAY(Value, array->data, array->capacity);
-  initValueArray(array);
+  FREE_ARRAY(Value, array->data, array->capacity, array->kind);
+  initValueArray(array, array->kind);
 }
 
-static void printObject(ObjType type, Value val) {
+ValueType valueType(Value val) {
+#ifdef NAN_BOXING
+  if (IS_NUM(val)) return VAL_NUMBER;
+  if (IS_OBJ(val)) return VAL_OBJ;
+  if (IS_BOOL(val)) return VAL_BOOL;
+  return VAL_NULL;
+#else
+  return val.type;
+#endif
+}
+
+bool valuesEqual(Value a, Value b) {
+  ValueType type = valueType(a);
+  if (type != valueType(b)) return false;
+
+  switch(type) {
+    case VAL_NUMBER:
+      return AS_NUMBER(a) == AS_NUMBER(b);
+    case VAL_BOOL:
+      return AS_BOOL(a) == AS_BOOL(b);
+    case VAL_NULL:
+      return true;
+    case VAL_OBJ:
+      // strings are interned, equal contents means the same object.
+      // ropes have to be flattened first
+      return AS_OBJ(a) == AS_OBJ(b);
+  }
+  return false;
+}
+
+static bool printObject(ObjType type, Value val) {
   switch(type) {
     case OBJ_STRING: {
       char* str = AS_CSTRING(val);
@@ -42,11 +77,14 @@ static void printObject(ObjType type, Value val) {
       printf("<native code>");
       break;
     }
+    case OBJ_ROPE:
+      return printRope(AS_ROPE(val));
   }
+  return true;
 }
 
-void printValue(Value val) {
-  switch (val.type) {
+bool printValue(Value val) {
+  switch (valueType(val)) {
     case VAL_NUMBER:
       printf("%g", AS_NUMBER(val));
       break;
@@ -57,7 +95,7 @@ void printValue(Value val) {
       printf("%s", "null");
       break;
     case VAL_OBJ:
-      printObject(OBJ_TYPE(val), val);
-      break;
+      return printObject(OBJ_TYPE(val), val);
   }
+  return true;
 }
@@ -12,31 +12,60 @@
 #include <parser.h>
 #include <object.h>
 #include <string.h>
+#include <limits.h>
 #include <table.h>
 #include <native.h>
+#include <profile.h>
+#include <jit.h>
+#include <trace.h>
+#include <gc.h>
 
 const char* funcName = NULL;
 
-static void setReturnVal(VM* vm, Value val) {
-  const char* temp = "return";
-  int length = strlen(temp) + 1;
-  char* str = ALLOCATE(char, length);
-  strcpy(str, temp);
-  str[length] = '\0';
+bool initVM(VM* vm, Compiler* compiler) {
+  initHeap(&vm->heap);
+  useHeap(&vm->heap);
 
-  ObjString* key = allocateString(vm, str);
-  tableSet(&vm->globals, key, val);
-}
-
-void initVM(VM* vm, Compiler* compiler) {
+  vm->frame = ALLOCATE(CallFrame, FRAMES_INITIAL, MEM_VM);
+  vm->frameCapacity = FRAMES_INITIAL;
+  vm->frameCount = 0;
+  vm->valueStack = ALLOCATE(Value, STACK_INITIAL, MEM_VM);
+  vm->stackCapacity = STACK_INITIAL;
   vm->stackTop = vm->valueStack;
-  vm->compiler = compiler;
+  vm->stackHigh = 0;
 
-  vm->objects = NULL;
-  initTable(&vm->globals);
-  setReturnVal(vm, NULL_VAL);
-  defineNatives(vm);
+  // the compiler isn't initialised yet, defining the natives
+  // must not find it if it collects garbage
+  vm->compiler = NULL;
 
+  vm->objects = NULL;
+  vm->grayStack = NULL;
+  vm->grayCount = 0;
+  vm->grayCapacity = 0;
+  vm->grayOverflow = false;
+  vm->gcPhase = GC_IDLE;
+  vm->sweepList = NULL;
+  vm->gcPauseMicros = GC_PAUSE_DEFAULT;
+  vm->nursery = ALLOCATE(uint8_t, NURSERY_SIZE, MEM_VM);
+  vm->nurseryTop = vm->nursery;
+  vm->rememberedCount = 0;
+#ifdef REGISTER_BYTECODE
+  vm->registerBytecode = true;
+#else
+  vm->registerBytecode = false;
+#endif
+  vm->jitEnabled = true;
+  vm->jitDepth = 0;
+  for (int i = 0; i < HOTCOUNT_SIZE; i++) {
+    vm->hotCounts[i] = TRACE_THRESHOLD;
+  }
+  initValueArray(&vm->globals, MEM_VM);
+  initTable(&vm->globalNames);
+  initTable(&vm->strings);
+  bool ok = vm->frame != NULL && vm->valueStack != NULL && vm->nursery != NULL &&
+    defineNatives(vm);
+  vm->compiler = compiler;
+  return ok;
 }
 
 static void printFuncName(const CallFrame* frame) {
@@ -58,35 +87,19 @@ void resetVM(VM* vm) {
   vm->stackTop = vm->valueStack;
 }
 
-static void freeObject(Obj* obj) {
-  switch(obj->type) {
-    case OBJ_STRING: {
-      ObjString* str = (ObjString*)obj;
-      FREE_ARRAY(char, str->str, str->length + 1);
-      FREE(ObjString, str);
-      break;
-    }
-    case OBJ_FUNCTION: {
-      ObjFunction* func = (ObjFunction*)obj;
-      if (func->name != NULL) {
-        freeObject((Obj*)func->name);
-      }
-      FREE(ObjFunction, func);
-      freeChunk(&CHUNK((*func)));
-      break;
-    }
-  }
-}
-
 static void freeObjects(VM* vm) {
-  Obj* obj = vm->objects;
   int count = 0;
 
-  while (obj != NULL) {
-    Obj* next = obj->next;
-    freeObject(obj);
-    count++;
-    obj = next;
+  // a collection may have stopped partway through its sweep
+  Obj* lists[] = {vm->objects, vm->sweepList};
+  for (int i = 0; i < 2; i++) {
+    Obj* obj = lists[i];
+    while (obj != NULL) {
+      Obj* next = obj->next;
+      freeObject(obj);
+      count++;
+      obj = next;
+    }
   }
 
 #ifdef DEBUG_STACK_TRACE
@@ -96,14 +109,67 @@ static void freeObjects(VM* vm) {
 
 
 void freeVM(VM* vm) {
+#ifdef PROFILE_OPCODES
+  printProfile();
+#endif
+  useHeap(&vm->heap);
   freeObjects(vm);
-  freeTable(&vm->globals);
+  freeValueArray(&vm->globals);
+  freeTable(&vm->globalNames);
+  freeTable(&vm->strings);
+  FREE_ARRAY(CallFrame, vm->frame, vm->frameCapacity, MEM_VM);
+  FREE_ARRAY(Value, vm->valueStack, vm->stackCapacity, MEM_VM);
+  FREE_ARRAY(uint8_t, vm->nursery, NURSERY_SIZE, MEM_VM);
+  free(vm->grayStack);
+  freeHeap(&vm->heap);
+  useHeap(NULL);
 }
 
 static void error(const char* msg) {
   fprintf(stderr, "ERROR: %s\n", msg);
 }
 
+int resolveGlobalSlot(VM* vm, const char* name, int length) {
+  uint32_t hash = hashString(name, length);
+  ObjString* key = tableFindString(&vm->globalNames, name, length, hash);
+
+  Value slot;
+  if (key != NULL && tableGet(&vm->globalNames, key, &slot)) {
+    return (int)AS_NUMBER(slot);
+  }
+
+  key = copyString(vm, name, length);
+  if (key == NULL) return -1;
+
+  int index = vm->globals.count;
+  if (!writeValueArray(&vm->globals, UNDEFINED_VAL)) return -1;
+  if (!tableSet(&vm->globalNames, key, NUMBER_VAL(index))) {
+    vm->globals.count--;
+    return -1;
+  }
+
+  return index;
+}
+
+/**
+ * reverse lookup of a global's name, only needed for error messages
+ */
+static const char* globalName(VM* vm, int slot) {
+  for (int i = 0; i < vm->globalNames.capacity; i++) {
+    Entry* entry = &vm->globalNames.entries[i];
+    if (entry->key != NULL && (int)AS_NUMBER(entry->value) == slot) {
+      return entry->key->str;
+    }
+  }
+  return "?";
+}
+
+static void undefinedGlobal(VM* vm, int slot) {
+  char buff[256];
+  snprintf(buff, sizeof(buff), "undefined variable '%s'", globalName(vm, slot));
+  error(buff);
+}
+
 
 
 void push(VM* vm, Value val) {
@@ -125,117 +191,251 @@ static bool isFalsey(Value val) {
   return IS_NULL(val) || (IS_BOOL(val) && !AS_BOOL(val));
 }
 
-static bool binaryOp(VM* vm, ValueType valType, OpCode op) {
-#define NUM_OP(operator, macro, type) \
-  do { \
-    double b = AS_NUMBER(pop(vm)); \
-    double a = AS_NUMBER(pop(vm)); \
-    type result = a operator b; \
-    Value value = macro(result); \
-    push(vm, value); \
-  } while(false)
-
-  switch(valType) {
-    case VAL_NUMBER: {
-      if (peek(vm, 1).type != VAL_NUMBER || peek(vm, 2).type != VAL_NUMBER) {
-          error("both operands must be number types");
-          return false;
-      }
-
-      switch(op) {
-        case OP_ADD: 
-          NUM_OP(+, NUMBER_VAL, double);
-          break;
-        case OP_SUBTRACT: NUM_OP(-, NUMBER_VAL, double); break;
-        case OP_MULTIPLY: NUM_OP(*, NUMBER_VAL, double); break;
-        case OP_DIVIDE: NUM_OP(/, NUMBER_VAL, double); break;
-        default: {
-          error("operand not supported for binary operation");
-          return false;
-        }
-      } 
-      return true;
-    }
+/**
+ * arithmetic and comparisons on operand values rather than the stack,
+ * so the register instructions can share them with the stack ones
+ */
+static bool numberOp(OpCode op, Value a, Value b, Value* result) {
+  if (!IS_NUM(a) || !IS_NUM(b)) {
+    error("both operands must be number types");
+    return false;
+  }
 
-   case VAL_BOOL: {
-    if (peek(vm, 1).type != VAL_NUMBER || peek(vm, 2).type != VAL_NUMBER) {
-      error("both operands must be number types");
+  double x = AS_NUMBER(a);
+  double y = AS_NUMBER(b);
+  switch(op) {
+    case OP_ADD: *result = NUMBER_VAL(x + y); break;
+    case OP_SUBTRACT: *result = NUMBER_VAL(x - y); break;
+    case OP_MULTIPLY: *result = NUMBER_VAL(x * y); break;
+    case OP_DIVIDE: *result = NUMBER_VAL(x / y); break;
+    case OP_LESS: *result = BOOL_VAL(x < y); break;
+    case OP_GREATER: *result = BOOL_VAL(x > y); break;
+    default: {
+      error("operand not supported for binary operation");
       return false;
     }
-    switch(op) {
-      case OP_LESS: NUM_OP(<, BOOL_VAL, bool); break;
-      case OP_GREATER: NUM_OP(>, BOOL_VAL, bool); break;
-      default:{
-        error("operand not supported for comparison");
-        return false;
-      } 
-    }
-    return true;
-   }
-   
-  default: {
-    // handle error
-    char buff[100];
-    snprintf(buff, sizeof(buff), "value type %d not supported as binary operand\n", 
-        valType);
-    error(buff);
+  }
+  return true;
+}
+
+static bool binaryOp(VM* vm, OpCode op) {
+  Value result;
+  if (!numberOp(op, peek(vm, 2), peek(vm, 1), &result)) {
     return false;
   }
- }
-#undef NUM_OP
+
+  vm->stackTop--;
+  vm->stackTop[-1] = result;
   return true;
 }
 
 static bool evalEquals(VM* vm) {
   
-  if (peek(vm, 1).type != peek(vm, 2).type) {
+  if (valueType(peek(vm, 1)) != valueType(peek(vm, 2))) {
     return false;
   }
 
+  // a rope compares as the interned string of its characters
+  for (int offset = 1; offset <= 2; offset++) {
+    if (IS_ROPE(peek(vm, offset))) {
+      ObjString* flat = flattenString(vm, peek(vm, offset));
+      if (flat == NULL) {
+        error("out of memory");
+        return false;
+      }
+      vm->stackTop[-offset] = OBJ_VAL(flat);
+    }
+  }
+
   Value a = pop(vm);
   Value b = pop(vm);
 
-  switch(a.type) {
-    case VAL_NUMBER:
-      push(vm, BOOL_VAL(AS_NUMBER(a) == AS_NUMBER(b)));
-      break;
-    case VAL_BOOL:
-      push(vm, BOOL_VAL(AS_BOOL(a) == AS_BOOL(b)));
-      break;
-    case VAL_NULL:
-      push(vm, BOOL_VAL(true));
-      break;
-    case VAL_OBJ:
-      push(vm, BOOL_VAL(strcmp(AS_CSTRING(a), AS_CSTRING(b)) == 0));
-      break;
-  }
+  push(vm, BOOL_VAL(valuesEqual(a, b)));
   return true;
 }
 
-static bool concatenate(VM* vm) {
-  if (!(IS_OBJ(peek(vm, 1))) || !(IS_OBJ(peek(vm, 2)))) {
+static int textLength(Value text) {
+  return IS_ROPE(text) ? (AS_ROPE(text))->length : (AS_STRING(text))->length;
+}
+
+static bool concatenate(VM* vm, Value a, Value b, Value* result) {
+  if (!IS_OBJ(a) || !IS_OBJ(b)) {
     error("both types must be objects");
     return false;
   }
-  if (OBJ_TYPE(peek(vm, 1)) != OBJ_STRING && OBJ_TYPE(peek(vm, 2)) != OBJ_STRING) {
+  if ((!IS_STRING(a) && !IS_ROPE(a)) || (!IS_STRING(b) && !IS_ROPE(b))) {
     // handle error
     error("both types must be strings");
     return false;
   }
 
-  ObjString* b = AS_STRING(pop(vm));
-  ObjString* a = AS_STRING(pop(vm));
-  int size = a->length + b->length;
+  // ropes are never empty
+  if (IS_STRING(a) && (AS_STRING(a))->length == 0) {
+    *result = b;
+    return true;
+  }
+  if (IS_STRING(b) && (AS_STRING(b))->length == 0) {
+    *result = a;
+    return true;
+  }
+
+  int64_t size = (int64_t)textLength(a) + textLength(b);
+  if (size > INT_MAX) {
+    error("string too long");
+    return false;
+  }
+
+  // long results share the operands' characters instead of copying
+  // them, the operands are still on the stack (or constants)
+  if (size >= ROPE_MIN) {
+    ObjRope* rope = newRope(vm, AS_OBJ(a), AS_OBJ(b));
+    if (rope == NULL) {
+      error("out of memory");
+      return false;
+    }
+    *result = OBJ_VAL(rope);
+    return true;
+  }
+
+  // anything shorter than ROPE_MIN is a string
+  // making room in the nursery may move the operands out of it
+  Value operands[] = {a, b};
+  bool young = reserveNursery(vm, (int)size, operands, 2);
+  ObjString* left = AS_STRING(operands[0]);
+  ObjString* right = AS_STRING(operands[1]);
+
+  // too big for the nursery, the operands are still on the stack
+  // (or constants) if allocating it collects garbage
+  ObjString* obj = young ? allocateYoungString(vm, (int)size) : allocateString(vm, (int)size);
+  if (obj == NULL) {
+    error("out of memory");
+    return false;
+  }
+  memcpy(obj->str, left->str, left->length);
+  memcpy(obj->str + left->length, right->str, right->length);
+
+  // the left operand's hash covers its half already
+  obj->hash = extendHash(left->hash, right->str, right->length);
+  ObjString* interned = internString(vm, obj);
+  if (interned == NULL) {
+    error("out of memory");
+    return false;
+  }
+  *result = OBJ_VAL(interned);
 
-  char* buff = strcat(a->str, b->str);
-  char* str = ALLOCATE(char, size + 1);
-  strcpy(str, buff);
-  ObjString* obj = allocateString(vm, str);
-  push(vm, OBJ_VAL(obj));
+  return true;
+}
+
+/**
+ * OP_ADD for any operands: concatenates strings, adds numbers
+ */
+static bool addValues(VM* vm, Value a, Value b, Value* result) {
+  if (IS_OBJ(b)) {
+    return concatenate(vm, a, b, result);
+  }
+
+  return numberOp(OP_ADD, a, b, result);
+}
 
+static bool add(VM* vm) {
+  Value result;
+  if (!addValues(vm, peek(vm, 2), peek(vm, 1), &result)) {
+    return false;
+  }
+
+  vm->stackTop--;
+  vm->stackTop[-1] = result;
   return true;
 }
 
+/**
+ * move the stack to a bigger array with room for needed values
+ */
+static bool growStack(VM* vm, int needed) {
+  if (needed > STACK_MAX) {
+    error("stack overflow");
+    return false;
+  }
+
+  int capacity = vm->stackCapacity;
+  while (capacity < needed) capacity *= 2;
+  if (capacity > STACK_MAX) capacity = STACK_MAX;
+
+  Value* old = vm->valueStack;
+  Value* grown = GROW_ARRAY(Value, old, vm->stackCapacity, capacity, MEM_VM);
+  if (grown == NULL) {
+    error("out of memory");
+    return false;
+  }
+  vm->valueStack = grown;
+  vm->stackCapacity = capacity;
+
+  // the values moved, point everything that referred to them at the new stack
+  for (int i = 0; i < vm->frameCount; i++) {
+    vm->frame[i].basePointer = vm->valueStack + (vm->frame[i].basePointer - old);
+  }
+  vm->stackTop = vm->valueStack + (vm->stackTop - old);
+  return true;
+}
+
+/**
+ * make room for slots values from base (an offset into the stack)
+ */
+static bool ensureStack(VM* vm, int base, int slots) {
+  int needed = base + slots;
+  if (needed <= vm->stackHigh) return true;
+  if (needed > vm->stackCapacity && !growStack(vm, needed)) return false;
+
+  // the collector scans whole frames, slots past the high-water mark
+  // may be uninitialised or point at objects that were freed
+  for (int i = vm->stackHigh; i < needed; i++) {
+    vm->valueStack[i] = NULL_VAL;
+  }
+  vm->stackHigh = needed;
+  return true;
+}
+
+/**
+ * frames are only referred to by index (or reloaded after a call),
+ * so the array can move freely
+ */
+static bool pushFrame(VM* vm) {
+  if (vm->frameCount == vm->frameCapacity) {
+    if (vm->frameCapacity == FRAMES_MAX) {
+      error("stack overflow");
+      return false;
+    }
+
+    int capacity = vm->frameCapacity * 2;
+    CallFrame* frames = GROW_ARRAY(CallFrame, vm->frame, vm->frameCapacity, capacity, MEM_VM);
+    if (frames == NULL) {
+      error("out of memory");
+      return false;
+    }
+    vm->frame = frames;
+    vm->frameCapacity = capacity;
+  }
+
+  vm->frameCount++;
+  return true;
+}
+
+/**
+ * a function becomes hot (and is handed to the JIT) on its
+ * JIT_THRESHOLD-th call. if it cannot be compiled it stays interpreted
+ */
+static void countCall(VM* vm, ObjFunction* func) {
+#ifdef JIT
+  if (func->callCount < JIT_THRESHOLD && ++func->callCount == JIT_THRESHOLD &&
+      vm->jitEnabled) {
+    jitCompile(vm, func);
+  }
+#else
+  (void)vm;
+  (void)func;
+#endif
+}
+
 static bool call(VM* vm, ObjFunction* func, uint8_t callArgs) {
   if (func->numArgs != callArgs) {
     error("wrong number of args");
@@ -244,30 +444,39 @@ static bool call(VM* vm, ObjFunction* func, uint8_t callArgs) {
   }
   pop(vm); // popping function object off stack
 
-  vm->frameCount++;
-  if (vm->frameCount > FRAMES_MAX) {
-    error("stack overflow");
+  int base = (int)(vm->stackTop - vm->valueStack) - func->numArgs;
+  if (!ensureStack(vm, base, func->maxSlots) || !pushFrame(vm)) {
     return false;
   }
 
+  countCall(vm, func);
   CallFrame* newFrame = &vm->frame[vm->frameCount - 1];
   newFrame->func = func;
   newFrame->ip = newFrame->func->chunk.code;
-  newFrame->basePointer = vm->stackTop - newFrame->func->numArgs;
+  newFrame->basePointer = vm->valueStack + base;
 
   return true;
 }
 
+/**
+ * natives run on the caller's stack and write their result straight into
+ * the slot of the first argument (the next free slot when there are none)
+ */
+static bool callNative(VM* vm, ObjNative* native, int callArgs) {
+  if (native->arity != NATIVE_VARIADIC && native->arity != callArgs) {
+    error("wrong number of args");
+    return false;
+  }
 
-static int resolveLocal(VM* vm, const CallFrame* frame) {
-  int index = (int)AS_NUMBER(pop(vm));
-  for (Value* current = frame->basePointer + index; current < vm->stackTop; current++) {
-    if (current->isLocal) {
-      break;
-    }
-    index++;
+  // only natives that declare they may fail are checked
+  Value* args = vm->stackTop - callArgs;
+  bool ok = native->func(vm, callArgs, args, args);
+  if ((native->flags & NATIVE_MAY_ERROR) && !ok) {
+    return false;
   }
-  return index;
+
+  vm->stackTop = args + 1;
+  return true;
 }
 
 static bool callValue(VM* vm, int callArgs) {
@@ -278,18 +487,9 @@ static bool callValue(VM* vm, int callArgs) {
         ObjFunction* func = AS_FUNC(val);
         return call(vm, func, callArgs);
       }
-      case OBJ_NATIVE: {
-        ObjNative* native = AS_NATIVE(val);
-        NativeFunc func = native->func;
+      case OBJ_NATIVE:
         pop(vm); // pop off native object from stack
-        Value result = func(vm, callArgs, vm->stackTop - callArgs);
-        if (result.type != VAL_NULL) {
-          setReturnVal(vm, result);
-        }
-
-        vm->stackTop -= callArgs;
-        break;
-      }
+        return callNative(vm, AS_NATIVE(val), callArgs);
       default:
         error("value being called must be a function object");
         return false;
@@ -303,7 +503,146 @@ static bool callValue(VM* vm, int callArgs) {
   return true;
 }
 
-static InterpretResult run(VM* vm) {
+/**
+ * a call in tail position reuses the caller's frame: the arguments move
+ * down over the frame's slots and the callee starts in its place.
+ * natives run as an ordinary call, and the OP_RETURN that follows the
+ * tail call returns their result
+ */
+static bool tailCall(VM* vm, CallFrame* frame, uint8_t callArgs) {
+  Value callee = peek(vm, 1);
+  if (!IS_FUNC(callee)) {
+    return callValue(vm, callArgs);
+  }
+
+  ObjFunction* func = AS_FUNC(callee);
+  if (func->numArgs != callArgs) {
+    error("wrong number of args");
+    return false;
+  }
+
+  Value* args = vm->stackTop - 1 - callArgs;
+  memmove(frame->basePointer, args, sizeof(Value) * callArgs);
+  vm->stackTop = frame->basePointer + callArgs;
+
+  if (!ensureStack(vm, (int)(frame->basePointer - vm->valueStack), func->maxSlots)) {
+    return false;
+  }
+
+  countCall(vm, func);
+  frame->func = func;
+  frame->ip = func->chunk.code;
+  return true;
+}
+
+/**
+ * a register instruction's source operand: a frame slot or a constant
+ */
+static inline Value registerOperand(const CallFrame* frame, uint8_t operand) {
+  if (IS_RK_CONSTANT(operand)) {
+    return frame->func->chunk.constants.data[operand & RK_MAX];
+  }
+  return frame->basePointer[operand];
+}
+
+static InterpretResult run(VM* vm, int exitDepth);
+
+#ifdef JIT
+/**
+ * run the top frame until it returns, as machine code when its function
+ * has been compiled. compiled frames nest on the C stack, so past
+ * JIT_DEPTH_MAX the frame is interpreted instead
+ */
+static bool runFrame(VM* vm) {
+  int depth = vm->frameCount;
+  while (true) {
+    ObjFunction* func = vm->frame[depth - 1].func;
+    if (func->jitCode == NULL || vm->jitDepth >= JIT_DEPTH_MAX) {
+      return run(vm, depth) == INTERPRET_OK;
+    }
+
+    vm->jitDepth++;
+    JitStatus status = ((JitCode)func->jitCode)(vm, (size_t)(depth - 1) * sizeof(CallFrame));
+    vm->jitDepth--;
+
+    // a loop's trace exited mid-function
+    if (status == JIT_INTERPRET) return run(vm, depth) == INTERPRET_OK;
+
+    // a tail call left another function in the frame
+    if (status != JIT_TAIL_CALL) return status == JIT_RETURNED;
+  }
+}
+
+bool jitArithmetic(VM* vm, uint8_t op) {
+  return op == OP_ADD ? add(vm) : binaryOp(vm, op);
+}
+
+bool jitRegisterOp(VM* vm, uint8_t op, Value a, Value b, Value* dst) {
+  return op == OP_ADD ? addValues(vm, a, b, dst) : numberOp(op, a, b, dst);
+}
+
+bool jitEqual(VM* vm) {
+  return evalEquals(vm);
+}
+
+void jitUndefinedGlobal(VM* vm, int slot) {
+  undefinedGlobal(vm, slot);
+}
+
+void jitNumberError(void) {
+  error("both operands must be number types");
+}
+
+bool jitCall(VM* vm, int callArgs) {
+  int depth = vm->frameCount;
+  if (!callValue(vm, callArgs)) return false;
+
+  // natives have already run, functions got a frame to run here
+  return vm->frameCount == depth || runFrame(vm);
+}
+
+bool jitCallNative(VM* vm, int slot, int callArgs) {
+  Value callee = vm->globals.data[slot];
+  if (IS_NATIVE(callee)) {
+    return callNative(vm, AS_NATIVE(callee), callArgs);
+  }
+
+  if (IS_UNDEFINED(callee)) {
+    undefinedGlobal(vm, slot);
+    return false;
+  }
+  if (!ensureStack(vm, (int)(vm->stackTop - vm->valueStack), 1)) {
+    return false;
+  }
+  push(vm, callee);
+  return jitCall(vm, callArgs);
+}
+
+int jitTailCall(VM* vm, int callArgs) {
+  bool replacesFrame = IS_FUNC(peek(vm, 1));
+  if (!tailCall(vm, &vm->frame[vm->frameCount - 1], callArgs)) {
+    return 0;
+  }
+  return replacesFrame ? 2 : 1;
+}
+
+bool jitHotLoop(VM* vm, int backEdge) {
+  CallFrame* frame = &vm->frame[vm->frameCount - 1];
+  Chunk* chunk = &frame->func->chunk;
+  uint8_t* header = chunk->code + jumpTarget(chunk, backEdge);
+
+  frame->ip = header;
+  traceLoop(vm, frame, backEdge);
+  return frame->ip == header;
+}
+#endif
+
+/**
+ * interpret from the top frame until the frame below exitDepth is
+ * reached again (the script's frame, or the caller of a frame that
+ * compiled code handed over), or until the script returns
+ */
+static InterpretResult run(VM* vm, int exitDepth) {
 
   CallFrame* frame = &vm->frame[vm->frameCount - 1];
 #define READ_BYTE() *(frame->ip++)
@@ -311,213 +650,720 @@ static InterpretResult run(VM* vm) {
   (frame->func->chunk.constants.data[READ_BYTE()])
 #define READ_SHORT() \
   (uint16_t)((frame->ip[0] << 8) | frame->ip[1])
+#define READ_LONG() \
+  (uint32_t)((frame->ip[0] << 16) | (frame->ip[1] << 8) | frame->ip[2])
 
-  while(true) {
-    frame = &vm->frame[vm->frameCount - 1];
+/**
+ * quickening: a generic arithmetic instruction that sees two numbers
+ * rewrites itself in place to its number-only form. the number-only
+ * form guards on the operand types and, when the guard fails, rewrites
+ * itself back (de-quickens) and re-executes as the generic instruction
+ */
+#define NUMBER_OPERANDS() (IS_NUM(vm->stackTop[-1]) && IS_NUM(vm->stackTop[-2]))
+#define QUICKEN(quick) \
+  do { \
+    if (NUMBER_OPERANDS()) frame->ip[-1] = quick; \
+  } while(false)
+#define DEQUICKEN(generic) \
+  do { \
+    frame->ip--; \
+    *frame->ip = generic; \
+  } while(false)
+#define NUMBER_OP(operator, macro) \
+  do { \
+    double b = AS_NUMBER(vm->stackTop[-1]); \
+    double a = AS_NUMBER(vm->stackTop[-2]); \
+    vm->stackTop--; \
+    vm->stackTop[-1] = macro(a operator b); \
+  } while(false)
+
+/**
+ * register instructions read their operands straight from the frame and
+ * write the destination slot. temporaries live above stackTop, so the
+ * generic fallbacks work on values rather than pushing onto the stack
+ */
+#define READ_RK() registerOperand(frame, READ_BYTE())
+
+/**
+ * after a call: pick up the top frame, running it as machine code
+ * when a new frame was pushed for a compiled function
+ */
+#ifdef JIT
+#define ENTER_CALLEE(depth) \
+  do { \
+    frame = &vm->frame[vm->frameCount - 1]; \
+    if (vm->frameCount > (depth) && frame->func->jitCode != NULL && \
+        vm->jitDepth < JIT_DEPTH_MAX) { \
+      if (!runFrame(vm)) return RUNTIME_ERROR; \
+      frame = &vm->frame[vm->frameCount - 1]; \
+    } \
+  } while(false)
+#else
+#define ENTER_CALLEE(depth) \
+  do { \
+    (void)(depth); \
+    frame = &vm->frame[vm->frameCount - 1]; \
+  } while(false)
+#endif
+
+/**
+ * a back-edge (ip just past it) counts down its loop's hot counter and
+ * hands the loop to the trace compiler when it runs out, or right away
+ * once the loop has a trace. either may move frame->ip to where the
+ * trace left off
+ */
+#ifdef JIT
+#define HOT_LOOP(backEdge) \
+  do { \
+    if (--vm->hotCounts[HOTCOUNT_INDEX(backEdge)] == 0) { \
+      traceLoop(vm, frame, (int)((backEdge) - frame->func->chunk.code)); \
+    } \
+  } while(false)
+#define ENTER_TRACE(backEdge) \
+  traceLoop(vm, frame, (int)((backEdge) - frame->func->chunk.code))
+#else
+#define HOT_LOOP(backEdge) (void)(backEdge)
+#define ENTER_TRACE(backEdge) (void)(backEdge)
+#endif
+#define REGISTER_OP(operator, macro, op) \
+  do { \
+    uint8_t dst = READ_BYTE(); \
+    Value a = READ_RK(); \
+    Value b = READ_RK(); \
+    if (IS_NUM(a) && IS_NUM(b)) { \
+      frame->basePointer[dst] = macro(AS_NUMBER(a) operator AS_NUMBER(b)); \
+    } else if (!numberOp(op, a, b, &frame->basePointer[dst])) { \
+      return RUNTIME_ERROR; \
+    } \
+  } while(false)
+#define REGISTER_BRANCH(operator) \
+  do { \
+    Value a = READ_RK(); \
+    Value b = READ_RK(); \
+    uint16_t offset = READ_SHORT(); \
+    frame->ip += 2; \
+    if (!IS_NUM(a) || !IS_NUM(b)) { \
+      error("both operands must be number types"); \
+      return RUNTIME_ERROR; \
+    } \
+    if (!(AS_NUMBER(a) operator AS_NUMBER(b))) { \
+      frame->ip += offset; \
+    } \
+  } while(false)
 
 #ifdef DEBUG_STACK_TRACE
-  printFuncName(frame);
-  printf("[ ");
-  for (Value* val = vm->valueStack; val < vm->stackTop; val++) {
-    printValue(*val);
-    printf(" ");
-  }
-  printf("]\n");
-  disassembleInstruction(&frame->func->chunk, (int)(frame->ip - frame->func->chunk.code));
+#define TRACE_INSTRUCTION() \
+  do { \
+    printFuncName(frame); \
+    printf("[ "); \
+    for (Value* val = vm->valueStack; val < vm->stackTop; val++) { \
+      printValue(*val); \
+      printf(" "); \
+    } \
+    printf("]\n"); \
+    disassembleInstruction(&frame->func->chunk, (int)(frame->ip - frame->func->chunk.code)); \
+  } while(false)
+#else
+#define TRACE_INSTRUCTION() do {} while(false)
 #endif
 
-    switch(READ_BYTE()) {
-      case OP_CONSTANT: {
+#ifdef PROFILE_OPCODES
+#define PROFILE_INSTRUCTION(instruction) profileInstruction(instruction)
+  resetProfileHistory();
+#else
+#define PROFILE_INSTRUCTION(instruction) do {} while(false)
+#endif
+
+#ifdef THREADED_DISPATCH
+  /**
+   * labels-as-values: every handler jumps straight to the next one,
+   * giving each opcode its own indirect branch to predict
+   */
+  static void* dispatchTable[] = {
+    [OP_CONSTANT] = &&L_OP_CONSTANT,
+    [OP_CONSTANT_LONG] = &&L_OP_CONSTANT_LONG,
+    [OP_ADD] = &&L_OP_ADD,
+    [OP_SUBTRACT] = &&L_OP_SUBTRACT,
+    [OP_MULTIPLY] = &&L_OP_MULTIPLY,
+    [OP_DIVIDE] = &&L_OP_DIVIDE,
+    [OP_LESS] = &&L_OP_LESS,
+    [OP_GREATER] = &&L_OP_GREATER,
+    [OP_EQUAL] = &&L_OP_EQUAL,
+    [OP_NEGATE] = &&L_OP_NEGATE,
+    [OP_NOT] = &&L_OP_NOT,
+    [OP_TRUE] = &&L_OP_TRUE,
+    [OP_FALSE] = &&L_OP_FALSE,
+    [OP_NULL] = &&L_OP_NULL,
+    [OP_DEFINE_GLOBAL] = &&L_OP_DEFINE_GLOBAL,
+    [OP_GET_GLOBAL] = &&L_OP_GET_GLOBAL,
+    [OP_SET_GLOBAL] = &&L_OP_SET_GLOBAL,
+    [OP_GET_LOCAL] = &&L_OP_GET_LOCAL,
+    [OP_SET_LOCAL] = &&L_OP_SET_LOCAL,
+    [OP_CALL] = &&L_OP_CALL,
+    [OP_TAIL_CALL] = &&L_OP_TAIL_CALL,
+    [OP_CALL_NATIVE] = &&L_OP_CALL_NATIVE,
+    [OP_JUMP_IF_FALSE] = &&L_OP_JUMP_IF_FALSE,
+    [OP_JUMP_IF_TRUE] = &&L_OP_JUMP_IF_TRUE,
+    [OP_LOOP] = &&L_OP_LOOP,
+    [OP_JUMP] = &&L_OP_JUMP,
+    [OP_POP] = &&L_OP_POP,
+    [OP_RETURN] = &&L_OP_RETURN,
+    [OP_JUMP_LONG] = &&L_OP_JUMP_LONG,
+    [OP_JUMP_IF_FALSE_LONG] = &&L_OP_JUMP_IF_FALSE_LONG,
+    [OP_JUMP_IF_TRUE_LONG] = &&L_OP_JUMP_IF_TRUE_LONG,
+    [OP_LOOP_LONG] = &&L_OP_LOOP_LONG,
+    [OP_GET_LOCAL_GET_LOCAL] = &&L_OP_GET_LOCAL_GET_LOCAL,
+    [OP_GET_LOCAL_CONSTANT] = &&L_OP_GET_LOCAL_CONSTANT,
+    [OP_GET_LOCAL_CONSTANT_ADD] = &&L_OP_GET_LOCAL_CONSTANT_ADD,
+    [OP_GET_LOCAL_CONSTANT_SUBTRACT] = &&L_OP_GET_LOCAL_CONSTANT_SUBTRACT,
+    [OP_ADD_SET_LOCAL] = &&L_OP_ADD_SET_LOCAL,
+    [OP_LESS_JUMP_IF_FALSE_POP] = &&L_OP_LESS_JUMP_IF_FALSE_POP,
+    [OP_GREATER_JUMP_IF_FALSE_POP] = &&L_OP_GREATER_JUMP_IF_FALSE_POP,
+    [OP_GET_GLOBAL_CALL] = &&L_OP_GET_GLOBAL_CALL,
+    [OP_GET_LOCAL_CALL] = &&L_OP_GET_LOCAL_CALL,
+    [OP_GET_GLOBAL_TAIL_CALL] = &&L_OP_GET_GLOBAL_TAIL_CALL,
+    [OP_ADD_NUM] = &&L_OP_ADD_NUM,
+    [OP_SUBTRACT_NUM] = &&L_OP_SUBTRACT_NUM,
+    [OP_MULTIPLY_NUM] = &&L_OP_MULTIPLY_NUM,
+    [OP_DIVIDE_NUM] = &&L_OP_DIVIDE_NUM,
+    [OP_LESS_NUM] = &&L_OP_LESS_NUM,
+    [OP_GREATER_NUM] = &&L_OP_GREATER_NUM,
+    [OP_ADD_R] = &&L_OP_ADD_R,
+    [OP_SUBTRACT_R] = &&L_OP_SUBTRACT_R,
+    [OP_MULTIPLY_R] = &&L_OP_MULTIPLY_R,
+    [OP_DIVIDE_R] = &&L_OP_DIVIDE_R,
+    [OP_LESS_R] = &&L_OP_LESS_R,
+    [OP_GREATER_R] = &&L_OP_GREATER_R,
+    [OP_JUMP_IF_NOT_LESS_R] = &&L_OP_JUMP_IF_NOT_LESS_R,
+    [OP_JUMP_IF_NOT_GREATER_R] = &&L_OP_JUMP_IF_NOT_GREATER_R,
+    [OP_LOOP_TRACE] = &&L_OP_LOOP_TRACE,
+    [OP_LOOP_LONG_TRACE] = &&L_OP_LOOP_LONG_TRACE,
+  };
+
+#define CASE(op) L_##op
+#define DISPATCH() \
+  do { \
+    TRACE_INSTRUCTION(); \
+    uint8_t instruction = READ_BYTE(); \
+    PROFILE_INSTRUCTION(instruction); \
+    goto *dispatchTable[instruction]; \
+  } while(false)
+
+  DISPATCH();
+#else
+#define CASE(op) case op
+#define DISPATCH() break
+
+  while(true) {
+    TRACE_INSTRUCTION();
+    uint8_t instruction = READ_BYTE();
+    PROFILE_INSTRUCTION(instruction);
+    switch(instruction) {
+#endif
+
+      CASE(OP_CONSTANT): {
         Value val = READ_CONSTANT();
         push(vm, val);
-        break;
+        DISPATCH();
       }
-      case OP_ADD: {
-        if (peek(vm, 1).type == VAL_OBJ ) {
-          if (concatenate(vm)) break;
-          return RUNTIME_ERROR;
-        }
-
-        if (binaryOp(vm, VAL_NUMBER, OP_ADD)) break;
+      CASE(OP_CONSTANT_LONG): {
+        uint32_t index = READ_LONG();
+        frame->ip += 3;
+        push(vm, frame->func->chunk.constants.data[index]);
+        DISPATCH();
+      }
+      CASE(OP_ADD): {
+        QUICKEN(OP_ADD_NUM);
+        if (add(vm)) DISPATCH();
         return RUNTIME_ERROR;
       }
-      case OP_SUBTRACT: {
-        if (binaryOp(vm, VAL_NUMBER, OP_SUBTRACT)) break;
+      CASE(OP_SUBTRACT): {
+        QUICKEN(OP_SUBTRACT_NUM);
+        if (binaryOp(vm, OP_SUBTRACT)) DISPATCH();
         return RUNTIME_ERROR;
       }
-      case OP_MULTIPLY: {
-        if (binaryOp(vm, VAL_NUMBER, OP_MULTIPLY)) break;
+      CASE(OP_MULTIPLY): {
+        QUICKEN(OP_MULTIPLY_NUM);
+        if (binaryOp(vm, OP_MULTIPLY)) DISPATCH();
         return RUNTIME_ERROR;
       }
-      case OP_DIVIDE: {
-        if (binaryOp(vm, VAL_NUMBER, OP_DIVIDE)) break;
+      CASE(OP_DIVIDE): {
+        QUICKEN(OP_DIVIDE_NUM);
+        if (binaryOp(vm, OP_DIVIDE)) DISPATCH();
         return RUNTIME_ERROR;
       }
-      case OP_LESS: {
-        if (binaryOp(vm, VAL_BOOL, OP_LESS)) break;
+      CASE(OP_LESS): {
+        QUICKEN(OP_LESS_NUM);
+        if (binaryOp(vm, OP_LESS)) DISPATCH();
         return RUNTIME_ERROR;
       }
-      case OP_GREATER: {
-        if (binaryOp(vm, VAL_BOOL, OP_GREATER)) break;
+      CASE(OP_GREATER): {
+        QUICKEN(OP_GREATER_NUM);
+        if (binaryOp(vm, OP_GREATER)) DISPATCH();
         return RUNTIME_ERROR;
       }
-      case OP_EQUAL: {
-        if (evalEquals(vm)) break;
+      CASE(OP_ADD_NUM): {
+        if (!NUMBER_OPERANDS()) {
+          DEQUICKEN(OP_ADD);
+          DISPATCH();
+        }
+        NUMBER_OP(+, NUMBER_VAL);
+        DISPATCH();
+      }
+      CASE(OP_SUBTRACT_NUM): {
+        if (!NUMBER_OPERANDS()) {
+          DEQUICKEN(OP_SUBTRACT);
+          DISPATCH();
+        }
+        NUMBER_OP(-, NUMBER_VAL);
+        DISPATCH();
+      }
+      CASE(OP_MULTIPLY_NUM): {
+        if (!NUMBER_OPERANDS()) {
+          DEQUICKEN(OP_MULTIPLY);
+          DISPATCH();
+        }
+        NUMBER_OP(*, NUMBER_VAL);
+        DISPATCH();
+      }
+      CASE(OP_DIVIDE_NUM): {
+        if (!NUMBER_OPERANDS()) {
+          DEQUICKEN(OP_DIVIDE);
+          DISPATCH();
+        }
+        NUMBER_OP(/, NUMBER_VAL);
+        DISPATCH();
+      }
+      CASE(OP_LESS_NUM): {
+        if (!NUMBER_OPERANDS()) {
+          DEQUICKEN(OP_LESS);
+          DISPATCH();
+        }
+        NUMBER_OP(<, BOOL_VAL);
+        DISPATCH();
+      }
+      CASE(OP_GREATER_NUM): {
+        if (!NUMBER_OPERANDS()) {
+          DEQUICKEN(OP_GREATER);
+          DISPATCH();
+        }
+        NUMBER_OP(>, BOOL_VAL);
+        DISPATCH();
+      }
+      CASE(OP_EQUAL): {
+        if (evalEquals(vm)) DISPATCH();
         return RUNTIME_ERROR;
       }
-      case OP_NEGATE: {
-        if (peek(vm, 1).type != VAL_NUMBER) {
+      CASE(OP_NEGATE): {
+        if (!IS_NUM(peek(vm, 1))) {
           resetVM(vm);
           return RUNTIME_ERROR;
         }
         Value val = NUMBER_VAL(-AS_NUMBER(pop(vm)));
         push(vm, val);
-        break;
+        DISPATCH();
       }
-      case OP_NOT:
+      CASE(OP_NOT):
         push(vm, BOOL_VAL(isFalsey(pop(vm))));
-        break;
-      case OP_TRUE: {
+        DISPATCH();
+      CASE(OP_TRUE): {
         Value val = BOOL_VAL(true);
         push(vm, val);
-        break;
+        DISPATCH();
       }
-      case OP_FALSE: {
+      CASE(OP_FALSE): {
         Value val = BOOL_VAL(false);
         push(vm, val);
-        break;
+        DISPATCH();
       }
-      case OP_NULL: {
+      CASE(OP_NULL): {
         Value val = NULL_VAL;
         push(vm, val);
-        break;
+        DISPATCH();
       }
-      case OP_DEFINE_GLOBAL: {
-        ObjString* name = AS_STRING(peek(vm, 1));
-        Value val = peek(vm, 2);
-        tableSet(&vm->globals, name, val);
-        pop(vm);
-        pop(vm);
-        break;
-      }
-      case OP_GET_GLOBAL: {
-        ObjString* name = AS_STRING(peek(vm, 1));
-        Value val;
-        bool found = tableGet(&vm->globals, name, &val);
-        if (!found) {
-          error("unexpected identifier");
+      CASE(OP_DEFINE_GLOBAL): {
+        uint16_t slot = READ_SHORT();
+        frame->ip += 2;
+        vm->globals.data[slot] = pop(vm);
+        GLOBAL_BARRIER(vm, slot, vm->globals.data[slot]);
+        DISPATCH();
+      }
+      CASE(OP_GET_GLOBAL): {
+        uint16_t slot = READ_SHORT();
+        frame->ip += 2;
+        Value val = vm->globals.data[slot];
+        if (IS_UNDEFINED(val)) {
+          undefinedGlobal(vm, slot);
           return RUNTIME_ERROR;
         }
-        pop(vm);
         push(vm, val);
-        break;
+        DISPATCH();
       }
-      case OP_SET_GLOBAL: {
-        ObjString* name = AS_STRING(peek(vm, 1));
-        bool isNewKey = tableSet(&vm->globals, name, peek(vm, 2));
-        if (isNewKey) {
-          error("unexpected identifier");
+      CASE(OP_SET_GLOBAL): {
+        uint16_t slot = READ_SHORT();
+        frame->ip += 2;
+        if (IS_UNDEFINED(vm->globals.data[slot])) {
+          undefinedGlobal(vm, slot);
           return RUNTIME_ERROR;
         }
-        pop(vm);
-        pop(vm);
-        break;
-      }
-      case OP_GET_LOCAL: {
-        int index = resolveLocal(vm, frame);
-        push(vm, frame->basePointer[index]);
-        break;
-      }
-      case OP_SET_LOCAL: {
-        int index = resolveLocal(vm, frame);
-        Value newVal = pop(vm);
-        newVal.isLocal = true;
-        frame->basePointer[index] = newVal;
-        break;
-      }
-      case OP_MARK_LOCAL: {
-        Value* val = vm->stackTop - 1;
-        val->isLocal = true;
-        break;
-      }
-      case OP_CALL: {
+        vm->globals.data[slot] = pop(vm);
+        GLOBAL_BARRIER(vm, slot, vm->globals.data[slot]);
+        DISPATCH();
+      }
+      CASE(OP_GET_LOCAL): {
+        uint8_t slot = READ_BYTE();
+        push(vm, frame->basePointer[slot]);
+        DISPATCH();
+      }
+      CASE(OP_SET_LOCAL): {
+        uint8_t slot = READ_BYTE();
+        frame->basePointer[slot] = pop(vm);
+        DISPATCH();
+      }
+      CASE(OP_CALL): {
         // create a new call frame, the function object
         // should be on the top of the stack
         // the base pointer should be the address of the first arg (if any)
         // the top of the stack will be one past the last arg
         uint8_t callArgs = READ_BYTE();
+        int depth = vm->frameCount;
         if (!callValue(vm, callArgs)) {
           return RUNTIME_ERROR;
         }
-        break;
+
+        // the callee (if any) is now the top frame
+        ENTER_CALLEE(depth);
+        DISPATCH();
       }
-      case OP_JUMP_IF_FALSE: {
+      CASE(OP_CALL_NATIVE): {
+        // the compiler saw a native in this global, so the callee is read
+        // from the slot instead of being pushed
+        uint16_t slot = READ_SHORT();
+        frame->ip += 2;
+        uint8_t callArgs = READ_BYTE();
+        Value callee = vm->globals.data[slot];
+        if (IS_NATIVE(callee)) {
+          if (!callNative(vm, AS_NATIVE(callee), callArgs)) {
+            return RUNTIME_ERROR;
+          }
+          DISPATCH();
+        }
+
+        // the global was reassigned since, take the generic path
+        if (IS_UNDEFINED(callee)) {
+          undefinedGlobal(vm, slot);
+          return RUNTIME_ERROR;
+        }
+        if (!ensureStack(vm, (int)(vm->stackTop - vm->valueStack), 1)) {
+          return RUNTIME_ERROR;
+        }
+        int depth = vm->frameCount;
+        push(vm, callee);
+        if (!callValue(vm, callArgs)) {
+          return RUNTIME_ERROR;
+        }
+        ENTER_CALLEE(depth);
+        DISPATCH();
+      }
+      CASE(OP_TAIL_CALL): {
+        uint8_t callArgs = READ_BYTE();
+        if (!tailCall(vm, frame, callArgs)) {
+          return RUNTIME_ERROR;
+        }
+        DISPATCH();
+      }
+      CASE(OP_JUMP_IF_FALSE): {
         // creating 16-bit integer with arguments
         uint16_t offset = READ_SHORT();
         frame->ip += 2;
         if (isFalsey(peek(vm, 1))) {
           frame->ip += offset;
         }
-        break;
+        DISPATCH();
       }
-      case OP_JUMP_IF_TRUE: {
+      CASE(OP_JUMP_IF_TRUE): {
         uint16_t offset = READ_SHORT();
         frame->ip += 2;
         if (!isFalsey(peek(vm, 1))) {
           frame->ip += offset;
         }
-        break;
+        DISPATCH();
       }
-      case OP_LOOP: {
+      CASE(OP_LOOP): {
+        uint8_t* backEdge = frame->ip - 1;
         uint16_t offset = READ_SHORT();
         frame->ip += 2;
         frame->ip -= offset;
-        break;
+        HOT_LOOP(backEdge);
+        DISPATCH();
       }
-      case OP_JUMP: {
+      CASE(OP_LOOP_TRACE): {
+        uint8_t* backEdge = frame->ip - 1;
         uint16_t offset = READ_SHORT();
         frame->ip += 2;
+        frame->ip -= offset;
+        ENTER_TRACE(backEdge);
+        DISPATCH();
+      }
+      CASE(OP_JUMP): {
+        uint16_t offset = READ_SHORT();
+        frame->ip += 2;
+        frame->ip += offset;
+        DISPATCH();
+      }
+      CASE(OP_JUMP_IF_FALSE_LONG): {
+        uint32_t offset = READ_LONG();
+        frame->ip += 3;
+        if (isFalsey(peek(vm, 1))) {
+          frame->ip += offset;
+        }
+        DISPATCH();
+      }
+      CASE(OP_JUMP_IF_TRUE_LONG): {
+        uint32_t offset = READ_LONG();
+        frame->ip += 3;
+        if (!isFalsey(peek(vm, 1))) {
+          frame->ip += offset;
+        }
+        DISPATCH();
+      }
+      CASE(OP_LOOP_LONG): {
+        uint8_t* backEdge = frame->ip - 1;
+        uint32_t offset = READ_LONG();
+        frame->ip += 3;
+        frame->ip -= offset;
+        HOT_LOOP(backEdge);
+        DISPATCH();
+      }
+      CASE(OP_LOOP_LONG_TRACE): {
+        uint8_t* backEdge = frame->ip - 1;
+        uint32_t offset = READ_LONG();
+        frame->ip += 3;
+        frame->ip -= offset;
+        ENTER_TRACE(backEdge);
+        DISPATCH();
+      }
+      CASE(OP_JUMP_LONG): {
+        uint32_t offset = READ_LONG();
+        frame->ip += 3;
         frame->ip += offset;
-        break;
+        DISPATCH();
       }
-      case OP_POP:
+      CASE(OP_POP):
         pop(vm);
-        break;
-      case OP_RETURN: {
+        DISPATCH();
+      CASE(OP_GET_LOCAL_GET_LOCAL): {
+        uint8_t first = READ_BYTE();
+        uint8_t second = READ_BYTE();
+        push(vm, frame->basePointer[first]);
+        push(vm, frame->basePointer[second]);
+        DISPATCH();
+      }
+      CASE(OP_GET_LOCAL_CONSTANT): {
+        uint8_t slot = READ_BYTE();
+        push(vm, frame->basePointer[slot]);
+        push(vm, READ_CONSTANT());
+        DISPATCH();
+      }
+      CASE(OP_GET_LOCAL_CONSTANT_ADD): {
+        Value a = frame->basePointer[READ_BYTE()];
+        Value b = READ_CONSTANT();
+        if (IS_NUM(a) && IS_NUM(b)) {
+          push(vm, NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
+          DISPATCH();
+        }
+
+        push(vm, a);
+        push(vm, b);
+        if (add(vm)) DISPATCH();
+        return RUNTIME_ERROR;
+      }
+      CASE(OP_GET_LOCAL_CONSTANT_SUBTRACT): {
+        Value a = frame->basePointer[READ_BYTE()];
+        Value b = READ_CONSTANT();
+        if (IS_NUM(a) && IS_NUM(b)) {
+          push(vm, NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b)));
+          DISPATCH();
+        }
+
+        push(vm, a);
+        push(vm, b);
+        if (binaryOp(vm, OP_SUBTRACT)) DISPATCH();
+        return RUNTIME_ERROR;
+      }
+      CASE(OP_ADD_SET_LOCAL): {
+        if (!add(vm)) return RUNTIME_ERROR;
+        uint8_t slot = READ_BYTE();
+        frame->basePointer[slot] = pop(vm);
+        DISPATCH();
+      }
+      CASE(OP_LESS_JUMP_IF_FALSE_POP): {
+        uint16_t offset = READ_SHORT();
+        frame->ip += 2;
+        if (!binaryOp(vm, OP_LESS)) return RUNTIME_ERROR;
+
+        // the POP only runs on the fall-through path,
+        // the jump target still pops the condition itself
+        if (isFalsey(peek(vm, 1))) {
+          frame->ip += offset;
+        } else {
+          pop(vm);
+        }
+        DISPATCH();
+      }
+      CASE(OP_GREATER_JUMP_IF_FALSE_POP): {
+        uint16_t offset = READ_SHORT();
+        frame->ip += 2;
+        if (!binaryOp(vm, OP_GREATER)) return RUNTIME_ERROR;
+
+        if (isFalsey(peek(vm, 1))) {
+          frame->ip += offset;
+        } else {
+          pop(vm);
+        }
+        DISPATCH();
+      }
+      CASE(OP_GET_GLOBAL_CALL): {
+        uint16_t slot = READ_SHORT();
+        frame->ip += 2;
+        uint8_t callArgs = READ_BYTE();
+        Value callee = vm->globals.data[slot];
+        if (IS_UNDEFINED(callee)) {
+          undefinedGlobal(vm, slot);
+          return RUNTIME_ERROR;
+        }
+
+        int depth = vm->frameCount;
+        push(vm, callee);
+        if (!callValue(vm, callArgs)) {
+          return RUNTIME_ERROR;
+        }
+        ENTER_CALLEE(depth);
+        DISPATCH();
+      }
+      CASE(OP_GET_LOCAL_CALL): {
+        uint8_t slot = READ_BYTE();
+        uint8_t callArgs = READ_BYTE();
+        int depth = vm->frameCount;
+        push(vm, frame->basePointer[slot]);
+        if (!callValue(vm, callArgs)) {
+          return RUNTIME_ERROR;
+        }
+        ENTER_CALLEE(depth);
+        DISPATCH();
+      }
+      CASE(OP_ADD_R): {
+        uint8_t dst = READ_BYTE();
+        Value a = READ_RK();
+        Value b = READ_RK();
+        if (IS_NUM(a) && IS_NUM(b)) {
+          frame->basePointer[dst] = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+          DISPATCH();
+        }
+
+        if (addValues(vm, a, b, &frame->basePointer[dst])) DISPATCH();
+        return RUNTIME_ERROR;
+      }
+      CASE(OP_SUBTRACT_R):
+        REGISTER_OP(-, NUMBER_VAL, OP_SUBTRACT);
+        DISPATCH();
+      CASE(OP_MULTIPLY_R):
+        REGISTER_OP(*, NUMBER_VAL, OP_MULTIPLY);
+        DISPATCH();
+      CASE(OP_DIVIDE_R):
+        REGISTER_OP(/, NUMBER_VAL, OP_DIVIDE);
+        DISPATCH();
+      CASE(OP_LESS_R):
+        REGISTER_OP(<, BOOL_VAL, OP_LESS);
+        DISPATCH();
+      CASE(OP_GREATER_R):
+        REGISTER_OP(>, BOOL_VAL, OP_GREATER);
+        DISPATCH();
+      CASE(OP_JUMP_IF_NOT_LESS_R):
+        REGISTER_BRANCH(<);
+        DISPATCH();
+      CASE(OP_JUMP_IF_NOT_GREATER_R):
+        REGISTER_BRANCH(>);
+        DISPATCH();
+      CASE(OP_GET_GLOBAL_TAIL_CALL): {
+        uint16_t slot = READ_SHORT();
+        frame->ip += 2;
+        uint8_t callArgs = READ_BYTE();
+        Value callee = vm->globals.data[slot];
+        if (IS_UNDEFINED(callee)) {
+          undefinedGlobal(vm, slot);
+          return RUNTIME_ERROR;
+        }
+
+        push(vm, callee);
+        if (!tailCall(vm, frame, callArgs)) {
+          return RUNTIME_ERROR;
+        }
+        DISPATCH();
+      }
+      CASE(OP_RETURN): {
         Value val = pop(vm); // grab return value
         if (vm->frameCount - 1 == 0) {
           return INTERPRET_OK;
         }
 
-        setReturnVal(vm, val);
+        // the result takes the caller's slot where the arguments began
         vm->frameCount--;
         vm->stackTop = frame->basePointer;
-        break;
+        push(vm, val);
+        if (vm->frameCount < exitDepth) {
+          return INTERPRET_OK;
+        }
+        frame = &vm->frame[vm->frameCount - 1];
+        DISPATCH();
       }
+#ifndef THREADED_DISPATCH
     }
   }
+#endif
 
 #undef READ_BYTE
 #undef READ_CONSTANT
 #undef READ_SHORT
+#undef READ_LONG
+#undef TRACE_INSTRUCTION
+#undef PROFILE_INSTRUCTION
+#undef NUMBER_OPERANDS
+#undef QUICKEN
+#undef DEQUICKEN
+#undef NUMBER_OP
+#undef READ_RK
+#undef REGISTER_OP
+#undef REGISTER_BRANCH
+#undef ENTER_CALLEE
+#undef HOT_LOOP
+#undef ENTER_TRACE
+#undef CASE
+#undef DISPATCH
 }
 
 
 InterpretResult interpret(VM* vm, const char* source) {
+  useHeap(&vm->heap);
+
   Parser parser;
   Statements statements = parse(&parser, source);
 
-  if (compile(vm, &statements).hasError) {
+  if (parser.outOfMemory || compile(vm, &statements).hasError) {
     freeStatements(&statements);
     return COMPILE_ERROR;
   }
   freeStatements(&statements);
 
   vm->frameCount = 1;
+  vm->stackTop = vm->valueStack;
   CallFrame* frame = &vm->frame[vm->frameCount - 1];
   frame->basePointer = vm->valueStack;
   frame->func = vm->compiler->func;
   frame->ip = frame->func->chunk.code;
+  if (!ensureStack(vm, 0, frame->func->maxSlots)) {
+    return RUNTIME_ERROR;
+  }
 
-  return run(vm);
+  return run(vm, 1);
 }
@@ -0,0 +1,270 @@
+#ifdef JIT
+
+#include <x64.h>
+#include <memory.h>
+#include <string.h>
+#include <sys/mman.h>
+
+void initAssembler(Assembler* as, int labelCount) {
+  as->code = NULL;
+  as->count = 0;
+  as->capacity = 0;
+  as->labels = NULL;
+  as->labelCount = 0;
+  as->labelCapacity = 0;
+  as->fixups = NULL;
+  as->fixupCount = 0;
+  as->fixupCapacity = 0;
+  as->failed = false;
+
+  for (int i = 0; i < labelCount; i++) {
+    newLabel(as);
+  }
+}
+
+void freeAssembler(Assembler* as) {
+  FREE_ARRAY(uint8_t, as->code, as->capacity, MEM_JIT);
+  FREE_ARRAY(int, as->labels, as->labelCapacity, MEM_JIT);
+  FREE_ARRAY(Fixup, as->fixups, as->fixupCapacity, MEM_JIT);
+  initAssembler(as, 0);
+}
+
+int newLabel(Assembler* as) {
+  if (as->labelCount == as->labelCapacity) {
+    int capacity = GROW_CAPACITY(as->labelCapacity);
+    int* labels = GROW_ARRAY(int, as->labels, as->labelCapacity, capacity, MEM_JIT);
+    if (labels == NULL) {
+      as->failed = true;
+      return -1;
+    }
+    as->labels = labels;
+    as->labelCapacity = capacity;
+  }
+  as->labels[as->labelCount] = -1;
+  return as->labelCount++;
+}
+
+void placeLabel(Assembler* as, int label) {
+  if (as->failed) return;
+  as->labels[label] = as->count;
+}
+
+bool resolveFixups(Assembler* as) {
+  if (as->failed) return false;
+  for (int i = 0; i < as->fixupCount; i++) {
+    Fixup* fixup = &as->fixups[i];
+    if (fixup->label < 0 || fixup->label >= as->labelCount ||
+        as->labels[fixup->label] == -1) {
+      return false;
+    }
+    patchTo(as, fixup->at, as->labels[fixup->label]);
+  }
+  return true;
+}
+
+void* finishCode(Assembler* as) {
+  if (as->failed || !countMemory(0, as->count, MEM_JIT)) return NULL;
+
+  // written while writable, then flipped to executable
+  void* code = mmap(NULL, as->count, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    countMemory(as->count, 0, MEM_JIT);
+    return NULL;
+  }
+
+  memcpy(code, as->code, as->count);
+  if (mprotect(code, as->count, PROT_READ | PROT_EXEC) != 0) {
+    munmap(code, as->count);
+    countMemory(as->count, 0, MEM_JIT);
+    return NULL;
+  }
+  return code;
+}
+
+void freeCode(void* code, size_t size) {
+  if (code == NULL) return;
+  munmap(code, size);
+  countMemory(size, 0, MEM_JIT);
+}
+
+void emitByte(Assembler* as, uint8_t byte) {
+  if (as->failed) return;
+  if (as->count == as->capacity) {
+    int capacity = GROW_CAPACITY(as->capacity);
+    uint8_t* code = GROW_ARRAY(uint8_t, as->code, as->capacity, capacity, MEM_JIT);
+    if (code == NULL) {
+      as->failed = true;
+      return;
+    }
+    as->code = code;
+    as->capacity = capacity;
+  }
+  as->code[as->count++] = byte;
+}
+
+void emitBytes(Assembler* as, const uint8_t* bytes, int count) {
+  for (int i = 0; i < count; i++) {
+    emitByte(as, bytes[i]);
+  }
+}
+
+void emitInt32(Assembler* as, int32_t value) {
+  uint32_t bits = (uint32_t)value;
+  for (int i = 0; i < 4; i++) {
+    emitByte(as, (bits >> (8 * i)) & 0xff);
+  }
+}
+
+void emitInt64(Assembler* as, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    emitByte(as, (value >> (8 * i)) & 0xff);
+  }
+}
+
+static void emitRex(Assembler* as, bool wide, int reg, int rm) {
+  uint8_t rex = 0x40 | (wide ? 0x08 : 0) | ((reg >> 3) << 2) | (rm >> 3);
+  if (rex != 0x40) emitByte(as, rex);
+}
+
+static void emitModRmMem(Assembler* as, int reg, int base, int32_t disp) {
+  emitByte(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP) emitByte(as, 0x24);
+  emitInt32(as, disp);
+}
+
+void emitRegReg(Assembler* as, uint8_t opcode, int reg, int rm) {
+  emitRex(as, true, reg, rm);
+  emitByte(as, opcode);
+  emitByte(as, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void emitRegMem(Assembler* as, bool wide, uint8_t opcode, int reg, int base, int32_t disp) {
+  emitRex(as, wide, reg, base);
+  emitByte(as, opcode);
+  emitModRmMem(as, reg, base, disp);
+}
+
+void emitMov(Assembler* as, int dst, int src) {
+  emitRegReg(as, 0x89, src, dst);
+}
+
+void emitLoad(Assembler* as, int dst, int base, int32_t disp) {
+  emitRegMem(as, true, 0x8b, dst, base, disp);
+}
+
+void emitStore(Assembler* as, int base, int32_t disp, int src) {
+  emitRegMem(as, true, 0x89, src, base, disp);
+}
+
+void emitLea(Assembler* as, int dst, int base, int32_t disp) {
+  emitRegMem(as, true, 0x8d, dst, base, disp);
+}
+
+void emitMovImm64(Assembler* as, int reg, uint64_t value) {
+  emitRex(as, true, 0, reg);
+  emitByte(as, 0xb8 + (reg & 7));
+  emitInt64(as, value);
+}
+
+void emitMovImm32(Assembler* as, int reg, int32_t value) {
+  emitRex(as, false, 0, reg);
+  emitByte(as, 0xb8 + (reg & 7));
+  emitInt32(as, value);
+}
+
+void emitAluImm(Assembler* as, int ext, int reg, int32_t value) {
+  emitRegReg(as, 0x81, ext, reg);
+  emitInt32(as, value);
+}
+
+void emitPush(Assembler* as, int reg) {
+  emitRex(as, false, 0, reg);
+  emitByte(as, 0x50 + (reg & 7));
+}
+
+void emitPop(Assembler* as, int reg) {
+  emitRex(as, false, 0, reg);
+  emitByte(as, 0x58 + (reg & 7));
+}
+
+void emitCall(Assembler* as, void* func) {
+  emitMovImm64(as, RAX, (uint64_t)(uintptr_t)func);
+  emitBytes(as, (const uint8_t[]){0xff, 0xd0}, 2); // call rax
+}
+
+void emitSseRegReg(Assembler* as, uint8_t opcode, int dst, int src) {
+  emitBytes(as, (const uint8_t[]){0xf2, 0x0f, opcode}, 3);
+  emitByte(as, 0xc0 | ((dst & 7) << 3) | (src & 7));
+}
+
+void emitSseMem(Assembler* as, uint8_t opcode, int xmm, int base, int32_t disp) {
+  emitByte(as, 0xf2);
+  emitRex(as, false, xmm, base);
+  emitBytes(as, (const uint8_t[]){0x0f, opcode}, 2);
+  emitModRmMem(as, xmm, base, disp);
+}
+
+void emitMovqToXmm(Assembler* as, int xmm, int reg) {
+  emitBytes(as, (const uint8_t[]){0x66, 0x48, 0x0f, 0x6e}, 4);
+  emitByte(as, 0xc0 | ((xmm & 7) << 3) | (reg & 7));
+}
+
+void emitMovqFromXmm(Assembler* as, int reg, int xmm) {
+  emitBytes(as, (const uint8_t[]){0x66, 0x48, 0x0f, 0x7e}, 4);
+  emitByte(as, 0xc0 | ((xmm & 7) << 3) | (reg & 7));
+}
+
+void emitCompareDoubles(Assembler* as, int a, int b) {
+  emitBytes(as, (const uint8_t[]){0x66, 0x0f, 0x2e}, 3);
+  emitByte(as, 0xc0 | ((a & 7) << 3) | (b & 7));
+}
+
+int emitJcc(Assembler* as, uint8_t cc) {
+  emitByte(as, 0x0f);
+  emitByte(as, 0x80 | cc);
+  emitInt32(as, 0);
+  return as->count - 4;
+}
+
+int emitJmp(Assembler* as) {
+  emitByte(as, 0xe9);
+  emitInt32(as, 0);
+  return as->count - 4;
+}
+
+void patchTo(Assembler* as, int at, int target) {
+  // offsets handed out after a failure point at bytes never written
+  if (as->failed) return;
+  int32_t rel = target - (at + 4);
+  memcpy(as->code + at, &rel, sizeof(rel));
+}
+
+void patchHere(Assembler* as, int at) {
+  patchTo(as, at, as->count);
+}
+
+void addFixup(Assembler* as, int at, int label) {
+  if (as->failed) return;
+  if (as->fixupCount == as->fixupCapacity) {
+    int capacity = GROW_CAPACITY(as->fixupCapacity);
+    Fixup* fixups = GROW_ARRAY(Fixup, as->fixups, as->fixupCapacity, capacity, MEM_JIT);
+    if (fixups == NULL) {
+      as->failed = true;
+      return;
+    }
+    as->fixups = fixups;
+    as->fixupCapacity = capacity;
+  }
+  as->fixups[as->fixupCount++] = (Fixup){at, label};
+}
+
+void jumpTo(Assembler* as, uint8_t cc, int label) {
+  addFixup(as, emitJcc(as, cc), label);
+}
+
+void jumpAlwaysTo(Assembler* as, int label) {
+  addFixup(as, emitJmp(as), label);
+}
+
+#endif
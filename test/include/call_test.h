@@ -0,0 +1,6 @@
+#ifndef MCSCRIPT_VM_TEST_CALL_TEST_H
+#define MCSCRIPT_VM_TEST_CALL_TEST_H
+
+void testCalls();
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef MCSCRIPT_VM_TEST_JIT_TEST_H
+#define MCSCRIPT_VM_TEST_JIT_TEST_H
+
+void testJit();
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef MCSCRIPT_VM_TEST_STRING_TEST_H
+#define MCSCRIPT_VM_TEST_STRING_TEST_H
+
+void testStrings();
+
+#endif
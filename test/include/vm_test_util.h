@@ -0,0 +1,36 @@
+#ifndef MCSCRIPT_VM_TEST_VM_TEST_UTIL_H
+#define MCSCRIPT_VM_TEST_VM_TEST_UTIL_H
+
+#include <compiler.h>
+#include <object.h>
+#include <value.h>
+#include <vm.h>
+
+/**
+ * set up vm with compiler as its script compiler, for
+ * the test to adjust before it runs anything
+ */
+void startVM(VM* vm, Compiler* compiler);
+
+/**
+ * run source on a VM set up by startVM
+ * returns whether it ran without errors
+ */
+bool runSource(VM* vm, const char* source);
+
+/**
+ * set up a VM and run source on it, the VM is freed by the caller
+ */
+bool runScript(VM* vm, Compiler* compiler, const char* source);
+
+/**
+ * the value of a global, undefined if the script never set it
+ */
+Value getGlobal(VM* vm, const char* name);
+
+/**
+ * make a native the script can call by name
+ */
+void defineTestNative(VM* vm, const char* name, NativeFunc func, int arity, uint8_t flags);
+
+#endif
@@ -0,0 +1,181 @@
+#include <call_test.h>
+#include <vm_test_util.h>
+#include <chunk.h>
+#include <compiler.h>
+#include <object.h>
+#include <value.h>
+#include <vm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * the most frames a probe() call has seen on the VM
+ */
+static int deepest;
+
+static bool probe(VM* vm, int numArgs, Value* args, Value* result) {
+  (void)numArgs;
+  (void)args;
+  if (vm->frameCount > deepest) deepest = vm->frameCount;
+  *result = NULL_VAL;
+  return true;
+}
+
+static bool runProbed(VM* vm, Compiler* compiler, const char* source) {
+  startVM(vm, compiler);
+  defineTestNative(vm, "probe", probe, 0, NATIVE_NO_ALLOC);
+  deepest = 0;
+  return runSource(vm, source);
+}
+
+static bool hasTailCall(const Chunk* chunk) {
+  for (int offset = 0; offset < chunk->count;
+      offset += instructionSize(chunk->code[offset])) {
+    uint8_t instruction = chunk->code[offset];
+    if (instruction == OP_TAIL_CALL || instruction == OP_GET_GLOBAL_TAIL_CALL) return true;
+  }
+  return false;
+}
+
+static void testTailCalls() {
+  // far deeper than the frames the VM starts with
+  const char* tailSource =
+    "function down(n, acc) { probe(); if (n < 1) { return acc; } return down(n - 1, acc + 1); }"
+    "var result = down(10000, 0);";
+
+  Compiler compiler;
+  VM vm;
+  if (!runProbed(&vm, &compiler, tailSource)) {
+    fprintf(stderr, "tail recursion failed\n");
+    return;
+  }
+
+  // the script's frame and the one down reuses
+  if (deepest != 2 || vm.frameCapacity != FRAMES_INITIAL) {
+    fprintf(stderr, "tail calls took frames: deepest=%d capacity=%d\n",
+        deepest, vm.frameCapacity);
+    return;
+  }
+
+  Value result = getGlobal(&vm, "result");
+  if (!IS_NUM(result) || AS_NUMBER(result) != 10000) {
+    fprintf(stderr, "wrong result from tail recursion\n");
+    return;
+  }
+  if (!hasTailCall(&(AS_FUNC(getGlobal(&vm, "down")))->chunk)) {
+    fprintf(stderr, "down has no tail call\n");
+    return;
+  }
+  freeVM(&vm);
+
+  // adding to the call's result keeps it out of tail position
+  const char* notTailSource =
+    "function up(n) { probe(); if (n < 1) { return 0; } return up(n - 1) + 1; }"
+    "var result = up(40);";
+
+  if (!runProbed(&vm, &compiler, notTailSource)) {
+    fprintf(stderr, "non-tail recursion failed\n");
+    return;
+  }
+
+  if (deepest != 42) {
+    fprintf(stderr, "up(40) reached %d frames\n", deepest);
+    return;
+  }
+
+  result = getGlobal(&vm, "result");
+  if (!IS_NUM(result) || AS_NUMBER(result) != 40) {
+    fprintf(stderr, "wrong result from non-tail recursion\n");
+    return;
+  }
+  if (hasTailCall(&(AS_FUNC(getGlobal(&vm, "up")))->chunk)) {
+    fprintf(stderr, "up(n - 1) + 1 was compiled as a tail call\n");
+    return;
+  }
+
+  freeVM(&vm);
+  puts("testTailCalls() passed");
+}
+
+static void testStackGrowth() {
+  // non-tail calls with locals outgrow the initial frames and stack
+  const char* source =
+    "function up(n) {"
+    "  var a = n; var b = n * 2;"
+    "  if (n < 1) { return 0; }"
+    "  return up(n - 1) + b - a;"
+    "}"
+    "var result = up(3000);";
+
+  Compiler compiler;
+  VM vm;
+  if (!runScript(&vm, &compiler, source)) {
+    fprintf(stderr, "deep recursion failed\n");
+    return;
+  }
+
+  if (vm.frameCapacity <= FRAMES_INITIAL || vm.stackCapacity <= STACK_INITIAL) {
+    fprintf(stderr, "the stacks didn't grow: frames=%d values=%d\n",
+        vm.frameCapacity, vm.stackCapacity);
+    return;
+  }
+
+  Value result = getGlobal(&vm, "result");
+  if (!IS_NUM(result) || AS_NUMBER(result) != 3000 * 3001 / 2) {
+    fprintf(stderr, "wrong result from deep recursion\n");
+    return;
+  }
+
+  freeVM(&vm);
+  puts("testStackGrowth() passed");
+}
+
+static void testStackOverflow() {
+  // a few slots a frame run out of frames first
+  const char* deepSource =
+    "function deep(n) { return deep(n + 1) + 1; }"
+    "var result = deep(0);";
+
+  Compiler compiler;
+  VM vm;
+  if (runScript(&vm, &compiler, deepSource)) {
+    fprintf(stderr, "endless recursion didn't fail\n");
+    return;
+  }
+  if (vm.frameCapacity != FRAMES_MAX) {
+    fprintf(stderr, "overflowed with %d frames\n", vm.frameCapacity);
+    return;
+  }
+  freeVM(&vm);
+
+  // more than STACK_MAX / FRAMES_MAX locals a frame run out of stack first
+  char* wideSource = malloc(64 * 1024);
+  int length = sprintf(wideSource, "function wide(n) {");
+  for (int i = 0; i < 80; i++) {
+    // identifiers can't hold digits, the index is spelled in letters
+    length += sprintf(wideSource + length, "var l%c%c = n;", 'a' + i / 26, 'a' + i % 26);
+  }
+  sprintf(wideSource + length, "return wide(n + 1) + laa; } var result = wide(0);");
+
+  bool ok = runScript(&vm, &compiler, wideSource);
+  free(wideSource);
+  if (ok) {
+    fprintf(stderr, "endless recursion with wide frames didn't fail\n");
+    return;
+  }
+  if (vm.stackCapacity != STACK_MAX) {
+    fprintf(stderr, "overflowed with %d stack slots\n", vm.stackCapacity);
+    return;
+  }
+
+  freeVM(&vm);
+  puts("testStackOverflow() passed");
+}
+
+void testCalls() {
+  printf("=== Call Tests ===\n");
+  testTailCalls();
+  testStackGrowth();
+  testStackOverflow();
+}
@@ -0,0 +1,208 @@
+#include <chunk_test.h>
+#include <vm_test_util.h>
+#include <chunk.h>
+#include <compiler.h>
+#include <object.h>
+#include <value.h>
+#include <vm.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static ObjString* makeString(char* str) {
+  int length = strlen(str);
+  ObjString* string = malloc(STRING_SIZE(length));
+  string->obj.type = OBJ_STRING;
+  string->length = length;
+  string->hash = hashString(str, length);
+  memcpy(string->str, str, length + 1);
+
+  return string;
+}
+
+static bool hasInstruction(const Chunk* chunk, uint8_t instruction) {
+  for (int offset = 0; offset < chunk->count;
+      offset += instructionSize(chunk->code[offset])) {
+    if (chunk->code[offset] == instruction) return true;
+  }
+  return false;
+}
+
+static void testConstantDedup() {
+  Chunk chunk;
+  initChunk(&chunk);
+
+  int one = addConstant(&chunk, NUMBER_VAL(1.5));
+  if (addConstant(&chunk, NUMBER_VAL(1.5)) != one) {
+    fprintf(stderr, "equal numbers got different constants\n");
+    return;
+  }
+
+  int zero = addConstant(&chunk, NUMBER_VAL(0.0));
+  int negativeZero = addConstant(&chunk, NUMBER_VAL(-0.0));
+  if (zero == negativeZero) {
+    fprintf(stderr, "0 and -0 share a constant\n");
+    return;
+  }
+  if (addConstant(&chunk, NUMBER_VAL(-0.0)) != negativeZero) {
+    fprintf(stderr, "-0 was not deduplicated\n");
+    return;
+  }
+
+  int nan = addConstant(&chunk, NUMBER_VAL(NAN));
+  if (addConstant(&chunk, NUMBER_VAL(NAN)) != nan) {
+    fprintf(stderr, "NaN with the same bits got different constants\n");
+    return;
+  }
+
+  ObjString* hello = makeString("hello");
+  int str = addConstant(&chunk, OBJ_VAL(hello));
+  if (addConstant(&chunk, OBJ_VAL(hello)) != str) {
+    fprintf(stderr, "the same string got different constants\n");
+    return;
+  }
+  if (findStringConstant(&chunk, "hello", 5, hello->hash) != str) {
+    fprintf(stderr, "string constant not found by its characters\n");
+    return;
+  }
+  if (findStringConstant(&chunk, "help", 4, hashString("help", 4)) != -1) {
+    fprintf(stderr, "found a string constant that was never added\n");
+    return;
+  }
+
+  if (chunk.constants.count != 5) {
+    fprintf(stderr, "wrong constant count expected=5 got=%d\n",
+        chunk.constants.count);
+    return;
+  }
+
+  // enough distinct numbers to grow the index a few times
+  for (int i = 0; i < 1000; i++) {
+    if (addConstant(&chunk, NUMBER_VAL(i + 0.25)) != 5 + i) {
+      fprintf(stderr, "constant %d not appended\n", i);
+      return;
+    }
+  }
+  for (int i = 0; i < 1000; i++) {
+    if (addConstant(&chunk, NUMBER_VAL(i + 0.25)) != 5 + i) {
+      fprintf(stderr, "constant %d not found after growing\n", i);
+      return;
+    }
+  }
+
+  freeChunk(&chunk);
+  free(hello);
+  puts("testConstantDedup() passed");
+}
+
+static void testLineTable() {
+  LineTable lines;
+  initLineTable(&lines);
+
+  if (getLine(&lines, 0) != 0) {
+    fprintf(stderr, "empty line table has a line\n");
+    return;
+  }
+
+  // offsets 4-9 on line 10, 10-19 on line 11, 20 on line 13
+  for (int offset = 4; offset < 10; offset++) writeLine(&lines, offset, 10);
+  for (int offset = 10; offset < 20; offset++) writeLine(&lines, offset, 11);
+  writeLine(&lines, 20, 13);
+
+  if (lines.count != 3) {
+    fprintf(stderr, "wrong run count expected=3 got=%d\n", lines.count);
+    return;
+  }
+
+  int offsets[] = {0, 3, 4, 9, 10, 19, 20, 1000};
+  int expected[] = {0, 0, 10, 10, 11, 11, 13, 13};
+  for (int i = 0; i < 8; i++) {
+    int line = getLine(&lines, offsets[i]);
+    if (line != expected[i]) {
+      fprintf(stderr, "wrong line at offset %d expected=%d got=%d\n",
+          offsets[i], expected[i], line);
+      return;
+    }
+  }
+
+  freeLineTable(&lines);
+  puts("testLineTable() passed");
+}
+
+static void testLongConstants() {
+  // 300 distinct constants push the later ones past a one-byte index
+  char* source = malloc(300 * 32);
+  int length = sprintf(source, "var s = 0;");
+  for (int i = 0; i < 300; i++) {
+    length += sprintf(source + length, "s = s + %d.5;", i);
+  }
+
+  Compiler compiler;
+  VM vm;
+  bool ok = runScript(&vm, &compiler, source);
+  free(source);
+
+  if (!ok) {
+    fprintf(stderr, "script with long constants failed\n");
+    return;
+  }
+
+  if (!hasInstruction(&CURRENT_CHUNK((&vm)), OP_CONSTANT_LONG)) {
+    fprintf(stderr, "no OP_CONSTANT_LONG in the chunk\n");
+    return;
+  }
+
+  Value sum = getGlobal(&vm, "s");
+  if (!IS_NUM(sum) || AS_NUMBER(sum) != 300 * 299 / 2 + 150) {
+    fprintf(stderr, "wrong sum of long constants\n");
+    return;
+  }
+
+  freeVM(&vm);
+  puts("testLongConstants() passed");
+}
+
+static void testLongJumps() {
+  // the then block is too long for a two-byte jump, so the script
+  // is compiled again with long jumps
+  char* source = malloc(8000 * 16);
+  int length = sprintf(source, "var x = 0; var y = 0; var flag = true; if (flag) {");
+  for (int i = 0; i < 8000; i++) {
+    length += sprintf(source + length, "x = x + 1;");
+  }
+  sprintf(source + length, "} else { x = -1; } y = 1;");
+
+  Compiler compiler;
+  VM vm;
+  bool ok = runScript(&vm, &compiler, source);
+  free(source);
+
+  if (!ok) {
+    fprintf(stderr, "script with long jumps failed\n");
+    return;
+  }
+
+  if (!hasInstruction(&CURRENT_CHUNK((&vm)), OP_JUMP_IF_FALSE_LONG)) {
+    fprintf(stderr, "no OP_JUMP_IF_FALSE_LONG in the chunk\n");
+    return;
+  }
+
+  Value x = getGlobal(&vm, "x");
+  Value y = getGlobal(&vm, "y");
+  if (!IS_NUM(x) || AS_NUMBER(x) != 8000 || !IS_NUM(y) || AS_NUMBER(y) != 1) {
+    fprintf(stderr, "wrong result across long jumps\n");
+    return;
+  }
+
+  freeVM(&vm);
+  puts("testLongJumps() passed");
+}
+
+void testChunk() {
+  printf("=== Chunk Tests ===\n");
+  testConstantDedup();
+  testLineTable();
+  testLongConstants();
+  testLongJumps();
+}
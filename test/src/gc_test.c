@@ -0,0 +1,263 @@
+#include <gc_test.h>
+#include <vm_test_util.h>
+#include <compiler.h>
+#include <gc.h>
+#include <object.h>
+#include <value.h>
+#include <vm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * collect(): a minor and then a full collection in the middle of a script
+ */
+static bool collect(VM* vm, int numArgs, Value* args, Value* result) {
+  (void)numArgs;
+  (void)args;
+  collectNursery(vm, NULL, 0);
+  collectGarbage(vm);
+  *result = NULL_VAL;
+  return true;
+}
+
+/**
+ * whether a watch() call found a collection cycle half done
+ */
+static bool sawCycle;
+
+static bool watch(VM* vm, int numArgs, Value* args, Value* result) {
+  (void)numArgs;
+  (void)args;
+  if (vm->gcPhase != GC_IDLE) sawCycle = true;
+  *result = NULL_VAL;
+  return true;
+}
+
+/**
+ * run source with the collector pausing for at most pauseMicros per
+ * step and collecting early under softLimit bytes (0 for none)
+ */
+static bool runCollecting(VM* vm, Compiler* compiler, const char* source,
+    int pauseMicros, size_t softLimit) {
+  startVM(vm, compiler);
+  vm->gcPauseMicros = pauseMicros;
+  setHeapLimits(&vm->heap, softLimit, 0);
+  defineTestNative(vm, "collect", collect, 0, 0);
+  defineTestNative(vm, "watch", watch, 0, NATIVE_NO_ALLOC);
+
+  sawCycle = false;
+  return runSource(vm, source);
+}
+
+/**
+ * whether value is a string (or rope) of count copies of piece and then tail
+ */
+static bool hasContents(VM* vm, Value value, const char* piece, int count, const char* tail) {
+  if (!IS_STRING(value) && !IS_ROPE(value)) return false;
+
+  ObjString* str = flattenString(vm, value);
+  int pieceLength = strlen(piece);
+  int tailLength = strlen(tail);
+  if (str == NULL || str->length != pieceLength * count + tailLength) return false;
+
+  for (int i = 0; i < count; i++) {
+    if (memcmp(str->str + i * pieceLength, piece, pieceLength) != 0) return false;
+  }
+  return memcmp(str->str + count * pieceLength, tail, tailLength) == 0;
+}
+
+static int countObjects(VM* vm) {
+  int count = 0;
+  for (Obj* obj = vm->objects; obj != NULL; obj = obj->next) count++;
+  return count;
+}
+
+static void testCollectKeepsLive() {
+  // live values in globals, in a frame's locals and in function
+  // constants, around collections and plenty of garbage
+  const char* source =
+    "function build(n) {"
+    "  var s = \"\"; var i = 0;"
+    "  while (i < n) { s = s + \"abcdefgh\"; i = i + 1; }"
+    "  return s;"
+    "}"
+    "function hold() {"
+    "  var mine = build(20); var other = \"lo\" + \"cal\";"
+    "  build(50); collect();"
+    "  return mine + other;"
+    "}"
+    "var kept = build(30);"
+    "var junk = build(100); junk = 0;"
+    "collect();"
+    "var held = hold();"
+    "collect();"
+    "var constant = \"from a constant\";";
+
+  Compiler compiler;
+  VM vm;
+  if (!runCollecting(&vm, &compiler, source, 0, 0)) {
+    fprintf(stderr, "collection script failed\n");
+    return;
+  }
+
+  if (!hasContents(&vm, getGlobal(&vm, "kept"), "abcdefgh", 30, "") ||
+      !hasContents(&vm, getGlobal(&vm, "held"), "abcdefgh", 20, "local") ||
+      !hasContents(&vm, getGlobal(&vm, "constant"), "from a constant", 1, "")) {
+    fprintf(stderr, "a live string did not survive collection\n");
+    return;
+  }
+
+  // unreachable strings are freed, reachable ones stay
+  int before = countObjects(&vm);
+  for (int i = 0; i < 100; i++) {
+    char garbage[16];
+    int length = sprintf(garbage, "garbage %d", i);
+    copyString(&vm, garbage, length);
+  }
+  collectGarbage(&vm);
+  if (countObjects(&vm) > before) {
+    fprintf(stderr, "garbage survived a collection\n");
+    return;
+  }
+  if (!hasContents(&vm, getGlobal(&vm, "kept"), "abcdefgh", 30, "")) {
+    fprintf(stderr, "kept did not survive a second collection\n");
+    return;
+  }
+
+  freeVM(&vm);
+  puts("testCollectKeepsLive() passed");
+}
+
+static void testNurseryPromotion() {
+  // a few young globals go through the remembered set, more than
+  // REMEMBERED_MAX make the minor collection scan every global
+  int counts[] = {3, REMEMBERED_MAX + 6};
+  for (int run = 0; run < 2; run++) {
+    char* source = malloc(4096);
+    int length = 0;
+    for (int i = 0; i < counts[run]; i++) {
+      // identifiers can't hold digits, the index is spelled in letters
+      length += sprintf(source + length, "var g%c%c = \"y\" + \"%c%c\";",
+          'a' + i / 26, 'a' + i % 26, 'a' + i / 26, 'a' + i % 26);
+    }
+    sprintf(source + length,
+        "function hold() { var mine = \"lo\" + \"cal\"; collect(); return mine; }"
+        "var held = hold();");
+
+    Compiler compiler;
+    VM vm;
+    bool ok = runCollecting(&vm, &compiler, source, 0, 0);
+    free(source);
+    if (!ok) {
+      fprintf(stderr, "nursery script failed\n");
+      return;
+    }
+
+    for (int i = 0; i < counts[run]; i++) {
+      char name[16];
+      char contents[16];
+      sprintf(name, "g%c%c", 'a' + i / 26, 'a' + i % 26);
+      sprintf(contents, "y%c%c", 'a' + i / 26, 'a' + i % 26);
+      Value global = getGlobal(&vm, name);
+      if (!hasContents(&vm, global, contents, 1, "") || IS_YOUNG(&vm, AS_OBJ(global))) {
+        fprintf(stderr, "%s was not promoted with %d young globals\n", name, counts[run]);
+        return;
+      }
+    }
+
+    Value held = getGlobal(&vm, "held");
+    if (!hasContents(&vm, held, "local", 1, "") || IS_YOUNG(&vm, AS_OBJ(held))) {
+      fprintf(stderr, "a young local was not promoted\n");
+      return;
+    }
+
+    freeVM(&vm);
+  }
+
+  // thousands of distinct short strings fill the nursery several times
+  const char* source =
+    "var early = \"ear\" + \"ly\";"
+    "var a = \"\"; var p = 0;"
+    "while (p < 20) {"
+    "  a = a + \"a\"; var b = \"\"; var q = 0;"
+    "  while (q < 20) {"
+    "    b = b + \"b\"; var c = \"\"; var r = 0;"
+    "    while (r < 20) { c = c + \"c\"; var s = a + b + c; r = r + 1; }"
+    "    q = q + 1;"
+    "  }"
+    "  p = p + 1;"
+    "}";
+
+  Compiler compiler;
+  VM vm;
+  if (!runCollecting(&vm, &compiler, source, 0, 0)) {
+    fprintf(stderr, "nursery churn script failed\n");
+    return;
+  }
+
+  Value early = getGlobal(&vm, "early");
+  if (!hasContents(&vm, early, "early", 1, "") || IS_YOUNG(&vm, AS_OBJ(early))) {
+    fprintf(stderr, "early was not promoted when the nursery filled\n");
+    return;
+  }
+  if (!hasContents(&vm, getGlobal(&vm, "a"), "a", 20, "")) {
+    fprintf(stderr, "a changed across minor collections\n");
+    return;
+  }
+
+  freeVM(&vm);
+  puts("testNurseryPromotion() passed");
+}
+
+static void testIncremental() {
+  // a long chain of ropes stays live while every 64KB of allocation
+  // does a collector step
+  const char* source =
+    "function build(n) {"
+    "  var s = \"\"; var i = 0;"
+    "  while (i < n) { s = s + \"abcdefgh\" + \"ijklmnop\"; i = i + 1; }"
+    "  return s;"
+    "}"
+    "var keep = \"start\"; var r = 0;"
+    "while (r < 300) { var t = build(20); keep = t + keep; watch(); r = r + 1; }";
+
+  // one step finishes the cycle, or a small budget spreads it out
+  int pauses[] = {0, 1};
+  for (int i = 0; i < 2; i++) {
+    Compiler compiler;
+    VM vm;
+    if (!runCollecting(&vm, &compiler, source, pauses[i], 1)) {
+      fprintf(stderr, "script failed with a %dus pause\n", pauses[i]);
+      return;
+    }
+
+#ifndef DEBUG_STRESS_GC
+    // stress builds collect everything at every allocation instead
+    if (sawCycle != (pauses[i] != 0)) {
+      fprintf(stderr, "with a %dus pause a cycle was %s\n", pauses[i],
+          sawCycle ? "left half done" : "never left half done");
+      return;
+    }
+#endif
+
+    // finish the running cycle, then do another whole one
+    collectGarbage(&vm);
+    collectGarbage(&vm);
+    if (!hasContents(&vm, getGlobal(&vm, "keep"), "abcdefghijklmnop", 20 * 300, "start")) {
+      fprintf(stderr, "keep changed with a %dus pause\n", pauses[i]);
+      return;
+    }
+
+    freeVM(&vm);
+  }
+
+  puts("testIncremental() passed");
+}
+
+void testGc() {
+  printf("=== Garbage Collector Tests ===\n");
+  testCollectKeepsLive();
+  testNurseryPromotion();
+  testIncremental();
+}
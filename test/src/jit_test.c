@@ -0,0 +1,340 @@
+#include <jit_test.h>
+#include <vm_test_util.h>
+#include <jit.h>
+#include <trace.h>
+#include <compiler.h>
+#include <gc.h>
+#include <object.h>
+#include <value.h>
+#include <vm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * hot functions over numbers, strings, recursion, tail calls and
+ * loops, each leaving its result in a global
+ */
+static const char* hotSource =
+  "function add(a, b) { return a + b; }"
+  "function fib(n) { if (n < 2) { return n; } return fib(n - 1) + fib(n - 2); }"
+  "function count(n) {"
+  "  var i = 0; var s = 0;"
+  "  while (i < n) { s = s + i * 2; if (i > n / 2) { s = s - 1; } i = i + 1; }"
+  "  return s;"
+  "}"
+  "function loop(n, acc) { if (n < 1) { return acc; } return loop(n - 1, acc + n); }"
+  "function same(a, b) { return a == b; }"
+  "function poly(x) { return x * x * 0.5 - x / 4; }"
+  "var sum = 0; var hits = 0; var i = 0;"
+  "while (i < 200) {"
+  "  sum = add(sum, poly(i));"
+  "  if (same(i, 50)) { hits = hits + 1; }"
+  "  i = i + 1;"
+  "}"
+  "var f = fib(20);"
+  "var c = count(5000);"
+  "var t = loop(10000, 0);"
+  "var s = add(\"ab\", \"cd\");"
+  "var m = add(1.5, -0.25);"
+  "var e = same(\"x\" + \"y\", \"xy\");";
+
+static const char* resultNames[] = {"sum", "hits", "f", "c", "t", "s", "m", "e"};
+
+static bool runWithJit(VM* vm, Compiler* compiler, const char* source, bool jit) {
+  startVM(vm, compiler);
+  vm->jitEnabled = jit;
+  return runSource(vm, source);
+}
+
+/**
+ * strings from two VMs are different objects, they match by contents
+ */
+static bool sameResult(Value a, Value b) {
+  if (IS_STRING(a) && IS_STRING(b)) {
+    ObjString* x = AS_STRING(a);
+    ObjString* y = AS_STRING(b);
+    return x->length == y->length && memcmp(x->str, y->str, x->length) == 0;
+  }
+  return valuesEqual(a, b);
+}
+
+static void testJitMatchesInterpreter() {
+  Compiler jitCompiler;
+  VM jitVM;
+  Compiler compiler;
+  VM vm;
+
+  if (!runWithJit(&jitVM, &jitCompiler, hotSource, true)) {
+    fprintf(stderr, "script failed with the JIT\n");
+    return;
+  }
+  if (!runWithJit(&vm, &compiler, hotSource, false)) {
+    fprintf(stderr, "script failed without the JIT\n");
+    return;
+  }
+
+  for (int i = 0; i < 8; i++) {
+    Value compiled = getGlobal(&jitVM, resultNames[i]);
+    Value interpreted = getGlobal(&vm, resultNames[i]);
+    if (!sameResult(compiled, interpreted)) {
+      fprintf(stderr, "%s differs between the JIT and the interpreter\n",
+          resultNames[i]);
+      return;
+    }
+  }
+
+#ifdef JIT
+  // every hot function was compiled, and none while the JIT was off
+  const char* hot[] = {"add", "fib", "same", "poly"};
+  for (int i = 0; i < 4; i++) {
+    if ((AS_FUNC(getGlobal(&jitVM, hot[i])))->jitCode == NULL) {
+      fprintf(stderr, "%s was not compiled\n", hot[i]);
+      return;
+    }
+    if ((AS_FUNC(getGlobal(&vm, hot[i])))->jitCode != NULL) {
+      fprintf(stderr, "%s was compiled with the JIT off\n", hot[i]);
+      return;
+    }
+  }
+#endif
+
+  freeVM(&jitVM);
+  freeVM(&vm);
+  puts("testJitMatchesInterpreter() passed");
+}
+
+static void testTraceSideExit() {
+  // the loop is hot long before x turns into a string, from then on
+  // the trace's branch guards exit to the interpreter. total is a
+  // global stored by every iteration of the trace
+  const char* source =
+    "var total = 0;"
+    "function spin(n) {"
+    "  var x = 0; var i = 0;"
+    "  while (i < n) {"
+    "    if (i == 2000) { x = \"s\"; }"
+    "    if (i < 2000) { x = x + 1; } else { x = x + \"t\"; }"
+    "    total = total + i;"
+    "    i = i + 1;"
+    "  }"
+    "  return x;"
+    "}"
+    "var result = spin(2010);";
+
+  Compiler jitCompiler;
+  VM jitVM;
+  Compiler compiler;
+  VM vm;
+
+  if (!runWithJit(&jitVM, &jitCompiler, source, true) ||
+      !runWithJit(&vm, &compiler, source, false)) {
+    fprintf(stderr, "traced script failed\n");
+    return;
+  }
+
+  const char* names[] = {"total", "result"};
+  for (int i = 0; i < 2; i++) {
+    if (!sameResult(getGlobal(&jitVM, names[i]), getGlobal(&vm, names[i]))) {
+      fprintf(stderr, "%s differs between the trace and the interpreter\n", names[i]);
+      return;
+    }
+  }
+
+  Value total = getGlobal(&vm, "total");
+  if (!IS_NUM(total) || AS_NUMBER(total) != 2009 * 2010 / 2) {
+    fprintf(stderr, "wrong total from the traced loop\n");
+    return;
+  }
+
+#ifdef JIT
+  ObjFunction* spin = AS_FUNC(getGlobal(&jitVM, "spin"));
+  if (spin->loopTraceCount == 0 || spin->loopTraces[0].code == NULL) {
+    fprintf(stderr, "the loop in spin was not traced\n");
+    return;
+  }
+  if ((AS_FUNC(getGlobal(&vm, "spin")))->loopTraceCount != 0) {
+    fprintf(stderr, "the loop in spin was traced with the JIT off\n");
+    return;
+  }
+#endif
+
+  freeVM(&jitVM);
+  freeVM(&vm);
+  puts("testTraceSideExit() passed");
+}
+
+/**
+ * calls to noop() and other(), both natives that don't allocate
+ */
+static int noopCalls;
+static int otherCalls;
+
+static bool noop(VM* vm, int numArgs, Value* args, Value* result) {
+  (void)vm;
+  (void)numArgs;
+  (void)args;
+  noopCalls++;
+  *result = NULL_VAL;
+  return true;
+}
+
+static bool other(VM* vm, int numArgs, Value* args, Value* result) {
+  (void)vm;
+  (void)numArgs;
+  (void)args;
+  otherCalls++;
+  *result = NULL_VAL;
+  return true;
+}
+
+static bool collect(VM* vm, int numArgs, Value* args, Value* result) {
+  (void)numArgs;
+  (void)args;
+  collectGarbage(vm);
+  collectGarbage(vm);
+  *result = NULL_VAL;
+  return true;
+}
+
+/**
+ * renew(): noop becomes a new native for other(), which the pools
+ * hand the block of a collected native
+ */
+static bool renew(VM* vm, int numArgs, Value* args, Value* result) {
+  (void)numArgs;
+  (void)args;
+  int slot = resolveGlobalSlot(vm, "noop", 4);
+  vm->globals.data[slot] = OBJ_VAL(newNative(vm, other, 0, NATIVE_NO_ALLOC));
+  *result = NULL_VAL;
+  return true;
+}
+
+static void testNativeGuard() {
+  // tick calls noop straight from compiled code, then noop is given
+  // another native, a native made where the old one was, or a string
+  const char* hot =
+    "function tick(n) { noop(); return n + 1; }"
+    "var i = 0; while (i < 200) { tick(i); i = i + 1; }";
+  const char* tails[] = {
+    "noop = other; tick(1);",
+    "noop = \"x\"; collect(); renew(); tick(1);",
+    "noop = \"x\"; tick(1);"
+  };
+
+  for (int i = 0; i < 3; i++) {
+    char source[512];
+    sprintf(source, "%s%s", hot, tails[i]);
+
+    Compiler compiler;
+    VM vm;
+    startVM(&vm, &compiler);
+    vm.jitEnabled = true;
+    defineTestNative(&vm, "noop", noop, 0, NATIVE_NO_ALLOC);
+    defineTestNative(&vm, "other", other, 0, NATIVE_NO_ALLOC);
+    defineTestNative(&vm, "collect", collect, 0, 0);
+    defineTestNative(&vm, "renew", renew, 0, 0);
+    noopCalls = 0;
+    otherCalls = 0;
+
+    bool ok = runSource(&vm, source);
+    if (ok != (i < 2)) {
+      fprintf(stderr, "calling a reassigned noop %s\n", ok ? "didn't fail" : "failed");
+      return;
+    }
+    if (noopCalls != 200 || otherCalls != (i < 2 ? 1 : 0)) {
+      fprintf(stderr, "the old noop was called after it was reassigned\n");
+      return;
+    }
+
+    freeVM(&vm);
+  }
+
+  puts("testNativeGuard() passed");
+}
+
+#ifdef JIT
+static void testJitThreshold() {
+  char source[256];
+  for (int calls = JIT_THRESHOLD - 1; calls <= JIT_THRESHOLD; calls++) {
+    sprintf(source,
+        "function inc(a) { return a + 1; }"
+        "var n = 0; var i = 0;"
+        "while (i < %d) { n = inc(n); i = i + 1; }", calls);
+
+    Compiler compiler;
+    VM vm;
+    if (!runWithJit(&vm, &compiler, source, true)) {
+      fprintf(stderr, "threshold script failed\n");
+      return;
+    }
+
+    ObjFunction* inc = AS_FUNC(getGlobal(&vm, "inc"));
+    bool compiled = inc->jitCode != NULL;
+    if (compiled != (calls == JIT_THRESHOLD)) {
+      fprintf(stderr, "inc after %d calls: compiled=%d\n", calls, compiled);
+      return;
+    }
+
+    Value n = getGlobal(&vm, "n");
+    if (!IS_NUM(n) || AS_NUMBER(n) != calls) {
+      fprintf(stderr, "wrong count after %d calls\n", calls);
+      return;
+    }
+
+    freeVM(&vm);
+  }
+
+  puts("testJitThreshold() passed");
+}
+
+static void testJitBailout() {
+  // compiled for numbers, then given strings and a bad operand: the
+  // number guards fail and the generic paths take over
+  const char* source =
+    "function sub(a, b) { return a - b; }"
+    "function add(a, b) { return a + b; }"
+    "var i = 0; var n = 0;"
+    "while (i < 100) { n = add(n, sub(i, 1)); i = i + 1; }"
+    "var s = add(\"con\", \"cat\");"
+    "var bad = sub(\"x\", 1);";
+
+  Compiler compiler;
+  VM vm;
+  if (runWithJit(&vm, &compiler, source, true)) {
+    fprintf(stderr, "subtracting from a string didn't fail\n");
+    return;
+  }
+
+  if ((AS_FUNC(getGlobal(&vm, "add")))->jitCode == NULL) {
+    fprintf(stderr, "add was not compiled\n");
+    return;
+  }
+
+  Value n = getGlobal(&vm, "n");
+  if (!IS_NUM(n) || AS_NUMBER(n) != 4850) {
+    fprintf(stderr, "wrong sum from compiled code\n");
+    return;
+  }
+
+  Value s = getGlobal(&vm, "s");
+  if (!IS_STRING(s) || strcmp(AS_CSTRING(s), "concat") != 0) {
+    fprintf(stderr, "compiled add didn't concatenate strings\n");
+    return;
+  }
+
+  freeVM(&vm);
+  puts("testJitBailout() passed");
+}
+#endif
+
+void testJit() {
+  printf("=== JIT Tests ===\n");
+  testJitMatchesInterpreter();
+  testTraceSideExit();
+  testNativeGuard();
+#ifdef JIT
+  testJitThreshold();
+  testJitBailout();
+#endif
+}
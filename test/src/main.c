@@ -1,9 +1,21 @@
 #include <parser_test.h>
 #include <table_test.h>
+#include <chunk_test.h>
+#include <call_test.h>
+#include <jit_test.h>
+#include <string_test.h>
+#include <gc_test.h>
+#include <memory_test.h>
 
 int main() {
 
   testParser();
   testTable();
+  testChunk();
+  testCalls();
+  testJit();
+  testStrings();
+  testGc();
+  testMemory();
   return 0;
 }
@@ -0,0 +1,292 @@
+#include <memory_test.h>
+#include <vm_test_util.h>
+#include <memory.h>
+#include <compiler.h>
+#include <gc.h>
+#include <value.h>
+#include <vm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool holdsBytes(const uint8_t* block, int count) {
+  for (int i = 0; i < count; i++) {
+    if (block[i] != (uint8_t)i) return false;
+  }
+  return true;
+}
+
+static void testPools() {
+  Heap heap;
+  initHeap(&heap);
+  useHeap(&heap);
+
+  // a freed block is handed out again for any size in its class
+  uint8_t* first = reallocate(NULL, 0, 40, MEM_CODE);
+  reallocate(first, 40, 0, MEM_CODE);
+  uint8_t* block = reallocate(NULL, 0, 48, MEM_CODE);
+  if (block != first) {
+    fprintf(stderr, "a freed block was not reused in its class\n");
+    return;
+  }
+
+  // resizing within the class keeps the block
+  for (int i = 0; i < 33; i++) block[i] = i;
+  if (reallocate(block, 48, 33, MEM_CODE) != block) {
+    fprintf(stderr, "resizing within a class moved the block\n");
+    return;
+  }
+
+  // across classes, and past POOL_MAX to malloc and back, the bytes move along
+  uint8_t* bigger = reallocate(block, 33, 200, MEM_CODE);
+  if (bigger == block || !holdsBytes(bigger, 33)) {
+    fprintf(stderr, "resizing to a bigger class lost the contents\n");
+    return;
+  }
+  uint8_t* large = reallocate(bigger, 200, POOL_MAX + 100, MEM_CODE);
+  if (large == NULL || !holdsBytes(large, 33)) {
+    fprintf(stderr, "resizing past POOL_MAX lost the contents\n");
+    return;
+  }
+  uint8_t* small = reallocate(large, POOL_MAX + 100, 20, MEM_CODE);
+  if (small == NULL || !holdsBytes(small, 20)) {
+    fprintf(stderr, "resizing back into the pools lost the contents\n");
+    return;
+  }
+
+  // the block left behind by the move to a bigger class is free again
+  if (reallocate(NULL, 0, 48, MEM_CODE) != block) {
+    fprintf(stderr, "the block a resize moved out of was not freed\n");
+    return;
+  }
+
+  if (heap.bytes != 48 + 20) {
+    fprintf(stderr, "wrong byte count after resizing expected=68 got=%zu\n", heap.bytes);
+    return;
+  }
+
+  useHeap(NULL);
+  freeHeap(&heap);
+  puts("testPools() passed");
+}
+
+static void testFreeHeap() {
+  Heap heap;
+  initHeap(&heap);
+  useHeap(&heap);
+
+  // more blocks of the largest class than one arena holds
+  int count = POOL_ARENA_SIZE / POOL_MAX + 100;
+  void** blocks = malloc(sizeof(void*) * count);
+  for (int i = 0; i < count; i++) {
+    blocks[i] = reallocate(NULL, 0, POOL_MAX, MEM_TABLE);
+  }
+  if (heap.arenas == NULL) {
+    fprintf(stderr, "the blocks didn't come from an arena\n");
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    reallocate(blocks[i], POOL_MAX, 0, MEM_TABLE);
+  }
+  free(blocks);
+
+  freeHeap(&heap);
+  if (heap.arenas != NULL || heap.arenaTop != NULL) {
+    fprintf(stderr, "freeHeap kept an arena\n");
+    return;
+  }
+  for (int i = 0; i < POOL_CLASSES; i++) {
+    if (heap.freeLists[i] != NULL) {
+      fprintf(stderr, "freeHeap kept the blocks of class %d\n", i);
+      return;
+    }
+  }
+
+  // the heap starts over with a new arena
+  void* block = reallocate(NULL, 0, 64, MEM_TABLE);
+  if (block == NULL || heap.arenas == NULL) {
+    fprintf(stderr, "no allocation after freeHeap\n");
+    return;
+  }
+  reallocate(block, 64, 0, MEM_TABLE);
+
+  useHeap(NULL);
+  freeHeap(&heap);
+  puts("testFreeHeap() passed");
+}
+
+static void testKindCounters() {
+  Heap heap;
+  initHeap(&heap);
+  useHeap(&heap);
+
+  void* string = reallocate(NULL, 0, 100, MEM_STRING);
+  void* code = reallocate(NULL, 0, 1000, MEM_CODE);
+  code = reallocate(code, 1000, 600, MEM_CODE);
+  reallocate(string, 100, 0, MEM_STRING);
+
+  if (heap.bytes != 600 || heap.peak != 1100) {
+    fprintf(stderr, "wrong totals bytes=%zu peak=%zu\n", heap.bytes, heap.peak);
+    return;
+  }
+  if (heap.kindBytes[MEM_STRING] != 0 || heap.kindPeak[MEM_STRING] != 100 ||
+      heap.kindBytes[MEM_CODE] != 600 || heap.kindPeak[MEM_CODE] != 1000) {
+    fprintf(stderr, "wrong per-kind counts\n");
+    return;
+  }
+  reallocate(code, 600, 0, MEM_CODE);
+
+  useHeap(NULL);
+  freeHeap(&heap);
+
+  // a script's heap is charged to the kinds it used
+  Compiler compiler;
+  VM vm;
+  if (!runScript(&vm, &compiler,
+      "function join(a, b) { return a + b; } var s = join(\"ab\", \"cd\");")) {
+    fprintf(stderr, "counted script failed\n");
+    return;
+  }
+
+  MemoryKind used[] = {MEM_STRING, MEM_FUNCTION, MEM_NATIVE, MEM_CODE,
+    MEM_CONSTANTS, MEM_TABLE, MEM_AST, MEM_VM};
+  size_t sum = 0;
+  for (int i = 0; i < MEM_KIND_COUNT; i++) sum += vm.heap.kindBytes[i];
+  if (sum != vm.heap.bytes) {
+    fprintf(stderr, "the kinds add up to %zu of %zu bytes\n", sum, vm.heap.bytes);
+    return;
+  }
+  for (int i = 0; i < 8; i++) {
+    if (vm.heap.kindPeak[used[i]] == 0) {
+      fprintf(stderr, "nothing was counted as %s\n", memoryKindName(used[i]));
+      return;
+    }
+  }
+  // the AST is gone once the script is compiled
+  if (vm.heap.kindBytes[MEM_AST] != 0) {
+    fprintf(stderr, "the AST is still held after compiling\n");
+    return;
+  }
+
+  freeVM(&vm);
+  puts("testKindCounters() passed");
+}
+
+/**
+ * plenty of ropes that are garbage as soon as they're made
+ */
+static const char* garbageSource =
+  "function build(n) {"
+  "  var s = \"\"; var i = 0;"
+  "  while (i < n) { s = s + \"abcdefgh\" + \"ijklmnop\"; i = i + 1; }"
+  "  return s;"
+  "}"
+  "var r = 0; while (r < 1000) { build(40); r = r + 1; }"
+  "var kept = build(40) == build(40);";
+
+static void testSoftLimit() {
+  // the peak without a limit, then with one well under it
+  size_t peaks[2];
+  size_t softLimit = 0;
+  for (int run = 0; run < 2; run++) {
+    Compiler compiler;
+    VM vm;
+    startVM(&vm, &compiler);
+    // whole collections, a timed step does less work on a busy machine
+    vm.gcPauseMicros = 0;
+    if (run == 1) {
+      softLimit = vm.heap.bytes + (peaks[0] - vm.heap.bytes) / 2;
+      setHeapLimits(&vm.heap, softLimit, 0);
+      if (vm.heap.nextGC > softLimit) {
+        fprintf(stderr, "the next collection is past the soft limit\n");
+        return;
+      }
+    }
+
+    if (!runSource(&vm, garbageSource)) {
+      fprintf(stderr, "garbage script failed\n");
+      return;
+    }
+    Value kept = getGlobal(&vm, "kept");
+    if (!IS_BOOL(kept) || !AS_BOOL(kept)) {
+      fprintf(stderr, "wrong result under a soft limit\n");
+      return;
+    }
+
+    peaks[run] = vm.heap.peak;
+    freeVM(&vm);
+  }
+
+  // a collection step runs every GC_STEP_BYTES past the limit
+  if (peaks[1] > softLimit + GC_STEP_BYTES) {
+    fprintf(stderr, "the heap grew to %zu bytes under a soft limit of %zu\n",
+        peaks[1], softLimit);
+    return;
+  }
+
+  puts("testSoftLimit() passed");
+}
+
+static void testHardLimit() {
+  // from no room at all to enough: the parse, the compile or the run
+  // fails for want of memory, and nothing is held past the limit
+  const char* source =
+    "function add(a, b) { return a + b; }"
+    "function twice(f, x) { return f(f(x, x), x); }"
+    "var names = \"ab\" + \"cd\";"
+    "var i = 0; var n = 0;"
+    "while (i < 100) { n = twice(add, n + i); i = i + 1; }";
+
+  bool compileFailed = false;
+  bool ran = false;
+  for (size_t extra = 0; extra <= 128 * 1024 && !ran; extra += 512) {
+    Compiler compiler;
+    VM vm;
+    startVM(&vm, &compiler);
+    size_t hardLimit = vm.heap.bytes + extra;
+    setHeapLimits(&vm.heap, 0, hardLimit);
+
+    InterpretResult result = interpret(&vm, source);
+    if (result == COMPILE_ERROR) compileFailed = true;
+    if (result == INTERPRET_OK) ran = true;
+    if (vm.heap.peak > hardLimit) {
+      fprintf(stderr, "the heap grew to %zu bytes under a hard limit of %zu\n",
+          vm.heap.peak, hardLimit);
+      return;
+    }
+
+    freeVM(&vm);
+  }
+
+  if (!compileFailed || !ran) {
+    fprintf(stderr, "hard limits didn't go from a compile error to running\n");
+    return;
+  }
+
+  // a string that grows until the heap is full
+  Compiler compiler;
+  VM vm;
+  startVM(&vm, &compiler);
+  size_t hardLimit = vm.heap.bytes + 512 * 1024;
+  setHeapLimits(&vm.heap, 0, hardLimit);
+  if (interpret(&vm, "var s = \"\"; while (true) { s = s + \"abcdefgh\"; }") != RUNTIME_ERROR) {
+    fprintf(stderr, "filling the heap wasn't a runtime error\n");
+    return;
+  }
+  if (vm.heap.peak > hardLimit) {
+    fprintf(stderr, "the string grew the heap past the hard limit\n");
+    return;
+  }
+
+  freeVM(&vm);
+  puts("testHardLimit() passed");
+}
+
+void testMemory() {
+  printf("=== Memory Tests ===\n");
+  testPools();
+  testFreeHeap();
+  testKindCounters();
+  testSoftLimit();
+  testHardLimit();
+}
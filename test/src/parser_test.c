@@ -7,15 +7,15 @@
 #include <string.h>
 #include <stdbool.h>
 
-static bool testNumber(Expression expr, double expected) {
-  if (expr.type != EXPR_NUMBER) {
+static bool testNumber(const Expression* expr, double expected) {
+  if (expr->type != EXPR_NUMBER) {
     fprintf(stderr, "expression is not EXPR_NUMBER\n");
     return false;
   }
 
-  if (expr.data.number.value != expected) {
+  if (expr->data.number.value != expected) {
     fprintf(stderr, "wrong value. expected=%f got=%f\n",
-        expected, expr.data.number.value);
+        expected, expr->data.number.value);
     return false;
   }
 
@@ -40,19 +40,19 @@ static void testStringExpressions() {
       return;
     }
 
-    Statement statement = stmts.stmts[0];
-    if (statement.type != STMT_EXPR) {
+    Statement* statement = stmts.stmts[0];
+    if (statement->type != STMT_EXPR) {
       fprintf(stderr, "statement not STMT_EXPR\n");
       return;
     }
 
-    Expression expr = statement.data.expressionStmt.expression;
-    if (expr.type != EXPR_STRING) {
+    Expression* expr = statement->data.expressionStmt.expression;
+    if (expr->type != EXPR_STRING) {
       fprintf(stderr, "expression not EXPR_STRING\n");
       return;
     }
 
-    String str = expr.data.string;
+    String str = expr->data.string;
 
     // accounting for opening and closing quotation marks
     int expectedLength = test.expectedNums[i];
@@ -89,14 +89,14 @@ static void testErrors() {
       return;
     }
 
-    Statement statement = stmts.stmts[0];
-    if (statement.type != STMT_EXPR) {
+    Statement* statement = stmts.stmts[0];
+    if (statement->type != STMT_EXPR) {
       fprintf(stderr, "statement is not STMT_EXPR\n");
       return;
     }
 
-    Expression expr = statement.data.expressionStmt.expression;
-    if (expr.type != EXPR_ERROR) {
+    Expression* expr = statement->data.expressionStmt.expression;
+    if (expr->type != EXPR_ERROR) {
       fprintf(stderr, "expr is not EXPR_ERROR\n");
       return;
     }
@@ -119,19 +119,19 @@ static void testBooleanExpressions() {
       return;
     }
 
-    Statement statement = stmts.stmts[0];
-    if (statement.type != STMT_EXPR) {
+    Statement* statement = stmts.stmts[0];
+    if (statement->type != STMT_EXPR) {
       fprintf(stderr, "statement is not STMT_EXPR\n");
       return;
     }
 
-    Expression expr = statement.data.expressionStmt.expression;
-    if (expr.type != EXPR_BOOL) {
+    Expression* expr = statement->data.expressionStmt.expression;
+    if (expr->type != EXPR_BOOL) {
       fprintf(stderr, "expr is not EXPR_BOOL\n");
       return;
     }
 
-    Boolean boolean = expr.data.boolean;
+    Boolean boolean = expr->data.boolean;
     if (boolean.value != test.expectedNums[i]) {
       fprintf(stderr, "wrong value. expected=%d got=%d\n", 
           test.expectedNums[i], boolean.value);
@@ -157,33 +157,29 @@ static void testPrefixExpression() {
       return;
     }
 
-    Statement statement = stmts.stmts[0];
-    if (statement.type != STMT_EXPR) {
+    Statement* statement = stmts.stmts[0];
+    if (statement->type != STMT_EXPR) {
       fprintf(stderr, "statement is not STMT_EXPR\n");
       return;
     }
 
     TokenType expectedOp = source[0] == '!' ? TOKEN_BANG : TOKEN_MINUS;
-    Expression expr = statement.data.expressionStmt.expression;
-    Expression* innerExp = expr.data.prefix.expression;
+    Expression* expr = statement->data.expressionStmt.expression;
+    Expression* innerExp = expr->data.prefix.expression;
 
-    if (expr.type != EXPR_PREFIX) {
+    if (expr->type != EXPR_PREFIX) {
       fprintf(stderr, "expression is not EXPR_PREFIX\n");
-      freeExpression(&expr);
       return;
     }
 
-    if (expr.data.prefix.operator != expectedOp) {
+    if (expr->data.prefix.operator != expectedOp) {
       fprintf(stderr, "wrong prefix operator\n");
-      freeExpression(&expr);
       return;
     }
 
-    if (!testNumber(*innerExp, tests.expectedNums[i])) {
-      freeExpression(&expr);
+    if (!testNumber(innerExp, tests.expectedNums[i])) {
       return;
     }
-    freeExpression(&expr);
     freeStatements(&stmts);
   }
 
@@ -201,11 +197,11 @@ static bool testInfixExpression(const Expression* expr, double left, double righ
     Expression* rightExpr = infix.right;
     TokenType operator = infix.operator;
 
-    if (!testNumber(*leftExpr, left)) {
+    if (!testNumber(leftExpr, left)) {
       return false;
     }
 
-    if (!testNumber(*rightExpr, right)) {
+    if (!testNumber(rightExpr, right)) {
       return false;
     }
 
@@ -236,19 +232,17 @@ static void testInfixExpressions() {
       return;
     }
 
-    Statement statement = stmts.stmts[0];
-    if (statement.type != STMT_EXPR) {
+    Statement* statement = stmts.stmts[0];
+    if (statement->type != STMT_EXPR) {
       fprintf(stderr, "statement is not STMT_EXPR\n");
       return;
     }
 
-    Expression expr = statement.data.expressionStmt.expression;
-    if (!testInfixExpression(&expr, tests.expectedNums[i], tests.expectedNums[i], tests.expectedOp[i])) {
-      freeExpression(&expr);
+    Expression* expr = statement->data.expressionStmt.expression;
+    if (!testInfixExpression(expr, tests.expectedNums[i], tests.expectedNums[i], tests.expectedOp[i])) {
       return;
     }
     
-    freeExpression(&expr);
     freeStatements(&stmts);
   }
 
@@ -269,52 +263,45 @@ static void testGroupExpression() {
       return;
     }
 
-    Statement statement = stmts.stmts[0];
+    Statement* statement = stmts.stmts[0];
 
-    if (statement.type != STMT_EXPR) {
+    if (statement->type != STMT_EXPR) {
       fprintf(stderr, "statement is not STMT_EXPR\n");
       return;
     }
 
-    Expression expr = statement.data.expressionStmt.expression;
-    if (expr.type != EXPR_INFIX) {
+    Expression* expr = statement->data.expressionStmt.expression;
+    if (expr->type != EXPR_INFIX) {
       fprintf(stderr, "top expression is not EXPR_INFIX\n");
-      freeExpression(&expr);
       return;
     }
 
-    Expression* left = expr.data.infix.left;
+    Expression* left = expr->data.infix.left;
     if (left->type != EXPR_GROUP) {
       fprintf(stderr, "left expression is not EXPR_GROUP\n");
-      freeExpression(&expr);
       return;
     }
 
     Expression* innerGroupExpr = left->data.group.expr;
     if (innerGroupExpr->type != EXPR_INFIX) {
       fprintf(stderr, "innerGroupExp is not EXPR_INFIX\n");
-      freeExpression(&expr);
       return;
     }
 
     if (!testInfixExpression(innerGroupExpr, 1, 2, TOKEN_PLUS)) {
-      freeExpression(&expr);
       return;
     }
 
-    Expression* right = expr.data.infix.right;
+    Expression* right = expr->data.infix.right;
     if (right->type != EXPR_NUMBER) {
       fprintf(stderr, "right expression is not EXPR_NUMBER\n");
-      freeExpression(&expr);
       return;
     }
 
-    if (!testNumber(*right, 3)) {
-      freeExpression(&expr);
+    if (!testNumber(right, 3)) {
       return;
     }
 
-    freeExpression(&expr);
     freeStatements(&stmts);
   }
 
@@ -332,21 +319,21 @@ static void testReturnStmt() {
           stmts.count);
       return;
     }
-    Statement statement = stmts.stmts[0];
-    if (statement.type != STMT_RETURN) {
+    Statement* statement = stmts.stmts[0];
+    if (statement->type != STMT_RETURN) {
       fprintf(stderr, "statement is not STMT_RETURN\n");
       return;
     }
 
-    Token token = statement.data.returnStmt.token;
+    Token token = statement->data.returnStmt.token;
     if (memcmp(token.start, "return", token.length) != 0) {
       fprintf(stderr, "Wrong token literal. Expected='return' got='%.*s'\n",
           token.length, token.start);
       return;
     }
 
-    ReturnStatement rs = statement.data.returnStmt;
-    if (rs.expression.type != EXPR_NULL && !testNumber(rs.expression, 10)) {
+    ReturnStatement rs = statement->data.returnStmt;
+    if (rs.expression->type != EXPR_NULL && !testNumber(rs.expression, 10)) {
       return;
     }
     freeStatements(&stmts);
@@ -366,29 +353,28 @@ static void testBlockStmt() {
           stmts.count);
       return;
     }
-    Statement stmt = stmts.stmts[0];
-    if (stmt.type != STMT_BLOCK) {
+    Statement* stmt = stmts.stmts[0];
+    if (stmt->type != STMT_BLOCK) {
       fprintf(stderr, "statement is not STMT_BLOCK\n");
       return;
     }
-    BlockStatement bs = stmt.data.blockStmt;
+    BlockStatement bs = stmt->data.blockStmt;
     Statements inners = bs.stmts;
     if (inners.count != 1) {
       fprintf(stderr, "inner statements does not contain 1 statement. got=%d\n",
           inners.count);
       return;
     }
-    Statement inner = inners.stmts[0];
-    if (inner.type != STMT_EXPR) {
+    Statement* inner = inners.stmts[0];
+    if (inner->type != STMT_EXPR) {
       fprintf(stderr, "inner is not STMT_EXPR\n");
       return;
     }
 
-    Expression expr = inner.data.expressionStmt.expression;
+    Expression* expr = inner->data.expressionStmt.expression;
     if (!testNumber(expr, tests.expectedNums[i])) {
       return;
     }
-    freeStatements(&inners);    
     freeStatements(&stmts);    
   }
   puts("testBlockStmt() passed");
@@ -396,7 +382,8 @@ static void testBlockStmt() {
 
 static void testNumberExpression() {
   Parser parser;
-  Test tests = {.count = 3, .tests = {"10;", "11;", "10.12;"}};
+  Test tests = {.count = 5, .tests = {"10;", "11;", "10.12;", "1234567890;",
+    "3.14159265358979;"}};
   for (int i = 0; i < tests.count; i++) {
     Statements stmts = parse(&parser, tests.tests[i]);
     if (stmts.count != 1) {
@@ -405,14 +392,14 @@ static void testNumberExpression() {
       return;
     }
 
-    Statement statement = stmts.stmts[0];
-    if (statement.type != STMT_EXPR) {
+    Statement* statement = stmts.stmts[0];
+    if (statement->type != STMT_EXPR) {
       fprintf(stderr, "statement is not STMT_EXPR\n");
       return;
     }
 
     double expected = strtod(tests.tests[i], NULL);
-    if (!testNumber(statement.data.expressionStmt.expression, expected)) {
+    if (!testNumber(statement->data.expressionStmt.expression, expected)) {
       return;
     }
     freeStatements(&stmts);
@@ -435,21 +422,21 @@ static void testVarStmt() {
       return;
     }
 
-    Statement statement = stmts.stmts[0];
-    if (statement.type != STMT_VAR) {
+    Statement* statement = stmts.stmts[0];
+    if (statement->type != STMT_VAR) {
       fprintf(stderr, "statement is not STMT_VAR\n");
       return;
     }
 
-    Token token = statement.data.varStmt.token;
+    Token token = statement->data.varStmt.token;
     if (memcmp(token.start, "var", token.length) != 0) {
       fprintf(stderr, "wrong token literal. expected='var' got=%.*s",
           token.length, token.start);
       return;
     }
 
-    Expression expr = statement.data.varStmt.value;
-    if (expr.type != EXPR_NULL && !testNumber(expr, 10)) {
+    Expression* expr = statement->data.varStmt.value;
+    if (expr->type != EXPR_NULL && !testNumber(expr, 10)) {
       return;
     }
 
@@ -473,13 +460,13 @@ void testIfStatement() {
       return;
     }
 
-    Statement stmt = stmts.stmts[0];
-    if (stmt.type != STMT_IF) {
+    Statement* stmt = stmts.stmts[0];
+    if (stmt->type != STMT_IF) {
       fprintf(stderr, "stmt is not STMT_IF\n");
       return;
     }
 
-    IfStatement is = AS_IFSTMT(stmt);
+    IfStatement is = AS_IFSTMT((*stmt));
     BlockStatement block = is.block;
     Statements inner = block.stmts;
 
@@ -489,15 +476,15 @@ void testIfStatement() {
       return;
     }
 
-    Statement innerStmt = inner.stmts[0];
-    if (innerStmt.type != STMT_EXPR) {
+    Statement* innerStmt = inner.stmts[0];
+    if (innerStmt->type != STMT_EXPR) {
       fprintf(stderr, "innerStmt is not STMT_EXPR\n");
       return;
     }
 
-    Expression expr;
+    Expression* expr = NULL;
     if (i == 0) {
-      expr = AS_EXPRSTMT(innerStmt).expression;
+      expr = AS_EXPRSTMT((*innerStmt)).expression;
       if (is.elseBlock.token.type != TOKEN_NULL) {
         fprintf(stderr, "else block should be null\n");
         return;
@@ -510,14 +497,13 @@ void testIfStatement() {
         return;
       }
 
-      Statement innerElseStmt = innerElse.stmts[0];
-      if (innerElseStmt.type != STMT_EXPR) {
+      Statement* innerElseStmt = innerElse.stmts[0];
+      if (innerElseStmt->type != STMT_EXPR) {
         fprintf(stderr, "innerElseStmt is not STMT_EXPR\n");
         return;
       }
 
-      expr = AS_EXPRSTMT(innerElseStmt).expression;
-      freeStatements(&innerElse);
+      expr = AS_EXPRSTMT((*innerElseStmt)).expression;
     }
 
     if (!testNumber(expr, test.expectedNums[i])) {
@@ -525,7 +511,6 @@ void testIfStatement() {
     }
 
     freeStatements(&stmts);
-    freeStatements(&inner);
     
   }
   puts("testIfStatement() passed");
@@ -545,13 +530,13 @@ static void testWhileStatement() {
       return;
     }
 
-    Statement stmt = stmts.stmts[0];
-    if (stmt.type != STMT_WHILE) {
+    Statement* stmt = stmts.stmts[0];
+    if (stmt->type != STMT_WHILE) {
       fprintf(stderr, "stmt is not STMT_WHILE\n");
       return;
     }
 
-    BlockStatement block = AS_WHILESTMT(stmt).block;
+    BlockStatement block = AS_WHILESTMT((*stmt)).block;
     Statements inner = block.stmts;
 
     if (inner.count != 1) {
@@ -560,19 +545,18 @@ static void testWhileStatement() {
       return;
     }
 
-    Statement innerStmt = inner.stmts[0];
-    if (innerStmt.type != STMT_EXPR) {
+    Statement* innerStmt = inner.stmts[0];
+    if (innerStmt->type != STMT_EXPR) {
       fprintf(stderr, "innerStmt not STMT_EXPR\n");
       return;
     }
 
-    Expression expr = AS_EXPRSTMT(innerStmt).expression;
+    Expression* expr = AS_EXPRSTMT((*innerStmt)).expression;
     if (!testNumber(expr, 10.0)) {
       return;
     }
 
     freeStatements(&stmts);
-    freeStatements(&inner);
   }
 
   puts("testWhileStatement() passed");
@@ -597,13 +581,13 @@ static void testFunctionStatement() {
       return;
     }
 
-    Statement stmt = stmts.stmts[0];
-    if (stmt.type != STMT_FUNCTION) {
+    Statement* stmt = stmts.stmts[0];
+    if (stmt->type != STMT_FUNCTION) {
       fprintf(stderr, "stmt is not STMT_FUNCTION\n");
       return;
     }
 
-    FunctionStatement fs = AS_FUNCSTMT(stmt);
+    FunctionStatement fs = AS_FUNCSTMT((*stmt));
 
     if (memcmp(fs.name.start, "doStuff", fs.name.length) != 0) {
       fprintf(stderr, "fs.name does not equal doStuff. got=%.*s\n",
@@ -635,18 +619,17 @@ static void testFunctionStatement() {
       return;
     }
 
-    Statement innerStmt = inner.stmts[0];
-    if (innerStmt.type != STMT_EXPR) {
+    Statement* innerStmt = inner.stmts[0];
+    if (innerStmt->type != STMT_EXPR) {
       fprintf(stderr, "innerStmt is not STMT_EXPR\n");
       return;
     }
 
-    Expression expr = AS_EXPRSTMT(innerStmt).expression;
+    Expression* expr = AS_EXPRSTMT((*innerStmt)).expression;
 
     if (!testNumber(expr, 10.0)) {
       return;
     }
-    freeStatements(&inner);
     freeStatements(&stmts);
   }
 
@@ -667,20 +650,20 @@ static void testCallExpression() {
       return;
     }
 
-    Statement stmt = stmts.stmts[0];
-    if (stmt.type != STMT_EXPR) {
+    Statement* stmt = stmts.stmts[0];
+    if (stmt->type != STMT_EXPR) {
       fprintf(stderr, "stmt is not STMT_EXPR\n");
       return;
     }
 
-    Expression expr = AS_EXPRSTMT(stmt).expression;
-    if (expr.type != EXPR_CALL) {
+    Expression* expr = AS_EXPRSTMT((*stmt)).expression;
+    if (expr->type != EXPR_CALL) {
       fprintf(stderr, "expr is not EXPR_CALL\n");
       return;
     }
 
 
-    CallExpression call = expr.data.call;
+    CallExpression call = expr->data.call;
     if (call.argCount != test.expectedNums[i]) {
       fprintf(stderr, "argCount wrong. expected=%d got=%d\n",
           test.expectedNums[i], call.argCount);
@@ -0,0 +1,118 @@
+#include <string_test.h>
+#include <vm_test_util.h>
+#include <compiler.h>
+#include <gc.h>
+#include <object.h>
+#include <value.h>
+#include <vm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void testInterning() {
+  const char* source =
+    "var a = \"hel\" + \"lo\";"
+    "var b = \"he\" + \"llo\";"
+    "var c = \"hello\";"
+    "var d = \"wor\" + \"ld\";";
+
+  Compiler compiler;
+  VM vm;
+  if (!runScript(&vm, &compiler, source)) {
+    fprintf(stderr, "interning script failed\n");
+    return;
+  }
+
+  // strings made at run time find the constant with the same contents
+  Obj* hello = AS_OBJ(getGlobal(&vm, "c"));
+  if (AS_OBJ(getGlobal(&vm, "a")) != hello || AS_OBJ(getGlobal(&vm, "b")) != hello) {
+    fprintf(stderr, "equal strings are different objects\n");
+    return;
+  }
+  if ((Obj*)copyString(&vm, "hello", 5) != hello) {
+    fprintf(stderr, "copyString made a second hello\n");
+    return;
+  }
+
+  // promoting a young string replaces it in the set
+  if (!IS_YOUNG(&vm, AS_OBJ(getGlobal(&vm, "d")))) {
+    fprintf(stderr, "world is not young\n");
+    return;
+  }
+  collectNursery(&vm, NULL, 0);
+  Obj* world = AS_OBJ(getGlobal(&vm, "d"));
+  if (IS_YOUNG(&vm, world) || (Obj*)copyString(&vm, "world", 5) != world) {
+    fprintf(stderr, "promoted world is not the interned one\n");
+    return;
+  }
+
+  freeVM(&vm);
+  puts("testInterning() passed");
+}
+
+static void testRopes() {
+  const char* source =
+    "var piece = \"abcdefghij\";"
+    "var left = \"\"; var right = \"\"; var i = 0;"
+    "while (i < 100) { left = left + piece; right = piece + right; i = i + 1; }"
+    "var same = left == right;"
+    "var longer = left == right + \"x\";"
+    "var built = \"0123456789012345678901234567890\" + \"123456789012345678901234567890123\";"
+    "var literal = built == \"0123456789012345678901234567890123456789012345678901234567890123\";";
+
+  Compiler compiler;
+  VM vm;
+  if (!runScript(&vm, &compiler, source)) {
+    fprintf(stderr, "rope script failed\n");
+    return;
+  }
+
+  Value left = getGlobal(&vm, "left");
+  Value right = getGlobal(&vm, "right");
+  if (!IS_ROPE(left) || !IS_ROPE(right) || !IS_ROPE(getGlobal(&vm, "built"))) {
+    fprintf(stderr, "long concatenations are not ropes\n");
+    return;
+  }
+
+  if (!AS_BOOL(getGlobal(&vm, "same")) || AS_BOOL(getGlobal(&vm, "longer")) ||
+      !AS_BOOL(getGlobal(&vm, "literal"))) {
+    fprintf(stderr, "wrong rope equality\n");
+    return;
+  }
+
+  // a left-leaning and a right-leaning rope flatten to one string
+  ObjString* flat = flattenString(&vm, left);
+  if (flat == NULL || flat->length != 1000) {
+    fprintf(stderr, "flattened rope has the wrong length\n");
+    return;
+  }
+  for (int i = 0; i < 1000; i++) {
+    if (flat->str[i] != 'a' + i % 10) {
+      fprintf(stderr, "flattened rope differs at %d\n", i);
+      return;
+    }
+  }
+  if (flat->str[1000] != '\0') {
+    fprintf(stderr, "flattened rope is not terminated\n");
+    return;
+  }
+
+  ObjRope* rope = AS_ROPE(left);
+  if (rope->flat != flat || rope->left != NULL || rope->right != NULL) {
+    fprintf(stderr, "rope kept its halves after flattening\n");
+    return;
+  }
+  if (flattenString(&vm, left) != flat || flattenString(&vm, right) != flat) {
+    fprintf(stderr, "equal ropes flattened to different strings\n");
+    return;
+  }
+
+  freeVM(&vm);
+  puts("testRopes() passed");
+}
+
+void testStrings() {
+  printf("=== String Tests ===\n");
+  testInterning();
+  testRopes();
+}
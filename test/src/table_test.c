@@ -4,16 +4,15 @@
 #include <stdio.h>
 #include <object.h>
 #include <string.h>
+#include <stdlib.h>
 
-static ObjString createKey(char* str) {
+static ObjString* createKey(char* str) {
   int length = strlen(str);
-  uint32_t hash = hashString(str, length);
-  ObjString key = {
-    .obj = {.type = OBJ_STRING},
-    .str = str,
-    .length = length,
-    .hash = hash
-  };
+  ObjString* key = malloc(STRING_SIZE(length));
+  key->obj.type = OBJ_STRING;
+  key->length = length;
+  key->hash = hashString(str, length);
+  memcpy(key->str, str, length + 1);
 
   return key;
 }
@@ -30,15 +29,15 @@ static void testSetTable() {
 
   for (int i = 0; i < test.count; i++) {
     char* str = (char*)test.keys[i];
-    ObjString key = createKey(str);
+    ObjString* key = createKey(str);
     
-    bool newKey = tableSet(&table, &key, test.vals[i]);
+    bool newKey = tableSet(&table, key, test.vals[i]);
     if (!newKey) {
       fprintf(stderr, "%s key already set\n", str);
       return;
     }
 
-    newKey = tableSet(&table, &key, NUMBER_VAL(100));
+    newKey = tableSet(&table, key, NUMBER_VAL(100));
     if (newKey) {
       fprintf(stderr, "%s key not set\n", str);
       return;
@@ -62,12 +61,12 @@ static void testGetTable() {
 
   for (int i = 0; i < test.count; i++) {
     char* str = (char*)test.keys[i];
-    ObjString key = createKey(str);
+    ObjString* key = createKey(str);
     Value val = test.vals[i];
-    tableSet(&table, &key, val);
+    tableSet(&table, key, val);
 
     Value emptyVal;
-    bool found = tableGet(&table, &key, &emptyVal);
+    bool found = tableGet(&table, key, &emptyVal);
 
     if (!found) {
       fprintf(stderr, "%s key not found\n", str);
@@ -102,17 +101,17 @@ static void testDeleteTable() {
 
   for (int i = 0; i < test.count; i++) {
     char* str = (char*)test.keys[i];
-    ObjString key = createKey(str);
+    ObjString* key = createKey(str);
     Value val = test.vals[i];
-    tableSet(&table, &key, val);
+    tableSet(&table, key, val);
 
-    bool success = tableDelete(&table, &key);
+    bool success = tableDelete(&table, key);
     if (!success) {
       fprintf(stderr, "%s was not sucessfully deleted\n", str);
       return;
     }
     Value emptyVal;
-    bool found = tableGet(&table, &key, &emptyVal);
+    bool found = tableGet(&table, key, &emptyVal);
 
     if (found) {
       fprintf(stderr,"%s key was found after deletion\n", str);
@@ -124,9 +123,59 @@ static void testDeleteTable() {
 
 }
 
+static void testFindString() {
+  TableTest test = {
+    .count = 2,
+    .keys = {"height", "age"},
+    .vals = {NUMBER_VAL(60), NUMBER_VAL(36)}
+  };
+
+  Table table;
+  initTable(&table);
+
+  if (tableFindString(&table, "age", 3, hashString("age", 3)) != NULL) {
+    fprintf(stderr, "found a key in an empty table\n");
+    return;
+  }
+
+  ObjString* keys[2];
+  for (int i = 0; i < test.count; i++) {
+    keys[i] = createKey((char*)test.keys[i]);
+    tableSet(&table, keys[i], test.vals[i]);
+  }
+
+  for (int i = 0; i < test.count; i++) {
+    const char* str = test.keys[i];
+    int length = strlen(str);
+    ObjString* found = tableFindString(&table, str, length, hashString(str, length));
+    if (found != keys[i]) {
+      fprintf(stderr, "%s not found by its characters\n", str);
+      return;
+    }
+  }
+
+  // same length as a key, and a prefix of one
+  if (tableFindString(&table, "ago", 3, hashString("ago", 3)) != NULL ||
+      tableFindString(&table, "heigh", 5, hashString("heigh", 5)) != NULL) {
+    fprintf(stderr, "found a key that was never set\n");
+    return;
+  }
+
+  // deleting one key leaves the other findable
+  tableDelete(&table, keys[0]);
+  if (tableFindString(&table, "age", 3, keys[1]->hash) != keys[1]) {
+    fprintf(stderr, "age not found after a delete\n");
+    return;
+  }
+
+  freeTable(&table);
+  puts("testFindString() passed");
+}
+
 void testTable() {
   printf("=== Hash Table Tests ===\n");
   testSetTable();
   testGetTable();
   testDeleteTable();
+  testFindString();
 }
@@ -0,0 +1,26 @@
+#include <vm_test_util.h>
+#include <string.h>
+
+void startVM(VM* vm, Compiler* compiler) {
+  initVM(vm, compiler);
+  initCompiler(vm, compiler, TYPE_SCRIPT);
+}
+
+bool runSource(VM* vm, const char* source) {
+  return interpret(vm, source) == INTERPRET_OK;
+}
+
+bool runScript(VM* vm, Compiler* compiler, const char* source) {
+  startVM(vm, compiler);
+  return runSource(vm, source);
+}
+
+Value getGlobal(VM* vm, const char* name) {
+  return vm->globals.data[resolveGlobalSlot(vm, name, strlen(name))];
+}
+
+void defineTestNative(VM* vm, const char* name, NativeFunc func, int arity, uint8_t flags) {
+  // the name is allocated first, the native isn't reachable until it is stored
+  int slot = resolveGlobalSlot(vm, name, strlen(name));
+  vm->globals.data[slot] = OBJ_VAL(newNative(vm, func, arity, flags));
+}